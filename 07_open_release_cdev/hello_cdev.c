@@ -3,8 +3,28 @@
 #include <linux/module.h>
 #include <linux/init.h>
 #include <linux/fs.h>  // "fs" stands for "file system."
+#include <linux/cdev.h>
+#include <linux/slab.h>  // For `kzalloc_node()` and `kfree()`.
+#include <linux/nodemask.h>  // For `for_each_online_node()`.
+#include <linux/atomic.h>
 
-static int major_dev_num;  // Major device number that will be allocated by our kernel module.
+/**
+ * @brief State of one minor device.
+ */
+struct hello_dev {
+    struct cdev cdev;
+    int node;  // NUMA node that this struct was allocated on.
+    atomic_t open_count;  // Number of files that are currently open on this device.
+};
+
+#define HELLO_MAX_DEVS 64
+
+static dev_t first_dev_num;  // Major and first minor device number that were allocated by our kernel module.
+static struct hello_dev *devs[HELLO_MAX_DEVS];
+
+static unsigned int nr_devs = 4;
+module_param(nr_devs, uint, 0444);
+MODULE_PARM_DESC(nr_devs, "Number of minor devices to create (1-64)");
 
 /**
  * @brief Callback function for when the device file is opened.
@@ -13,25 +33,36 @@ static int major_dev_num;  // Major device number that will be allocated by our
  *     opened device file, among other things.
  * @param[in] file: Represents an open file in the Linux kernel. This struct is created when \n
  *     we're opening a file (before calling "open" callback function), and destroyed after \n
- *     calling the release function. This only lives as long as the file is opened.
+ *     calling the release function. This only lives as long as the file is opened. \n
+ *     `file->private_data` is ours to use for as long as the file is open.
  * @return Return code.
  */
 static int my_open(struct inode *inode, struct file *filep) {
+    // Every minor number has its own `struct hello_dev` with the `cdev` embedded in it. Remember the
+    // device in the file, so the other callbacks don't have to look it up again.
+    struct hello_dev *dev = container_of(inode->i_cdev, struct hello_dev, cdev);
+    int open_files = atomic_inc_return(&dev->open_count);
+
+    filep->private_data = dev;
+
+    // Every `open()` ends up here, so only the default (DEBUG) build profile prints. The arguments of
+    // `pr_debug()` may never be evaluated, which is why the counter is updated above.
 
     // Print out the major and minor device numbers of the currently opened file.
-    pr_info("hello_cdev - Major: %d, Minor %d\n", imajor(inode), iminor(inode));
+    pr_debug("hello_cdev - Major: %d, Minor %d, Node %d, Open files %d\n", imajor(inode), iminor(inode),
+             dev->node, open_files);
 
     // Print out the file position of the currently opened file.
-    pr_info("hello_cdev - filep->f_pos: %lld\n", filep->f_pos);
+    pr_debug("hello_cdev - filep->f_pos: %lld\n", filep->f_pos);
 
     // Print out the permissions of the currently opened file.
     // `file.f_mode` allows us to read back the permissions given to this file. Before a read or
     // write function is called, it checks if the permissions are there to read or write.
     // If not, the callback function specified in our driver is never called.
-    pr_info("hello_cdev - filep->f_mode: %u\n", filep->f_mode);
+    pr_debug("hello_cdev - filep->f_mode: %u\n", filep->f_mode);
 
     // Print out the flags of the currently opened file.
-    pr_info("hello_cdev - filep->f_flags: %u\n", filep->f_flags);
+    pr_debug("hello_cdev - filep->f_flags: %u\n", filep->f_flags);
 
     return 0;  // Indicate that opening the file was successful.
 }
@@ -42,40 +73,115 @@ static int my_open(struct inode *inode, struct file *filep) {
  * @return Return code.
  */
 static int my_release(struct inode *inode, struct file *filep) {
-    pr_info("hello_cdev - File is closed.\n");
+    struct hello_dev *dev = filep->private_data;
+    int open_files = atomic_dec_return(&dev->open_count);
+
+    pr_debug("hello_cdev - File is closed. Open files on minor %d: %d\n", iminor(inode), open_files);
     return 0;
 }
 
 static struct file_operations fops = {
     // Set file operations function pointers to our own functions.
+    .owner = THIS_MODULE,
     .open = my_open,
     .release = my_release,
 };
 
+/**
+ * @brief Picks the NUMA node for the device with the minor number `minor`.
+ * @details
+ * Spreads the devices over the online nodes, so every node has devices with node-local state.
+ */
+static int hello_dev_node(unsigned int minor) {
+    unsigned int n = minor % num_online_nodes();
+    int node;
+
+    for_each_online_node(node)
+        if (n-- == 0)
+            break;
+
+    return node;
+}
+
+/**
+ * @brief Allocates and registers the device with the minor number `minor`.
+ *
+ * @return The new device, or an `ERR_PTR()`.
+ */
+static struct hello_dev *hello_dev_create(unsigned int minor) {
+    struct hello_dev *dev;
+    int node = hello_dev_node(minor);
+    int ret;
+
+    dev = kzalloc_node(sizeof(*dev), GFP_KERNEL, node);
+    if (!dev)
+        return ERR_PTR(-ENOMEM);
+
+    dev->node = node;
+    atomic_set(&dev->open_count, 0);
+
+    // `cdev_init()` links the character device to our file operations, `cdev_add()` makes it live.
+    // From this point on, `my_open()` can be called for this minor number.
+    cdev_init(&dev->cdev, &fops);
+    dev->cdev.owner = THIS_MODULE;
+    ret = cdev_add(&dev->cdev, MKDEV(MAJOR(first_dev_num), minor), 1);
+    if (ret) {
+        kfree(dev);
+        return ERR_PTR(ret);
+    }
+
+    return dev;
+}
+
 /**
  * @brief Callback function for when the module is loaded into the kernel.
  * 
  * @return Zero if the loading of the module was successful.
  */
 static int __init my_init(void) {
-    // `register_chrdev()`:
-    //   Will allocate device numbers, create a character device, and link the device numbers to the character device.
-    //   • 1st arg is the major device number that it should allocate for the device number.
-    //       • If zero, it will search for and use a free device number.
-    //       • If non-zero, it will allocate all 255 minor device numbers for that major device number.
-    //   • 2nd arg is a label, which will appear in `/proc/devices`.
-    //   • 3rd arg is a pointer to the file operations, which should be supported by our character device.
-    major_dev_num = register_chrdev(0, "hello_cdev", &fops);
-
-    // Check for error while registering the character device.
-    if (major_dev_num < 0) {
-        pr_err("hello_cdev - Error registering character device\n");
-        return major_dev_num;
+    unsigned int i;
+    int ret;
+
+    if (nr_devs == 0 || nr_devs > HELLO_MAX_DEVS) {
+        pr_err("hello_cdev - nr_devs must be between 1 and %d, got %u\n", HELLO_MAX_DEVS, nr_devs);
+        return -EINVAL;
+    }
+
+    // `alloc_chrdev_region()`:
+    //   Allocates a free major device number together with `nr_devs` minor device numbers.
+    //   • 1st arg receives the first device number (major and first minor) of the region.
+    //   • 2nd arg is the first minor device number that we want.
+    //   • 3rd arg is the number of minor device numbers that we want.
+    //   • 4th arg is a label, which will appear in `/proc/devices`.
+    // Unlike `register_chrdev()`, this doesn't create a character device yet. We add one `cdev` per
+    // minor number ourselves, so every minor can have its own state.
+    ret = alloc_chrdev_region(&first_dev_num, 0, nr_devs, "hello_cdev");
+
+    // Check for error while allocating the device numbers.
+    if (ret < 0) {
+        pr_err("hello_cdev - Error allocating device numbers\n");
+        return ret;
+    }
+
+    for (i = 0; i < nr_devs; i++) {
+        devs[i] = hello_dev_create(i);
+        if (IS_ERR(devs[i])) {
+            ret = PTR_ERR(devs[i]);
+            goto err;
+        }
     }
 
-    // The registration of the character device worked.
-    pr_info("hello_cdev - Major device number: %d\n", major_dev_num);
+    // The registration of the character devices worked.
+    pr_info("hello_cdev - Major device number: %d, %u devices\n", MAJOR(first_dev_num), nr_devs);
     return 0;
+
+err:
+    while (i--) {
+        cdev_del(&devs[i]->cdev);
+        kfree(devs[i]);
+    }
+    unregister_chrdev_region(first_dev_num, nr_devs);
+    return ret;
 }
 
 /**
@@ -87,9 +193,16 @@ static int __init my_init(void) {
  *   • Makes this function only available within this kernel module.
  */
 static void __exit my_exit(void) {
-    // Delete the character device and free the allocated device numbers via `unregister_chrdev()`.
-    // `unregister_chrdev()`'s 2nd arg is the label that appears in `/proc/devices`.
-    unregister_chrdev(major_dev_num, "hello_cdev");
+    unsigned int i;
+
+    // Delete the character devices and free their state.
+    for (i = 0; i < nr_devs; i++) {
+        cdev_del(&devs[i]->cdev);
+        kfree(devs[i]);
+    }
+
+    // Free the allocated device numbers.
+    unregister_chrdev_region(first_dev_num, nr_devs);
 }
 
 // Specify the function to use when the module is loaded into the kernel.
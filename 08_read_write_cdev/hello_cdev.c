@@ -3,123 +3,1013 @@
 #include <linux/module.h>
 #include <linux/init.h>
 #include <linux/fs.h>  // "fs" stands for "file system."
+#include <linux/cdev.h>
+#include <linux/nodemask.h>  // For `for_each_online_node()`.
+#include <linux/slab.h>  // For `kzalloc_node()` and `kfree()`.
+#include <linux/mm.h>  // For `alloc_pages_node()` and `vm_map_pages()`.
+#include <linux/pagemap.h>  // For `lock_page()` and `unlock_page()`.
+#include <linux/xarray.h>
+#include <linux/vmalloc.h>  // For `vmap()`.
+#include <linux/mutex.h>
+#include <linux/wait.h>
+#include <linux/poll.h>
+#include <linux/log2.h>  // For `is_power_of_2()`.
+#include <linux/uio.h>  // For `struct iov_iter`, `copy_to_iter()` and `copy_from_iter()`.
 
-static int major_dev_num;  // Major device number that will be allocated by our kernel module.
-static char text[64];
+#include <cdev_stats.h>
+#include "hello_cdev.h"
 
+// Defines the tracepoints. Exactly one source file of a module has to do this.
+#define CREATE_TRACE_POINTS
+#include "hello_cdev_trace.h"
 
 /**
- * @brief The `read()` callback function. Writes from kernel space to user space.
+ * @brief A multi-producer, single-consumer ring buffer.
+ * @details
+ * Positions (`head` and `tail`) are free-running counters. They are turned into an index into `data`
+ * with `pos & mask`, which is why the size of the ring has to be a power of two.
+ *   • Producers reserve space by moving `head` forward with a compare-and-exchange. After that they
+ *     own the reserved bytes and copy into them without holding any lock, so concurrent writers
+ *     never touch each other's records and never wait for each other's `copy_from_user()`.
+ *   • The consumer walks the records from `tail` to `head`. It stops at the first record whose
+ *     producer hasn't committed it yet, so records are always read in the order they were reserved.
  *
- * @param[in] filp: An opened file in the Linux kernel.
- * @param[in] user_buf: A user space buffer.
- * @param[in] len: Length of the buffer.
- * @param[inout] off: Our current file offset.
+ * The ring lives in individually allocated pages, so that it can be mapped into user space:
+ * page 0 holds the `struct hello_ring_ctrl` with both cursors, the data area follows.
+ */
+struct hello_ring {
+    struct hello_ring_ctrl *ctrl;  // Shared with user space. Holds `head` and `tail`.
+    char *data;
+    u32 mask;  // `ring_size - 1`.
+
+    struct page **pages;  // Control page followed by the data pages.
+    unsigned int nr_pages;
+    void *vaddr;  // Contiguous kernel mapping of `pages`.
+
+    // Consumer side of `read()`.
+    size_t rd_off;  // How many payload bytes of the record at `tail` were already read.
+    struct mutex rd_lock;
+
+    wait_queue_head_t space_wq;  // Writers sleep here while the ring is full.
+    wait_queue_head_t data_wq;  // Readers and `poll()` wait here for a committed record.
+};
+
+/**
+ * @brief State of one minor device. Every minor has its own ring on its own NUMA node.
+ */
+struct hello_dev {
+    struct hello_ring ring;
+    struct cdev cdev;
+    int node;  // NUMA node that the ring and this struct were allocated on.
+};
+
+/**
+ * @brief A sparse, seekable RAM store of `store_size` bytes. It is the minor after the rings.
+ * @details
+ * Unlike the rings, the store is random access: reads and writes start at the file position, so
+ * `lseek()`, `pread()` and `pwrite()` work like on a regular file of fixed size. A page is only
+ * allocated when it is written for the first time, pages that were never written read as zeros.
  *
- * @return The number of bytes that were read successfully.
+ * The pages are kept in an xarray, indexed by page number. Lookups don't take any lock, and pages
+ * are only freed when the module is removed, so a page stays valid after it was looked up.
+ * Accesses to the same page are serialized with the lock of that page, so a read never sees half
+ * of a write to the same page. Accesses to different pages run in parallel.
  */
-static ssize_t my_read(struct file *filp, char __user *user_buf, size_t len, loff_t *off) {
-    // With `struct file`, we can:
-    //   • Access the permissions of this file.
-    //   • Access the file operations which were supported by this file.
-    //   • Use the private data.
-    // We want the `user_buf` to have the data after we are done with the `read` function.
-    int num_bytes_not_copied;
-    int bytes_copied;
+struct hello_store {
+    struct xarray pages;  // `struct page *`s, indexed by page number.
+    atomic_long_t nr_pages;  // Pages that were allocated so far.
+    struct cdev cdev;
+    int node;  // NUMA node that the pages are allocated on.
+};
+
+#define HELLO_MAX_DEVS 64
+
+static dev_t first_dev_num;  // Major and first minor device number that were allocated by our kernel module.
+static struct hello_dev *devs[HELLO_MAX_DEVS];
+static struct hello_store *store_dev;  // NULL if `store_size` is zero.
+static unsigned int nr_minors;  // The rings and the store.
+
+static unsigned int ring_size = 65536;
+module_param(ring_size, uint, 0444);
+MODULE_PARM_DESC(ring_size, "Size of the ring buffer of every device in bytes (power of two, at least PAGE_SIZE)");
+
+static unsigned int nr_devs = 4;
+module_param(nr_devs, uint, 0444);
+MODULE_PARM_DESC(nr_devs, "Number of minor devices to create (1-64)");
+
+static unsigned long long store_size = 1ULL << 30;
+module_param(store_size, ullong, 0444);
+MODULE_PARM_DESC(store_size, "Size of the sparse store device (the minor after the rings) in bytes, 0 for no store");
 
-    // The maximum bytes we can copy is what is remaining in the `text` buffer.
-    int num_bytes_to_copy = (len + *off) < sizeof(text) ? len : (sizeof(text) - *off);
+static int dev_nodes[HELLO_MAX_DEVS] = { [0 ... HELLO_MAX_DEVS - 1] = NUMA_NO_NODE };
+static unsigned int nr_dev_nodes;
+module_param_array(dev_nodes, int, &nr_dev_nodes, 0444);
+MODULE_PARM_DESC(dev_nodes, "NUMA node of every minor device, -1 to spread them over the online nodes");
+
+// Per-CPU counters, in /sys/module/hello_cdev/stats/{read,write}.
+CDEV_STATS_DEFINE(read);
+CDEV_STATS_DEFINE(write);
+
+static struct attribute *stats_attrs[] = {
+    &read_attr.attr,
+    &write_attr.attr,
+    NULL,
+};
+
+static const struct attribute_group stats_group = {
+    .name = "stats",
+    .attrs = stats_attrs,
+};
+
+/**
+ * @brief Copies `len` bytes from `from` into the ring, starting at position `pos`.
+ *
+ * @return The number of bytes that were copied.
+ */
+static size_t ring_copy_from_iter(struct hello_ring *ring, u32 pos, size_t len, struct iov_iter *from) {
+    size_t idx = pos & ring->mask;
+    size_t first = min_t(size_t, len, ring_size - idx);  // Bytes until the end of the ring.
+    size_t copied = copy_from_iter(ring->data + idx, first, from);
+
+    if (copied < first)
+        return copied;
+
+    // Continue at the start of the ring with the part that wrapped around.
+    return copied + copy_from_iter(ring->data, len - first, from);
+}
+
+/**
+ * @brief Copies `len` bytes from the ring, starting at position `pos`, into `to`.
+ *
+ * @return The number of bytes that were copied.
+ */
+static size_t ring_copy_to_iter(struct hello_ring *ring, struct iov_iter *to, u32 pos, size_t len) {
+    size_t idx = pos & ring->mask;
+    size_t first = min_t(size_t, len, ring_size - idx);
+    size_t copied = copy_to_iter(ring->data + idx, first, to);
+
+    if (copied < first)
+        return copied;
+
+    return copied + copy_to_iter(ring->data, len - first, to);
+}
 
-    pr_info("hello_cdev - Read is called, we want to read %ld bytes, but actually read %d bytes. The offset is %lld.\n", len, num_bytes_to_copy, *off);
+/**
+ * @brief Clears `len` bytes of the ring, starting at position `pos`.
+ * @details
+ * Consumed records are zeroed before their space is handed back to the producers. Otherwise stale
+ * payload bytes could look like a committed record header to the consumer on the next lap.
+ */
+static void ring_zero(struct hello_ring *ring, u32 pos, size_t len) {
+    size_t idx = pos & ring->mask;
+    size_t first = min_t(size_t, len, ring_size - idx);
+
+    memset(ring->data + idx, 0, first);
+    memset(ring->data, 0, len - first);
+}
+
+/**
+ * @brief Returns true if `total` more bytes fit between the consumer and the producers.
+ */
+static bool ring_has_space(struct hello_ring *ring, u32 total) {
+    return READ_ONCE(ring->ctrl->head) - smp_load_acquire(&ring->ctrl->tail) + total <= ring_size;
+}
+
+/**
+ * @brief Wait condition of the writers: asks the consumer for a wake-up, then checks for space.
+ * @details
+ * The full barrier orders the flag before the look at `tail`. It pairs with the barrier in
+ * `ring_wake_writers()`, so either we see the new `tail`, or the consumer sees our flag and wakes us.
+ */
+static bool ring_wait_space(struct hello_ring *ring, u32 total) {
+    WRITE_ONCE(ring->ctrl->flags, HELLO_RING_NEED_WAKEUP);
+    smp_mb();
+    return ring_has_space(ring, total);
+}
+
+/**
+ * @brief Wakes up the writers that wait for space, if there are any. Called after `tail` moved.
+ */
+static void ring_wake_writers(struct hello_ring *ring) {
+    // Pairs with the barrier in `ring_wait_space()`.
+    smp_mb();
+    if (READ_ONCE(ring->ctrl->flags) & HELLO_RING_NEED_WAKEUP) {
+        WRITE_ONCE(ring->ctrl->flags, 0);
+        wake_up_interruptible(&ring->space_wq);
+    }
+}
+
+/**
+ * @brief Returns true if the record at `tail` is committed (or discarded), so a read makes progress.
+ */
+static bool ring_readable(struct hello_ring *ring) {
+    u32 tail = READ_ONCE(ring->ctrl->tail);
+    struct hello_rec_hdr *hdr = (struct hello_rec_hdr *)(ring->data + (tail & ring->mask));
+
+    return tail != READ_ONCE(ring->ctrl->head) && smp_load_acquire(&hdr->flags);
+}
+
+/**
+ * @brief Reserves `total` bytes in the ring for a single producer.
+ *
+ * @param[in] total: Number of bytes to reserve (record header included).
+ * @param[in] nonblock: Return `-EAGAIN` instead of sleeping when the ring is full.
+ * @param[out] pos: Position of the reserved bytes.
+ *
+ * @return Zero on success, a negative error code otherwise.
+ */
+static int ring_reserve(struct hello_ring *ring, u32 total, bool nonblock, u32 *pos) {
+    u32 head;
+
+    for (;;) {
+        head = READ_ONCE(ring->ctrl->head);
+
+        if (head - smp_load_acquire(&ring->ctrl->tail) + total > ring_size) {
+            if (nonblock)
+                return -EAGAIN;
+
+            // Sleep until the consumer has freed enough space. `read()` wakes us up when it moves
+            // `tail`, a consumer that goes through the mapping calls `HELLO_RING_WAKE`.
+            if (wait_event_interruptible(ring->space_wq, ring_wait_space(ring, total)))
+                return -ERESTARTSYS;
+
+            continue;
+        }
+
+        // Another producer may have moved `head` since we read it. In that case, try again.
+        if (cmpxchg(&ring->ctrl->head, head, head + total) == head)
+            break;
+    }
+
+    *pos = head;
+    return 0;
+}
 
-    // We can't read any bytes if the offset is at or beyond the end of the `text` buffer.
-    if (*off >= sizeof(text))
+/**
+ * @brief Returns true if the caller asked us not to sleep.
+ * @details
+ * `O_NONBLOCK` comes from `open()`/`fcntl()`, `IOCB_NOWAIT` from `preadv2(RWF_NOWAIT)` and io_uring.
+ */
+static bool my_nowait(struct kiocb *iocb) {
+    return (iocb->ki_filp->f_flags & O_NONBLOCK) || (iocb->ki_flags & IOCB_NOWAIT);
+}
+
+/**
+ * @brief Consumes records from the ring. Writes from kernel space to user space.
+ * @details
+ * Consumes committed records from the ring. A single read may return the payload of several records,
+ * and a record that doesn't fit into `to` is continued by the next read. `read()`, `readv()` and
+ * io_uring reads all end up here, so a `readv()` scatters as many records as fit over all of its
+ * buffers with one system call.
+ *
+ * @param[in] iocb: Describes the I/O request. `iocb->ki_filp` is the opened file.
+ * @param[inout] to: The user space buffers to copy into.
+ *
+ * @return The number of bytes that were read successfully. If there is nothing to read, the call sleeps
+ * until a producer commits a record, or returns `-EAGAIN` for non-blocking callers.
+ *
+ * @note The ring is a stream, so we will ignore `iocb->ki_pos`.
+ */
+static ssize_t hello_read_iter(struct kiocb *iocb, struct iov_iter *to) {
+    struct hello_dev *dev = iocb->ki_filp->private_data;
+    struct hello_ring *ring = &dev->ring;
+    struct hello_rec_hdr *hdr;
+    size_t copied = 0;
+    size_t chunk;
+    size_t n;
+    u32 tail;
+    u32 rec_len;
+    u32 flags;
+    bool freed = false;
+    ssize_t ret = 0;
+
+    if (!iov_iter_count(to))
         return 0;
 
-    // Copy from our device driver `text` buffer into our user buffer (`user_buf`).
-    num_bytes_not_copied = copy_to_user(user_buf, &text[*off], num_bytes_to_copy);
+    // There is only one consumer cursor, so concurrent readers take turns.
+    if (my_nowait(iocb)) {
+        if (!mutex_trylock(&ring->rd_lock))
+            return -EAGAIN;
+    } else if (mutex_lock_interruptible(&ring->rd_lock)) {
+        return -ERESTARTSYS;
+    }
+
+again:
+    while (iov_iter_count(to)) {
+        tail = ring->ctrl->tail;
+
+        // Nothing was reserved after `tail`, the ring is empty.
+        if (tail == READ_ONCE(ring->ctrl->head))
+            break;
+
+        // Pairs with the `smp_store_release()` in `hello_write_iter()`. Makes sure we see the payload.
+        hdr = (struct hello_rec_hdr *)(ring->data + (tail & ring->mask));
+        flags = smp_load_acquire(&hdr->flags);
+
+        // The producer of the oldest record is still copying. Everything behind it has to wait.
+        if (!flags)
+            break;
+
+        // The data pages are writable through `mmap()`, so don't trust the length blindly.
+        rec_len = READ_ONCE(hdr->len);
+        if (rec_len > ring_size - sizeof(*hdr) || ring->rd_off > rec_len) {
+            pr_err_ratelimited("hello_cdev - Corrupted record at position %u.\n", tail);
+            ret = -EIO;
+            break;
+        }
+
+        if (flags & HELLO_REC_COMMITTED) {
+            chunk = min_t(size_t, iov_iter_count(to), rec_len - ring->rd_off);
+            n = ring_copy_to_iter(ring, to, tail + sizeof(*hdr) + ring->rd_off, chunk);
 
-    bytes_copied = num_bytes_to_copy - num_bytes_not_copied;
+            copied += n;
+            ring->rd_off += n;
 
-    // Need to update our file offset based on the amount of bytes that were copied.
-    *off += bytes_copied;
+            if (n < chunk) {
+                ret = -EFAULT;
+                break;
+            }
 
-    // Print a warning if any bytes were not copied.
-    if (num_bytes_not_copied)
-        pr_warn("hello_cdev - Could only copy %d bytes\n.", bytes_copied);
+            // `to` is full. The rest of this record is returned by the next read.
+            if (ring->rd_off < rec_len)
+                break;
+        }
 
-    return bytes_copied;
+        // The whole record was consumed. Hand its space back to the producers.
+        chunk = ALIGN(sizeof(*hdr) + rec_len, HELLO_RING_ALIGN);
+        ring_zero(ring, tail, chunk);
+        ring->rd_off = 0;
+
+        // Pairs with the `smp_load_acquire()` in `ring_reserve()`. The zeroed bytes are visible before
+        // a producer can reserve them again.
+        smp_store_release(&ring->ctrl->tail, tail + chunk);
+        freed = true;
+    }
+
+    // Nothing to return yet. Only discarded records (if any) were consumed.
+    if (!copied && !ret) {
+        if (my_nowait(iocb)) {
+            ret = -EAGAIN;
+        } else {
+            // Don't hold the cursor while sleeping. Writers may be waiting for the space we just freed.
+            mutex_unlock(&ring->rd_lock);
+            if (freed) {
+                ring_wake_writers(ring);
+                freed = false;
+            }
+
+            // `hello_write_iter()` wakes us up when it publishes a record.
+            if (wait_event_interruptible(ring->data_wq, ring_readable(ring)))
+                return -ERESTARTSYS;
+            if (mutex_lock_interruptible(&ring->rd_lock))
+                return -ERESTARTSYS;
+            goto again;
+        }
+    }
+
+    mutex_unlock(&ring->rd_lock);
+
+    // Wake up writers that were waiting for space.
+    if (freed)
+        ring_wake_writers(ring);
+
+    return copied ? copied : ret;
 }
 
 /**
- * @brief The `write()` callback function. Writes from user space to kernel space.
+ * @brief Adds one record to the ring. Writes from user space to kernel space.
+ * @details
+ * Every call becomes one record in the ring, no matter how many buffers `from` is made of. A `writev()`
+ * therefore gathers its scattered pieces into a single record with a single reservation. Writes larger
+ * than the ring are truncated.
  *
- * @param[in] filp: An opened file in the Linux kernel.
- * @param[in] user_buf: A user space buffer.
- * @param[in] len: Length of the user space buffer.
- * @param[inout] off: Our current file offset.
+ * @param[in] iocb: Describes the I/O request. `iocb->ki_filp` is the opened file.
+ * @param[inout] from: The user space buffers to copy from.
  *
  * @return The number of bytes that were written successfully.
+ *
+ * @note The ring is a stream, so we will ignore `iocb->ki_pos`.
  */
-static ssize_t my_write(struct file *filp, const char __user *user_buf, size_t len, loff_t *off) {
-    int num_bytes_not_copied;
-    int bytes_copied;
+static ssize_t hello_write_iter(struct kiocb *iocb, struct iov_iter *from) {
+    struct hello_dev *dev = iocb->ki_filp->private_data;
+    struct hello_ring *ring = &dev->ring;
+    struct hello_rec_hdr *hdr;
+    size_t len = iov_iter_count(from);
+    size_t copied;
+    u32 pos;
+    int ret;
 
-    // The maximum bytes we can copy is what is remaining in the `text` buffer.
-    int num_bytes_to_copy = (len + *off) < sizeof(text) ? len : (sizeof(text) - *off);
+    if (!len)
+        return 0;
 
-    pr_info("hello_cdev - Write is called, we want to write %ld bytes, but actually wrote %d bytes. The offset is %lld.\n", len, num_bytes_to_copy, *off);
+    // A single record can't be bigger than the ring itself.
+    len = min_t(size_t, len, ring_size - sizeof(*hdr));
 
-    // We can't read any bytes if the offset is at or beyond the end of the `text` buffer.
-    if (*off >= sizeof(text))
-        return 0;
+    ret = ring_reserve(ring, ALIGN(sizeof(*hdr) + len, HELLO_RING_ALIGN), my_nowait(iocb), &pos);
+    if (ret)
+        return ret;
+
+    // The reserved bytes belong to us alone, no lock is needed to fill them.
+    hdr = (struct hello_rec_hdr *)(ring->data + (pos & ring->mask));
+    hdr->len = len;
+
+    // Copy from the user buffers (`from`) to our reserved space in the ring.
+    copied = ring_copy_from_iter(ring, pos + sizeof(*hdr), len, from);
+
+    // Publish the record. The consumer sees the header and payload before it sees the flags.
+    smp_store_release(&hdr->flags, copied < len ? HELLO_REC_DISCARD : HELLO_REC_COMMITTED);
+
+    // Wake up the readers. A discarded record wakes them too, it may be the one they are stuck behind.
+    // `wq_has_sleeper()` contains the full barrier that orders the flags before the look at the queue.
+    if (wq_has_sleeper(&ring->data_wq))
+        wake_up_interruptible(&ring->data_wq);
+
+    // The record is dropped. This shows up as a copy fault in the `write` stats.
+    if (copied < len)
+        return -EFAULT;
+
+    return len;
+}
+
+/**
+ * @brief The `read_iter()` callback function. Counts and traces `hello_read_iter()`.
+ */
+static ssize_t my_read_iter(struct kiocb *iocb, struct iov_iter *to) {
+    struct hello_dev *dev = iocb->ki_filp->private_data;
+    size_t len = iov_iter_count(to);
+    ssize_t ret = hello_read_iter(iocb, to);
+
+    cdev_stats_account(&read_stats, ret);
+    trace_hello_cdev_read(MINOR(dev->cdev.dev), len, ret);
+    return ret;
+}
+
+/**
+ * @brief The `write_iter()` callback function. Counts and traces `hello_write_iter()`.
+ */
+static ssize_t my_write_iter(struct kiocb *iocb, struct iov_iter *from) {
+    struct hello_dev *dev = iocb->ki_filp->private_data;
+    size_t len = iov_iter_count(from);
+    ssize_t ret = hello_write_iter(iocb, from);
+
+    cdev_stats_account(&write_stats, ret);
+    trace_hello_cdev_write(MINOR(dev->cdev.dev), len, ret);
+    return ret;
+}
+
+/**
+ * @brief The `mmap()` callback function. Maps the control page and the ring into user space.
+ * @details
+ * The reader can then consume records straight from the mapped pages without any system call.
+ * See `struct hello_ring_ctrl` for the protocol.
+ *
+ * @param[in] filp: An opened file in the Linux kernel.
+ * @param[in] vma: The user space memory area that should be filled with our pages.
+ *
+ * @return Zero if the mapping was successful.
+ */
+static int my_mmap(struct file *filp, struct vm_area_struct *vma) {
+    struct hello_dev *dev = filp->private_data;
+
+    // The consumer writes `tail` and clears consumed records, a private copy of the pages is useless.
+    if (!(vma->vm_flags & VM_SHARED))
+        return -EINVAL;
 
-    // Copy from user buffer (`user_buf`) to our device driver `text` buffer.
-    num_bytes_not_copied = copy_from_user(&text[*off], user_buf, num_bytes_to_copy);
+    // Don't let the mapping grow with `mremap()` and keep the ring out of core dumps.
+    vm_flags_set(vma, VM_DONTEXPAND | VM_DONTDUMP);
 
-    bytes_copied = num_bytes_to_copy - num_bytes_not_copied;
+    // Inserts our pages, starting at the page offset that was passed to `mmap()`. The pages are
+    // reference counted, so they stay valid as long as they are mapped somewhere.
+    return vm_map_pages(vma, dev->ring.pages, dev->ring.nr_pages);
+}
 
-    // Print a warning if any bytes were not copied.
-    if (num_bytes_not_copied)
-        pr_warn("hello_cdev - Could only copy %d bytes\n.", bytes_copied);
+/**
+ * @brief The `unlocked_ioctl()` callback function.
+ *
+ * @param[in] cmd: `HELLO_RING_WAKE`, the doorbell of consumers that go through the mapping.
+ *
+ * @return Zero, or -ENOTTY for unknown commands.
+ */
+static long my_ioctl(struct file *filp, unsigned int cmd, unsigned long arg) {
+    struct hello_dev *dev = filp->private_data;
 
-    // Need to update our file offset based on the amount of bytes that were copied.
-    *off += bytes_copied;
+    switch (cmd) {
+        case HELLO_RING_WAKE:
+            ring_wake_writers(&dev->ring);
+            return 0;
 
-    return bytes_copied;
+        default:
+            return -ENOTTY;
+    }
+}
+
+/**
+ * @brief The `poll()` callback function. Used by `poll()`, `select()`, `epoll` and io_uring.
+ *
+ * @param[in] filp: An opened file in the Linux kernel.
+ * @param[in] wait: Lets us register the waitqueues that will signal a change in readiness.
+ *
+ * @return `EPOLLIN` if the oldest record is committed, `EPOLLOUT` if a one-byte record fits.
+ */
+static __poll_t my_poll(struct file *filp, poll_table *wait) {
+    struct hello_dev *dev = filp->private_data;
+    struct hello_ring *ring = &dev->ring;
+    u32 min_rec = ALIGN(sizeof(struct hello_rec_hdr) + 1, HELLO_RING_ALIGN);  // A one-byte write.
+    __poll_t mask = 0;
+
+    // Doesn't sleep. It only adds our waitqueues to the ones that the caller (e.g. epoll) listens on.
+    poll_wait(filp, &ring->data_wq, wait);
+    poll_wait(filp, &ring->space_wq, wait);
+
+    if (ring_readable(ring))
+        mask |= EPOLLIN | EPOLLRDNORM;
+
+    // If the ring is full, ask the consumer for a wake-up, just like a sleeping writer does.
+    if (ring_has_space(ring, min_rec) || ring_wait_space(ring, min_rec))
+        mask |= EPOLLOUT | EPOLLWRNORM;
+
+    return mask;
+}
+
+/**
+ * @brief Callback function for when the device file is opened.
+ *
+ * @param[in] inode: Represents a file. We can get the major and minor device number of the \n
+ *     opened device file, among other things.
+ * @param[in] filp: Represents an open file in the Linux kernel. `filp->private_data` is ours \n
+ *     to use for as long as the file is open.
+ * @return Return code.
+ */
+static int my_open(struct inode *inode, struct file *filp) {
+    // Every minor number has its own `struct hello_dev` with the `cdev` embedded in it. Remember the
+    // device in the file, so the other callbacks don't have to look it up again.
+    filp->private_data = container_of(inode->i_cdev, struct hello_dev, cdev);
+
+    // The ring has no file offset. `stream_open()` also stops the VFS from serializing
+    // concurrent reads and writes on the same file with its file position lock.
+    stream_open(inode, filp);
+
+    // Both `my_read_iter()` and `my_write_iter()` honor `IOCB_NOWAIT`. This lets io_uring complete
+    // requests inline instead of handing every one of them to a worker thread.
+    filp->f_mode |= FMODE_NOWAIT;
+
+    return 0;
 }
 
 static struct file_operations fops = {
     // Set file operations function pointers to our own functions.
     .owner = THIS_MODULE,
-    .read = my_read,  // The `read()` callback function.
-    .write = my_write,  // The `write()` callback function.
+    .open = my_open,
+    .read_iter = my_read_iter,  // Used by `read()`, `readv()` and io_uring.
+    .write_iter = my_write_iter,  // Used by `write()`, `writev()` and io_uring.
+    .poll = my_poll,  // Used by `poll()`, `select()`, `epoll` and io_uring.
+    .mmap = my_mmap,  // The `mmap()` callback function.
+    .unlocked_ioctl = my_ioctl,
+    .compat_ioctl = compat_ptr_ioctl,
+
+    // `splice()` and `sendfile()`. Both helpers call our `read_iter()`/`write_iter()` with the pages
+    // of the pipe, so the data is copied once between the ring and the pipe, and never goes through
+    // a user space buffer. A spliced write is one record, just like a `write()`.
+    .splice_read = copy_splice_read,
+    .splice_write = iter_file_splice_write,
+};
+
+/**
+ * @brief Frees the pages of the ring. Works on a partially allocated ring, too.
+ */
+static void ring_free(struct hello_ring *ring) {
+    unsigned int i;
+
+    if (ring->vaddr)
+        vunmap(ring->vaddr);
+
+    for (i = 0; i < ring->nr_pages; i++)
+        if (ring->pages[i])
+            __free_page(ring->pages[i]);
+
+    kfree(ring->pages);
+}
+
+/**
+ * @brief Allocates the control page and the data pages of the ring on NUMA node `node`.
+ *
+ * @return Zero if the allocation was successful.
+ */
+static int ring_alloc(struct hello_ring *ring, int node) {
+    unsigned int i;
+
+    ring->nr_pages = 1 + ring_size / PAGE_SIZE;
+    ring->pages = kcalloc_node(ring->nr_pages, sizeof(*ring->pages), GFP_KERNEL, node);
+    if (!ring->pages)
+        return -ENOMEM;
+
+    // `vm_map_pages()` can only map order-0 pages, so allocate them one by one.
+    for (i = 0; i < ring->nr_pages; i++) {
+        ring->pages[i] = alloc_pages_node(node, GFP_KERNEL | __GFP_ZERO, 0);
+        if (!ring->pages[i])
+            goto err;
+    }
+
+    // Map the pages next to each other in kernel space, so the driver can index the data directly.
+    ring->vaddr = vmap(ring->pages, ring->nr_pages, VM_MAP, PAGE_KERNEL);
+    if (!ring->vaddr)
+        goto err;
+
+    ring->ctrl = ring->vaddr;
+    ring->ctrl->size = ring_size;
+    ring->ctrl->data_offset = PAGE_SIZE;
+    ring->data = (char *)ring->vaddr + PAGE_SIZE;
+    ring->mask = ring_size - 1;
+
+    ring->rd_off = 0;
+    mutex_init(&ring->rd_lock);
+    init_waitqueue_head(&ring->space_wq);
+    init_waitqueue_head(&ring->data_wq);
+    return 0;
+
+err:
+    ring_free(ring);
+    return -ENOMEM;
+}
+
+/**
+ * @brief Picks the NUMA node for the device with the minor number `minor`.
+ * @details
+ * Uses `dev_nodes[minor]` if it was given, otherwise spreads the devices over the online nodes.
+ */
+static int hello_dev_node(unsigned int minor) {
+    unsigned int n;
+    int node;
+
+    if (minor < nr_dev_nodes && dev_nodes[minor] != NUMA_NO_NODE) {
+        if (dev_nodes[minor] < 0 || dev_nodes[minor] >= MAX_NUMNODES || !node_online(dev_nodes[minor]))
+            return -EINVAL;
+        return dev_nodes[minor];
+    }
+
+    n = minor % num_online_nodes();
+    for_each_online_node(node)
+        if (n-- == 0)
+            break;
+
+    return node;
+}
+
+/**
+ * @brief Allocates and registers the device with the minor number `minor`.
+ *
+ * @return The new device, or an `ERR_PTR()`.
+ */
+static struct hello_dev *hello_dev_create(unsigned int minor) {
+    struct hello_dev *dev;
+    int node = hello_dev_node(minor);
+    int ret;
+
+    if (node < 0) {
+        pr_err("hello_cdev - dev_nodes[%u] = %d is not an online NUMA node\n", minor, dev_nodes[minor]);
+        return ERR_PTR(node);
+    }
+
+    // Every device lives on its own node, so devices used from different nodes share no cache lines.
+    dev = kzalloc_node(sizeof(*dev), GFP_KERNEL, node);
+    if (!dev)
+        return ERR_PTR(-ENOMEM);
+
+    dev->node = node;
+    ret = ring_alloc(&dev->ring, node);
+    if (ret)
+        goto err_free_dev;
+
+    // `cdev_init()` links the character device to our file operations, `cdev_add()` makes it live.
+    // From this point on, `my_open()` can be called for this minor number.
+    cdev_init(&dev->cdev, &fops);
+    dev->cdev.owner = THIS_MODULE;
+    ret = cdev_add(&dev->cdev, MKDEV(MAJOR(first_dev_num), minor), 1);
+    if (ret)
+        goto err_free_ring;
+
+    return dev;
+
+err_free_ring:
+    ring_free(&dev->ring);
+err_free_dev:
+    kfree(dev);
+    return ERR_PTR(ret);
+}
+
+/**
+ * @brief Unregisters and frees a device that was created by `hello_dev_create()`.
+ */
+static void hello_dev_destroy(struct hello_dev *dev) {
+    cdev_del(&dev->cdev);
+    ring_free(&dev->ring);
+    kfree(dev);
+}
+
+/**
+ * @brief Returns the page of the store at page number `index`, allocating it if it doesn't exist yet.
+ *
+ * @return The page, or an `ERR_PTR()`.
+ */
+static struct page *store_get_page(struct hello_store *store, pgoff_t index) {
+    struct page *page, *old;
+
+    page = xa_load(&store->pages, index);
+    if (page)
+        return page;
+
+    page = alloc_pages_node(store->node, GFP_HIGHUSER | __GFP_ZERO, 0);
+    if (!page)
+        return ERR_PTR(-ENOMEM);
+
+    // Another writer may have added the page since our lookup. Then the exchange fails, returns the
+    // page that won, and we write into that one instead.
+    old = xa_cmpxchg(&store->pages, index, NULL, page, GFP_KERNEL);
+    if (old) {
+        __free_page(page);
+        return xa_is_err(old) ? ERR_PTR(xa_err(old)) : old;
+    }
+
+    atomic_long_inc(&store->nr_pages);
+    return page;
+}
+
+/**
+ * @brief Reads from the store at `iocb->ki_pos`. Holes read as zeros.
+ *
+ * @return The number of bytes that were read. Zero at the end of the store.
+ */
+static ssize_t store_read_iter(struct kiocb *iocb, struct iov_iter *to) {
+    struct hello_store *store = iocb->ki_filp->private_data;
+    loff_t pos = iocb->ki_pos;
+    struct page *page;
+    size_t copied = 0;
+    size_t off, chunk, n;
+    ssize_t ret = 0;
+
+    if (pos >= store_size)
+        return 0;
+    iov_iter_truncate(to, store_size - pos);
+
+    // One page at a time, so only one page lock is held at any time.
+    while (iov_iter_count(to)) {
+        off = pos & ~PAGE_MASK;
+        chunk = min_t(size_t, iov_iter_count(to), PAGE_SIZE - off);
+
+        page = xa_load(&store->pages, pos >> PAGE_SHIFT);
+        if (!page) {
+            n = iov_iter_zero(chunk, to);
+        } else {
+            lock_page(page);
+            n = copy_page_to_iter(page, off, chunk, to);
+            unlock_page(page);
+        }
+
+        copied += n;
+        pos += n;
+
+        if (n < chunk) {
+            ret = -EFAULT;
+            break;
+        }
+    }
+
+    iocb->ki_pos = pos;
+    return copied ? copied : ret;
+}
+
+/**
+ * @brief Writes into the store at `iocb->ki_pos`. Allocates the pages that are written for the first time.
+ *
+ * @return The number of bytes that were written, or -ENOSPC at the end of the store.
+ */
+static ssize_t store_write_iter(struct kiocb *iocb, struct iov_iter *from) {
+    struct hello_store *store = iocb->ki_filp->private_data;
+    loff_t pos = iocb->ki_pos;
+    struct page *page;
+    size_t copied = 0;
+    size_t off, chunk, n;
+    ssize_t ret = 0;
+
+    if (!iov_iter_count(from))
+        return 0;
+
+    // The store has a fixed size, like a disk. Writes past its end are cut short.
+    if (pos >= store_size)
+        return -ENOSPC;
+    iov_iter_truncate(from, store_size - pos);
+
+    while (iov_iter_count(from)) {
+        off = pos & ~PAGE_MASK;
+        chunk = min_t(size_t, iov_iter_count(from), PAGE_SIZE - off);
+
+        page = store_get_page(store, pos >> PAGE_SHIFT);
+        if (IS_ERR(page)) {
+            ret = PTR_ERR(page);
+            break;
+        }
+
+        // Copying from user space may fault and sleep with the page locked. The store can't be
+        // mapped, so the fault can't need the lock of one of our pages.
+        lock_page(page);
+        n = copy_page_from_iter(page, off, chunk, from);
+        unlock_page(page);
+
+        copied += n;
+        pos += n;
+
+        if (n < chunk) {
+            ret = -EFAULT;
+            break;
+        }
+    }
+
+    iocb->ki_pos = pos;
+    return copied ? copied : ret;
+}
+
+/**
+ * @brief The `read_iter()` callback function of the store. Counts and traces `store_read_iter()`.
+ */
+static ssize_t my_store_read_iter(struct kiocb *iocb, struct iov_iter *to) {
+    struct hello_store *store = iocb->ki_filp->private_data;
+    size_t len = iov_iter_count(to);
+    ssize_t ret = store_read_iter(iocb, to);
+
+    cdev_stats_account(&read_stats, ret);
+    trace_hello_cdev_read(MINOR(store->cdev.dev), len, ret);
+    return ret;
+}
+
+/**
+ * @brief The `write_iter()` callback function of the store. Counts and traces `store_write_iter()`.
+ */
+static ssize_t my_store_write_iter(struct kiocb *iocb, struct iov_iter *from) {
+    struct hello_store *store = iocb->ki_filp->private_data;
+    size_t len = iov_iter_count(from);
+    ssize_t ret = store_write_iter(iocb, from);
+
+    cdev_stats_account(&write_stats, ret);
+    trace_hello_cdev_write(MINOR(store->cdev.dev), len, ret);
+    return ret;
+}
+
+/**
+ * @brief The `llseek()` callback function of the store.
+ * @details
+ * `SEEK_SET`, `SEEK_CUR` and `SEEK_END` work like on a regular file of `store_size` bytes.
+ * Seeking before the start or past the end fails with -EINVAL.
+ */
+static loff_t my_store_llseek(struct file *filp, loff_t offset, int whence) {
+    return fixed_size_llseek(filp, offset, whence, store_size);
+}
+
+/**
+ * @brief Callback function for when the store device file is opened.
+ */
+static int my_store_open(struct inode *inode, struct file *filp) {
+    filp->private_data = container_of(inode->i_cdev, struct hello_store, cdev);
+    return 0;
+}
+
+static struct file_operations store_fops = {
+    .owner = THIS_MODULE,
+    .open = my_store_open,
+    .llseek = my_store_llseek,
+    .read_iter = my_store_read_iter,  // Also used by `pread()` and `preadv()`.
+    .write_iter = my_store_write_iter,  // Also used by `pwrite()` and `pwritev()`.
+    .splice_read = copy_splice_read,  // See `fops`.
+    .splice_write = iter_file_splice_write,
 };
 
+/**
+ * @brief Allocates and registers the store with the minor number `minor`. No page is allocated yet.
+ *
+ * @return The new store, or an `ERR_PTR()`.
+ */
+static struct hello_store *hello_store_create(unsigned int minor) {
+    struct hello_store *store;
+    int node = hello_dev_node(minor);
+    int ret;
+
+    if (node < 0) {
+        pr_err("hello_cdev - dev_nodes[%u] = %d is not an online NUMA node\n", minor, dev_nodes[minor]);
+        return ERR_PTR(node);
+    }
+
+    store = kzalloc_node(sizeof(*store), GFP_KERNEL, node);
+    if (!store)
+        return ERR_PTR(-ENOMEM);
+
+    store->node = node;
+    xa_init(&store->pages);
+    atomic_long_set(&store->nr_pages, 0);
+
+    cdev_init(&store->cdev, &store_fops);
+    store->cdev.owner = THIS_MODULE;
+    ret = cdev_add(&store->cdev, MKDEV(MAJOR(first_dev_num), minor), 1);
+    if (ret) {
+        kfree(store);
+        return ERR_PTR(ret);
+    }
+
+    return store;
+}
+
+/**
+ * @brief Unregisters the store and frees all of its pages.
+ */
+static void hello_store_destroy(struct hello_store *store) {
+    struct page *page;
+    unsigned long index;
+
+    cdev_del(&store->cdev);
+
+    pr_info("hello_cdev - The store used %ld pages.\n", atomic_long_read(&store->nr_pages));
+
+    xa_for_each(&store->pages, index, page)
+        __free_page(page);
+    xa_destroy(&store->pages);
+    kfree(store);
+}
+
 /**
  * @brief Callback function for when the module is loaded into the kernel.
  *
  * @return Zero if the loading of the module was successful.
  */
 static int __init my_init(void) {
-    // `register_chrdev()`:
-    //   Will allocate device numbers, create a character device, and link the device numbers to the character device.
-    //   • 1st arg is the major device number that it should allocate for the device number.
-    //       • If zero, it will search for and use a free device number.
-    //       • If non-zero, it will allocate all 255 minor device numbers for that major device number.
-    //   • 2nd arg is a label, which will appear in `/proc/devices`.
-    //   • 3rd arg is a pointer to the file operations, which should be supported by our character device.
-    major_dev_num = register_chrdev(0, "hello_cdev", &fops);
-
-    // Check for error while registering the character device.
-    if (major_dev_num < 0) {
-        pr_err("hello_cdev - Error registering character device\n");
-        return major_dev_num;
-    }
-
-    // The registration of the character device worked.
-    pr_info("hello_cdev - Major device number: %d\n", major_dev_num);
+    unsigned int i;
+    int ret;
+
+    // The ring indexes with a mask, so its size has to be a power of two. The cursors are 32 bits
+    // wide and `head - tail + total` must not overflow, so the ring can't be bigger than 1 GiB.
+    if (ring_size < PAGE_SIZE || ring_size > (1U << 30) || !is_power_of_2(ring_size)) {
+        pr_err("hello_cdev - ring_size must be a power of two between PAGE_SIZE and 1 GiB, got %u\n", ring_size);
+        return -EINVAL;
+    }
+
+    if (nr_devs == 0 || nr_devs > HELLO_MAX_DEVS) {
+        pr_err("hello_cdev - nr_devs must be between 1 and %d, got %u\n", HELLO_MAX_DEVS, nr_devs);
+        return -EINVAL;
+    }
+
+    // File positions are signed, and the page numbers have to fit into an xarray index.
+    if (store_size > MAX_LFS_FILESIZE) {
+        pr_err("hello_cdev - store_size must not be bigger than %lld, got %llu\n", MAX_LFS_FILESIZE, store_size);
+        return -EINVAL;
+    }
+    nr_minors = nr_devs + (store_size ? 1 : 0);
+
+    // `alloc_chrdev_region()`:
+    //   Allocates a free major device number together with `nr_minors` minor device numbers.
+    //   • 1st arg receives the first device number (major and first minor) of the region.
+    //   • 2nd arg is the first minor device number that we want.
+    //   • 3rd arg is the number of minor device numbers that we want.
+    //   • 4th arg is a label, which will appear in `/proc/devices`.
+    // Unlike `register_chrdev()`, this doesn't create a character device yet. We add one `cdev` per
+    // minor number ourselves, so every minor can have its own state.
+    ret = alloc_chrdev_region(&first_dev_num, 0, nr_minors, "hello_cdev");
+
+    // Check for error while allocating the device numbers.
+    if (ret < 0) {
+        pr_err("hello_cdev - Error allocating device numbers\n");
+        return ret;
+    }
+
+    for (i = 0; i < nr_devs; i++) {
+        devs[i] = hello_dev_create(i);
+        if (IS_ERR(devs[i])) {
+            ret = PTR_ERR(devs[i]);
+            goto err;
+        }
+    }
+
+    if (store_size) {
+        store_dev = hello_store_create(nr_devs);
+        if (IS_ERR(store_dev)) {
+            ret = PTR_ERR(store_dev);
+            store_dev = NULL;
+            goto err;
+        }
+    }
+
+    ret = cdev_stats_register(&stats_group);
+    if (ret)
+        goto err;
+
+    // The registration of the character devices worked.
+    pr_info("hello_cdev - Major device number: %d, %u devices, ring size: %u bytes, store size: %llu bytes\n",
+            MAJOR(first_dev_num), nr_devs, ring_size, store_size);
     return 0;
+
+err:
+    if (store_dev)
+        hello_store_destroy(store_dev);
+    while (i--)
+        hello_dev_destroy(devs[i]);
+    unregister_chrdev_region(first_dev_num, nr_minors);
+    return ret;
 }
 
 /**
@@ -131,9 +1021,18 @@ static int __init my_init(void) {
  *   • Makes this function only available within this kernel module.
  */
 static void __exit my_exit(void) {
-    // Delete the character device and free the allocated device numbers via `unregister_chrdev()`.
-    // `unregister_chrdev()`'s 2nd arg is the label that appears in `/proc/devices`.
-    unregister_chrdev(major_dev_num, "hello_cdev");
+    unsigned int i;
+
+    cdev_stats_unregister(&stats_group);
+
+    // Delete the character devices first, so no new file can be opened while we free the rings.
+    for (i = 0; i < nr_devs; i++)
+        hello_dev_destroy(devs[i]);
+    if (store_dev)
+        hello_store_destroy(store_dev);
+
+    // Free the allocated device numbers.
+    unregister_chrdev_region(first_dev_num, nr_minors);
 }
 
 // Specify the function to use when the module is loaded into the kernel.
@@ -0,0 +1,63 @@
+#ifndef HELLO_CDEV_H
+#define HELLO_CDEV_H
+
+// This header is shared by the kernel module and the user space programs, so only use the
+// fixed-size types from <linux/types.h>.
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+// Every record in the ring starts on a multiple of this many bytes, so a record header never wraps
+// around the end of the ring.
+#define HELLO_RING_ALIGN 8
+
+// `struct hello_ring_ctrl.flags`, set by the driver.
+#define HELLO_RING_NEED_WAKEUP 0x1  // A writer sleeps until there is space. Call `HELLO_RING_WAKE`.
+
+// Wakes up the writers that wait for space. Only needed by consumers that move `tail` through the
+// mapping, `read()` does it by itself.
+#define HELLO_RING_WAKE _IO('h', 0)
+
+// Values for `struct hello_rec_hdr.flags`.
+#define HELLO_REC_COMMITTED 0x1  // The producer finished copying the payload; the record can be read.
+#define HELLO_REC_DISCARD 0x2  // Copying from user space failed; the consumer skips the record.
+
+/**
+ * @brief Header in front of every record that was written into the ring.
+ * @details
+ * The payload directly follows the header and may wrap around the end of the ring. The next record
+ * starts at the next multiple of `HELLO_RING_ALIGN`.
+ */
+struct hello_rec_hdr {
+    __u32 len;  // Number of payload bytes following the header.
+    __u32 flags;  // `HELLO_REC_*` flags. Zero while the producer is still copying the payload.
+};
+
+/**
+ * @brief Control page at offset zero of the `mmap()` area.
+ * @details
+ * Cursors are free-running positions. Use `pos & (size - 1)` to get the offset into the data area,
+ * which starts `data_offset` bytes after the beginning of the mapping.
+ *
+ * To consume a record through the mapping:
+ *   1. Load the `flags` of the header at `tail` with acquire semantics. If they're zero, `poll()`
+ *      the device for `POLLIN`, which waits until that record is committed.
+ *   2. Use the payload, unless `HELLO_REC_DISCARD` is set.
+ *   3. Zero the whole record (header, payload and padding), so that it can't be mistaken for a
+ *      committed record on the next lap.
+ *   4. Store the position of the next record into `tail` with release semantics.
+ *   5. Issue a full barrier and check `flags`. If `HELLO_RING_NEED_WAKEUP` is set, call
+ *      `HELLO_RING_WAKE`. Writers that found the ring full sleep until then.
+ *
+ * There is only one consumer cursor. Don't mix `read()` and the mapping on the same device.
+ */
+struct hello_ring_ctrl {
+    __u32 head;  // Producer cursor. Only written by the driver.
+    __u32 pad0[15];  // Keep `head` and `tail` on separate cache lines.
+    __u32 tail;  // Consumer cursor. Written by whoever consumes the records.
+    __u32 pad1[15];
+    __u32 size;  // Size of the data area in bytes. Always a power of two.
+    __u32 data_offset;  // Offset of the data area from the start of the mapping.
+    __u32 flags;  // `HELLO_RING_*` flags.
+};
+
+#endif  // #ifndef HELLO_CDEV_H
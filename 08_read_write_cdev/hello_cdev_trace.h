@@ -0,0 +1,51 @@
+// Tracepoints of hello_cdev. They cost a not-taken branch while disabled. Enable them with e.g.
+//   echo 1 > /sys/kernel/tracing/events/hello_cdev/enable
+// or record them with `perf record -e 'hello_cdev:*'`.
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM hello_cdev
+
+// Unlike other headers, this one is read several times by <trace/define_trace.h>.
+#if !defined(HELLO_CDEV_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define HELLO_CDEV_TRACE_H
+
+#include <linux/tracepoint.h>
+
+DECLARE_EVENT_CLASS(hello_cdev_io,
+    TP_PROTO(unsigned int minor, size_t len, ssize_t ret),
+    TP_ARGS(minor, len, ret),
+
+    TP_STRUCT__entry(
+        __field(unsigned int, minor)
+        __field(size_t, len)  // Bytes that were asked for.
+        __field(ssize_t, ret)  // Bytes that were transferred, or a negative errno.
+    ),
+
+    TP_fast_assign(
+        __entry->minor = minor;
+        __entry->len = len;
+        __entry->ret = ret;
+    ),
+
+    TP_printk("minor=%u len=%zu ret=%zd", __entry->minor, __entry->len, __entry->ret)
+);
+
+DEFINE_EVENT(hello_cdev_io, hello_cdev_read,
+    TP_PROTO(unsigned int minor, size_t len, ssize_t ret),
+    TP_ARGS(minor, len, ret)
+);
+
+DEFINE_EVENT(hello_cdev_io, hello_cdev_write,
+    TP_PROTO(unsigned int minor, size_t len, ssize_t ret),
+    TP_ARGS(minor, len, ret)
+);
+
+#endif  // #if !defined(HELLO_CDEV_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+
+// <trace/define_trace.h> includes this file again, from the path below. The Makefile adds our
+// directory to the include path for that.
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE hello_cdev_trace
+#include <trace/define_trace.h>
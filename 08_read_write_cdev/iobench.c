@@ -0,0 +1,226 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>  // For open, close, read and write.
+#include <fcntl.h>  // For the flags being associated with our character device.
+#include <time.h>
+#include <sys/mman.h>  // For mmap.
+#include <sys/syscall.h>  // For the io_uring system call numbers.
+#include <sys/uio.h>  // For readv and writev.
+#include <linux/io_uring.h>
+
+// Compares three ways of moving records through the device:
+//   • scalar:   one `write()` per record, one `read()` per record.
+//   • vectored: one `writev()` and one `readv()` per batch of records.
+//   • io_uring: one `io_uring_enter()` per batch of write requests, one per batch of read requests.
+//
+// Usage: iobench [device] [record size] [batch size] [iterations]
+
+#define MAX_BATCH 256
+
+/**
+ * @brief The parts of an io_uring instance that we need. There is no liburing, so we use the
+ *     system calls and the shared rings directly.
+ */
+struct uring {
+    int fd;
+    unsigned *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+};
+
+/**
+ * @brief Returns the current time of the monotonic clock in nanoseconds.
+ */
+static uint64_t now_in_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/**
+ * @brief Sets up an io_uring instance with room for `entries` requests.
+ *
+ * @return Zero on success.
+ */
+static int uring_init(struct uring *ring, unsigned entries) {
+    struct io_uring_params p;
+    size_t sq_size, cq_size;
+    char *sq, *cq;
+
+    memset(&p, 0, sizeof(p));
+    ring->fd = syscall(__NR_io_uring_setup, entries, &p);
+    if (ring->fd < 0)
+        return -1;
+
+    sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+
+    // Newer kernels map both rings with a single `mmap()`.
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+        sq_size = cq_size = sq_size > cq_size ? sq_size : cq_size;
+
+    sq = mmap(NULL, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (sq == MAP_FAILED)
+        return -1;
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+        cq = sq;
+    else {
+        cq = mmap(NULL, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+        if (cq == MAP_FAILED)
+            return -1;
+    }
+
+    ring->sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED)
+        return -1;
+
+    ring->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    ring->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)(sq + p.sq_off.array);
+    ring->cq_head = (unsigned *)(cq + p.cq_off.head);
+    ring->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    ring->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    return 0;
+}
+
+/**
+ * @brief Submits `n` reads or writes of `len` bytes each and waits for all of them to complete.
+ *
+ * @return The total number of bytes that were transferred, or -1 on error.
+ */
+static long uring_batch(struct uring *ring, int fd, int opcode, char **bufs, unsigned len, unsigned n) {
+    unsigned tail = *ring->sq_tail;
+    unsigned head, i, idx;
+    long total = 0;
+
+    for (i = 0; i < n; i++, tail++) {
+        idx = tail & *ring->sq_mask;
+        memset(&ring->sqes[idx], 0, sizeof(ring->sqes[idx]));
+        ring->sqes[idx].opcode = opcode;
+        ring->sqes[idx].fd = fd;
+        ring->sqes[idx].addr = (uintptr_t)bufs[i];
+        ring->sqes[idx].len = len;
+        ring->sqes[idx].off = (uint64_t)-1;  // The device is a stream, use the current position.
+        ring->sq_array[idx] = idx;
+    }
+
+    // The kernel must see the filled entries before it sees the new tail.
+    __atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+
+    // Submit all requests and wait for all completions with a single system call.
+    if (syscall(__NR_io_uring_enter, ring->fd, n, n, IORING_ENTER_GETEVENTS, NULL, 0) < 0)
+        return -1;
+
+    head = *ring->cq_head;
+    for (i = 0; i < n; i++, head++) {
+        struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+
+        if (cqe->res < 0)
+            return -1;
+        total += cqe->res;
+    }
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+
+    return total;
+}
+
+/**
+ * @brief Prints the result of one mode.
+ */
+static void report(const char *mode, uint64_t ns, unsigned long records, unsigned long bytes) {
+    printf("%-9s: %8.0f ns/record  %10.0f records/s  %8.1f MB/s\n",
+           mode, (double)ns / records, records / (ns / 1e9), bytes / (ns / 1e9) / 1e6);
+}
+
+// This is a user space program.
+int main(int argc, char **argv) {
+    const char *dev = argc > 1 ? argv[1] : "/dev/hello0";
+    unsigned rec_size = argc > 2 ? strtoul(argv[2], NULL, 0) : 256;
+    unsigned batch = argc > 3 ? strtoul(argv[3], NULL, 0) : 32;
+    unsigned long iters = argc > 4 ? strtoul(argv[4], NULL, 0) : 10000;
+    struct iovec iov[MAX_BATCH];
+    char *bufs[MAX_BATCH];
+    struct uring ring;
+    unsigned long it;
+    uint64_t start;
+    unsigned i;
+    int fd;  // File descriptor.
+
+    if (batch == 0 || batch > MAX_BATCH) {
+        printf("The batch size must be between 1 and %d.\n", MAX_BATCH);
+        return 1;
+    }
+
+    // Open our character device [driver] with read/write permissions.
+    fd = open(dev, O_RDWR);
+
+    // Check if we couldn't open the file.
+    if (fd < 0) {
+        perror("Error opening file.");
+        return fd;
+    }
+
+    for (i = 0; i < batch; i++) {
+        bufs[i] = malloc(rec_size);
+        memset(bufs[i], 'a' + i % 26, rec_size);
+        iov[i].iov_base = bufs[i];
+        iov[i].iov_len = rec_size;
+    }
+
+    printf("%u records of %u bytes per batch, %lu batches\n", batch, rec_size, iters);
+
+    {  /* Test #1: One system call per record. */
+        start = now_in_ns();
+        for (it = 0; it < iters; it++) {
+            for (i = 0; i < batch; i++)
+                if (write(fd, bufs[i], rec_size) != rec_size)
+                    goto io_error;
+            for (i = 0; i < batch; i++)
+                if (read(fd, bufs[i], rec_size) != rec_size)
+                    goto io_error;
+        }
+        report("scalar", now_in_ns() - start, iters * batch, iters * batch * rec_size);
+    }
+
+    {  /* Test #2: One system call per batch. `writev()` gathers the batch into one record. */
+        start = now_in_ns();
+        for (it = 0; it < iters; it++) {
+            if (writev(fd, iov, batch) != batch * rec_size)
+                goto io_error;
+            if (readv(fd, iov, batch) != batch * rec_size)
+                goto io_error;
+        }
+        report("vectored", now_in_ns() - start, iters * batch, iters * batch * rec_size);
+    }
+
+    {  /* Test #3: One `io_uring_enter()` per batch, every request is its own record. */
+        if (uring_init(&ring, MAX_BATCH) < 0) {
+            perror("io_uring is not available");
+            return 1;
+        }
+
+        start = now_in_ns();
+        for (it = 0; it < iters; it++) {
+            if (uring_batch(&ring, fd, IORING_OP_WRITE, bufs, rec_size, batch) != batch * rec_size)
+                goto io_error;
+            if (uring_batch(&ring, fd, IORING_OP_READ, bufs, rec_size, batch) != batch * rec_size)
+                goto io_error;
+        }
+        report("io_uring", now_in_ns() - start, iters * batch, iters * batch * rec_size);
+    }
+
+    close(fd);  // Close the file.
+    return 0;
+
+io_error:
+    perror("Error moving records through the device. Is the ring big enough for one batch?");
+    close(fd);
+    return 1;
+}
@@ -0,0 +1,174 @@
+#define _GNU_SOURCE  // For splice and vmsplice.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>  // For open, close, read, write and pipe.
+#include <fcntl.h>  // For the flags being associated with our character device, and splice.
+#include <time.h>
+#include <sys/uio.h>  // For vmsplice.
+#include <sys/wait.h>
+
+// Streams a payload through a ring of the device and compares two ways of moving it:
+//   • copy:   the producer `write()`s from a buffer, the consumer `read()`s into a buffer and
+//             `write()`s that buffer to the destination. Every byte is copied between user space
+//             and the kernel three times.
+//   • splice: the producer `vmsplice()`s its buffer into a pipe and `splice()`s the pipe into the
+//             device, the consumer `splice()`s from the device into a pipe and from the pipe into the
+//             destination. Every byte is copied into the ring and out of it again, both inside the
+//             kernel, and never goes through a user space buffer on the consumer side.
+//
+// Every chunk becomes one record in the ring, so load the module with a `ring_size` that is a few
+// times larger than the chunk size.
+//
+// Usage: splicebench <device> [copy|splice] [MiB] [chunk size] [destination, default /dev/null]
+
+/**
+ * @brief Returns the current time of the monotonic clock in seconds.
+ */
+static double now_in_secs(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief Moves `len` bytes from the pipe `in` to `out`.
+ *
+ * @return Zero on success, -1 on error.
+ */
+static int drain_pipe(int in, int out, size_t len) {
+    ssize_t n;
+
+    while (len > 0) {
+        n = splice(in, NULL, out, NULL, len, SPLICE_F_MOVE);
+        if (n <= 0)
+            return -1;
+        len -= n;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Forks a process which writes `total` bytes into the device, `chunk` bytes at a time.
+ *
+ * @return The process ID of the producer, or -1 on error.
+ */
+static pid_t start_producer(const char *dev, int use_splice, size_t total, size_t chunk) {
+    size_t written = 0;
+    struct iovec iov;
+    int fd, p[2];
+    char *buf;
+    ssize_t n;
+    pid_t pid;
+
+    pid = fork();
+    if (pid != 0)
+        return pid;  // Parent (or fork error).
+
+    fd = open(dev, O_WRONLY);
+    buf = malloc(chunk);
+    if (fd < 0 || !buf || (use_splice && pipe(p) < 0)) {
+        perror("Producer setup failed");
+        exit(1);
+    }
+    memset(buf, 'x', chunk);
+
+    // `write()` and the spliced writes sleep while the ring is full.
+    while (written < total) {
+        if (use_splice) {
+            // `vmsplice()` puts references to our buffer into the pipe, it doesn't copy it. Moving
+            // the pipe into the device is the only copy.
+            iov.iov_base = buf;
+            iov.iov_len = chunk;
+            n = vmsplice(p[1], &iov, 1, 0);
+            if (n < 0 || drain_pipe(p[0], fd, n) < 0) {
+                perror("Producer splice failed");
+                exit(1);
+            }
+        } else {
+            n = write(fd, buf, chunk);
+            if (n < 0) {
+                perror("Producer write failed");
+                exit(1);
+            }
+        }
+        written += n;
+    }
+
+    exit(0);
+}
+
+// This is a user space program.
+int main(int argc, char **argv) {
+    size_t total, chunk, received = 0;
+    const char *dest;
+    int use_splice;
+    int fd, out, status;
+    int p[2];
+    double start, secs;
+    char *buf;
+    ssize_t n;
+    pid_t pid;
+
+    // The first argument to this program is the file that should be opened.
+    if (argc < 2) {
+        // We can't do anything if no file was passed as an argument.
+        printf("I need the file to open as an argument!\n");
+        return 0;
+    }
+    use_splice = argc > 2 && strcmp(argv[2], "splice") == 0;
+    total = (argc > 3 ? strtoul(argv[3], NULL, 0) : 4096) << 20;
+    chunk = argc > 4 ? strtoul(argv[4], NULL, 0) : 16384;
+    dest = argc > 5 ? argv[5] : "/dev/null";
+
+    fd = open(argv[1], O_RDONLY);
+    out = open(dest, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    buf = malloc(chunk);
+
+    // Check if we couldn't open the files.
+    if (fd < 0 || out < 0 || !buf || pipe(p) < 0) {
+        perror("Setup failed");
+        return 1;
+    }
+
+    start = now_in_secs();
+
+    pid = start_producer(argv[1], use_splice, total, chunk);
+    if (pid < 0) {
+        perror("fork failed");
+        return 1;
+    }
+
+    while (received < total) {
+        // Both block while the ring is empty.
+        if (use_splice)
+            n = splice(fd, NULL, p[1], NULL, chunk, SPLICE_F_MOVE);
+        else
+            n = read(fd, buf, chunk);
+
+        if (n <= 0) {
+            perror("Error reading from device.");
+            return 1;
+        }
+
+        if (use_splice ? drain_pipe(p[0], out, n) < 0 : write(out, buf, n) != n) {
+            perror("Error writing to the destination.");
+            return 1;
+        }
+        received += n;
+    }
+
+    secs = now_in_secs() - start;
+    waitpid(pid, &status, 0);
+
+    printf("%-6s: %zu MiB in chunks of %zu bytes to %s in %.3f s = %.2f GB/s\n",
+           use_splice ? "splice" : "copy", total >> 20, chunk, dest, secs, total / secs / 1e9);
+
+    close(out);
+    close(fd);  // Close the file.
+    free(buf);
+
+    return 0;
+}
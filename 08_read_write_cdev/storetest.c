@@ -0,0 +1,136 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>  // For pread, pwrite, lseek and close.
+#include <fcntl.h>  // For the flags being associated with our character device.
+#include <time.h>
+
+// Uses the store device (the minor after the rings) as a RAM-backed scratch file:
+//   1. Checks the size with `lseek(SEEK_END)`.
+//   2. Writes blocks at random offsets with `pwrite()`, every block filled with its own offset.
+//   3. Reads them back with `pread()` in reverse order and verifies them.
+//   4. Reads a block that was never written and checks that it is all zeros.
+//
+// Usage: storetest <store device> [block size] [blocks]
+
+/**
+ * @brief Returns the current time of the monotonic clock in seconds.
+ */
+static double now_in_secs(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief Fills `buf` with a pattern that depends on `off`, so misplaced blocks are detected.
+ */
+static void fill(uint64_t *buf, size_t size, uint64_t off) {
+    size_t i;
+
+    for (i = 0; i < size / sizeof(*buf); i++)
+        buf[i] = off + i;
+}
+
+// This is a user space program.
+int main(int argc, char **argv) {
+    size_t block, nr_blocks, i, bad = 0;
+    uint64_t *buf, *expect, *offs;
+    off_t size, slots;
+    double start, secs;
+    int fd;
+
+    // The first argument to this program is the file that should be opened.
+    if (argc < 2) {
+        // We can't do anything if no file was passed as an argument.
+        printf("I need the file to open as an argument!\n");
+        return 0;
+    }
+    block = argc > 2 ? strtoul(argv[2], NULL, 0) : 4096;
+    nr_blocks = argc > 3 ? strtoul(argv[3], NULL, 0) : 65536;
+    if (block < sizeof(uint64_t) || block % sizeof(uint64_t) || nr_blocks == 0) {
+        printf("The block size must be a multiple of 8 and there must be at least one block.\n");
+        return 1;
+    }
+
+    fd = open(argv[1], O_RDWR);
+
+    // Check if we couldn't open the file.
+    if (fd < 0) {
+        perror("Error opening file.");
+        return fd;
+    }
+
+    // The store has a fixed size, `SEEK_END` tells us what it is.
+    size = lseek(fd, 0, SEEK_END);
+    if (size < 0) {
+        perror("lseek failed");
+        return 1;
+    }
+    slots = size / block;
+    printf("The store has %lld bytes = %lld blocks of %zu bytes\n", (long long)size, (long long)slots, block);
+    if (slots < 2) {
+        printf("The store is too small for this block size.\n");
+        return 1;
+    }
+
+    buf = malloc(block);
+    expect = malloc(block);
+    offs = malloc(nr_blocks * sizeof(*offs));
+    if (!buf || !expect || !offs) {
+        perror("malloc failed");
+        return 1;
+    }
+
+    // Random, block-aligned offsets. The last block is never written, so it stays a hole.
+    srand(1);
+    for (i = 0; i < nr_blocks; i++)
+        offs[i] = (uint64_t)(((unsigned long long)rand() << 31 | rand()) % (slots - 1)) * block;
+
+    start = now_in_secs();
+    for (i = 0; i < nr_blocks; i++) {
+        fill(buf, block, offs[i]);
+        if (pwrite(fd, buf, block, offs[i]) != (ssize_t)block) {
+            perror("pwrite failed");
+            return 1;
+        }
+    }
+    secs = now_in_secs() - start;
+    printf("pwrite: %zu blocks in %.3f s = %.0f MB/s\n", nr_blocks, secs, nr_blocks * block / secs / 1e6);
+
+    // Read them back in reverse order, so the reads don't follow the writes.
+    start = now_in_secs();
+    for (i = nr_blocks; i-- > 0;) {
+        if (pread(fd, buf, block, offs[i]) != (ssize_t)block) {
+            perror("pread failed");
+            return 1;
+        }
+        fill(expect, block, offs[i]);
+        if (memcmp(buf, expect, block))
+            bad++;
+    }
+    secs = now_in_secs() - start;
+    printf("pread:  %zu blocks in %.3f s = %.0f MB/s, %zu mismatches\n", nr_blocks, secs, nr_blocks * block / secs / 1e6, bad);
+
+    // Blocks that were written more than once hold the data of the last write, which has the same
+    // pattern. So any mismatch is a bug. A hole must read as zeros.
+    if (pread(fd, buf, block, (slots - 1) * block) != (ssize_t)block) {
+        perror("pread of the hole failed");
+        return 1;
+    }
+    memset(expect, 0, block);
+    printf("The hole at the end %s zeros\n", memcmp(buf, expect, block) ? "does NOT read as" : "reads as");
+
+    // Reading at the end returns nothing, writing there fails.
+    printf("pread at the end returns %zd, pwrite at the end returns %zd\n",
+           pread(fd, buf, block, size), pwrite(fd, buf, block, size));
+
+    close(fd);  // Close the file.
+    free(buf);
+    free(expect);
+    free(offs);
+
+    return bad ? 1 : 0;
+}
@@ -1,28 +1,219 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
 #include <unistd.h>  // For open and close.
 #include <fcntl.h>  // For the flags being associated with our character device.
+#include <poll.h>
+#include <time.h>
+#include <sys/mman.h>  // For mmap and munmap.
+#include <sys/ioctl.h>
+#include <sys/wait.h>
+
+#include "hello_cdev.h"
+
+#define RECORD_SIZE 256  // Size of every record that the writer process puts into the ring.
+#define READ_BUF_SIZE 65536  // Size of the buffer that the `read()` path copies into.
+
+/**
+ * @brief Returns the current time of the monotonic clock in seconds.
+ */
+static double now_in_secs(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief Forks a process which writes `total` bytes into the device, one record at a time.
+ *
+ * @return The process ID of the writer, or -1 on error.
+ */
+static pid_t start_writer(const char *dev, size_t total) {
+    char record[RECORD_SIZE];
+    size_t written = 0;
+    ssize_t n;
+    pid_t pid;
+    int fd;
+
+    pid = fork();
+    if (pid != 0)
+        return pid;  // Parent (or fork error).
+
+    fd = open(dev, O_WRONLY);
+    if (fd < 0) {
+        perror("Error opening file for writing.");
+        exit(1);
+    }
+
+    memset(record, 'x', sizeof(record));
+
+    // `write()` sleeps while the ring is full, so this runs in lockstep with the reader.
+    while (written < total) {
+        n = write(fd, record, sizeof(record));
+        if (n < 0) {
+            perror("Error writing to device.");
+            exit(1);
+        }
+        written += n;
+    }
+
+    close(fd);
+    exit(0);
+}
+
+/**
+ * @brief Consumes `total` bytes with `read()`.
+ *
+ * @return A checksum over the bytes, so the compiler can't drop the work.
+ */
+static unsigned long consume_with_read(int fd, size_t total) {
+    static char buf[READ_BUF_SIZE];
+    unsigned long sum = 0;
+    size_t got = 0;
+    ssize_t n, i;
+
+    while (got < total) {
+        n = read(fd, buf, sizeof(buf));
+        // Blocks while the ring is empty, so there is no zero to handle.
+        if (n <= 0) {
+            perror("Error reading from device.");
+            exit(1);
+        }
+
+        for (i = 0; i < n; i++)
+            sum += (unsigned char)buf[i];
+        got += n;
+    }
+
+    return sum;
+}
+
+/**
+ * @brief Consumes `total` bytes directly from the mapped ring. See `struct hello_ring_ctrl`.
+ *
+ * @return A checksum over the bytes, so the compiler can't drop the work.
+ */
+static unsigned long consume_with_mmap(int fd, struct hello_ring_ctrl *ctrl, size_t total) {
+    unsigned char *data = (unsigned char *)ctrl + ctrl->data_offset;
+    uint32_t mask = ctrl->size - 1;
+    struct hello_rec_hdr *hdr;
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+    unsigned long sum = 0;
+    size_t got = 0;
+    uint32_t tail, flags, len, rec_size, i;
+
+    while (got < total) {
+        tail = ctrl->tail;  // We are the only consumer, nobody else moves `tail`.
+        hdr = (struct hello_rec_hdr *)(data + (tail & mask));
+
+        // Pairs with the release in the driver. Once the flags are set, the payload is visible.
+        flags = __atomic_load_n(&hdr->flags, __ATOMIC_ACQUIRE);
+        if (!flags) {
+            // The ring is empty. Sleep until the driver commits the record at `tail`.
+            if (poll(&pfd, 1, -1) < 0) {
+                perror("Error polling the device.");
+                exit(1);
+            }
+            continue;
+        }
+
+        len = hdr->len;
+        if (flags & HELLO_REC_COMMITTED) {
+            for (i = 0; i < len; i++)
+                sum += data[(tail + sizeof(*hdr) + i) & mask];
+            got += len;
+        }
+
+        // Clear the whole record before handing its space back to the driver.
+        rec_size = (sizeof(*hdr) + len + HELLO_RING_ALIGN - 1) & ~(HELLO_RING_ALIGN - 1);
+        i = (tail & mask) + rec_size > ctrl->size ? ctrl->size - (tail & mask) : rec_size;
+        memset(data + (tail & mask), 0, i);
+        memset(data, 0, rec_size - i);  // The part that wrapped around, if any.
+
+        __atomic_store_n(&ctrl->tail, tail + rec_size, __ATOMIC_RELEASE);
+
+        // A writer that found the ring full sleeps until we ring the doorbell. The full barrier
+        // orders our `tail` before the look at `flags`, the driver does the same the other way round.
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&ctrl->flags, __ATOMIC_RELAXED) & HELLO_RING_NEED_WAKEUP)
+            ioctl(fd, HELLO_RING_WAKE);
+    }
+
+    return sum;
+}
+
+/**
+ * @brief Prints the throughput of one test.
+ */
+static void report(const char *name, size_t total, double secs, unsigned long sum) {
+    printf("%-6s: %zu bytes in %.3f s = %.1f MB/s (checksum %lu)\n",
+           name, total, secs, total / secs / 1e6, sum);
+}
 
 // This is a user space program.
 int main(int argc, char **argv) {
+    const char *dev = argc > 1 ? argv[1] : "/dev/hello0";
+    size_t total = (argc > 2 ? strtoul(argv[2], NULL, 0) : 64) << 20;  // In megabytes.
+    struct hello_ring_ctrl *ctrl;
+    size_t map_len;
+    unsigned long sum;
+    double start;
+    pid_t writer;
     int fd;  // File descriptor.
-    char c;
 
-    {  /* Test #1 */
-        // Open our character device [driver] with read/write permissions.
-        fd = open("/dev/hello0", O_RDWR);
+    // Open our character device [driver] with read/write permissions.
+    fd = open(dev, O_RDWR);
+
+    // Check if we couldn't open the file.
+    if (fd < 0) {
+        perror("Error opening file.");
+        return fd;
+    }
 
-        // Check if we couldn't open the file.
-        if (fd < 0) {
-            perror("Error opening file.");
-            return fd;
+    {  /* Test #1: Consume with one `read()` system call per buffer. */
+        start = now_in_secs();
+        writer = start_writer(dev, total);
+        if (writer < 0) {
+            perror("fork failed");
+            return 1;
         }
+        sum = consume_with_read(fd, total);
+        report("read()", total, now_in_secs() - start, sum);
+        waitpid(writer, NULL, 0);
+    }
 
-        // Keep reading 1 byte at a time until we reach the end.
-        while(read(fd, &c, 1))
-            putchar(c);  // Print the character that was read.
+    {  /* Test #2: Consume straight from the mapped pages. */
+        // Map only the control page first to learn how big the ring is.
+        ctrl = mmap(NULL, sysconf(_SC_PAGESIZE), PROT_READ, MAP_SHARED, fd, 0);
+        if (ctrl == MAP_FAILED) {
+            perror("Error mapping control page.");
+            return 1;
+        }
+        map_len = ctrl->data_offset + ctrl->size;
+        munmap(ctrl, sysconf(_SC_PAGESIZE));
 
-        close(fd);  // Close the file.
+        ctrl = mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (ctrl == MAP_FAILED) {
+            perror("Error mapping ring.");
+            return 1;
+        }
+
+        start = now_in_secs();
+        writer = start_writer(dev, total);
+        if (writer < 0) {
+            perror("fork failed");
+            return 1;
+        }
+        sum = consume_with_mmap(fd, ctrl, total);
+        report("mmap()", total, now_in_secs() - start, sum);
+        waitpid(writer, NULL, 0);
+
+        munmap(ctrl, map_len);
     }
 
+    close(fd);  // Close the file.
+
     return 0;
 }
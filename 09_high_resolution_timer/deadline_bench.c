@@ -0,0 +1,244 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>  // For open, close, read and getopt.
+#include <fcntl.h>  // For the flags being associated with our character device.
+#include <poll.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+
+#include "bench.h"
+#include "hrt_deadline.h"
+
+// Benchmarks the deadline scheduler of hrt_deadline.ko: how many timers per second it takes, and
+// how accurately they expire. Every thread opens the device, so it has its own timers and its own
+// completion channel. It adds timers in batches, each `delay` from now, and reads the expiries as
+// they come, keeping at most `inflight` timers pending. Optionally it cancels some of them again.
+//
+// Two latencies are reported for every expiry:
+//   • lateness: `fired_ns - expires_ns`, how late the kernel expired the timer.
+//   • delivery: when this program read the expiry, minus `expires_ns`. Includes the wake-up.
+//
+// Build: gcc -O2 -pthread -I../bench -o deadline_bench deadline_bench.c ../bench/bench.c
+// Usage: deadline_bench [-t threads] [-d secs] [-u delay us] [-b batch] [-i inflight] [-c cancel %] <device>
+
+struct config {
+    const char *dev;
+    unsigned int threads;
+    double secs;
+    unsigned int delay_us;
+    unsigned int batch;
+    unsigned int inflight;
+    unsigned int cancel_pct;  // Percentage of the timers that are cancelled right after adding them.
+};
+
+/**
+ * @brief One thread. Only written by the thread itself.
+ */
+struct worker {
+    pthread_t thread;
+    const struct config *cfg;
+    int failed;
+    uint64_t added, cancelled, expired;
+    struct hrtd_stats stats;  // From the last `HRTD_STATS`.
+    struct bench_hist lateness, delivery;
+};
+
+/**
+ * @brief Reads all expiries that are there. Waits for at least one if `wait` is set.
+ *
+ * @return The number of expiries, or -1 on error.
+ */
+static int drain(struct worker *w, int fd, int wait) {
+    struct hrtd_expiry ev[256];
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+    uint64_t now;
+    ssize_t n;
+    int total = 0, i;
+
+    if (wait && poll(&pfd, 1, 1000) < 0)
+        return -1;
+
+    while ((n = read(fd, ev, sizeof(ev))) > 0) {
+        now = bench_now_ns();
+        for (i = 0; i < n / (ssize_t)sizeof(ev[0]); i++) {
+            bench_hist_record(&w->lateness, ev[i].fired_ns - ev[i].expires_ns);
+            bench_hist_record(&w->delivery, now > ev[i].expires_ns ? now - ev[i].expires_ns : 0);
+        }
+        total += i;
+    }
+    if (n < 0 && errno != EAGAIN)
+        return -1;
+
+    // Nothing came in a whole second. Maybe expiries were lost, see `pending()`.
+    if (wait && !total && ioctl(fd, HRTD_STATS, &w->stats) < 0)
+        return -1;
+
+    w->expired += total;
+    return total;
+}
+
+/**
+ * @brief Returns the number of timers that neither expired nor were cancelled yet. Expiries that
+ * didn't fit into the completion channel never come, so they don't count.
+ */
+static uint64_t pending(const struct worker *w) {
+    return w->added - w->cancelled - w->expired - w->stats.overflow;
+}
+
+static void *worker_fn(void *arg) {
+    struct worker *w = arg;
+    const struct config *cfg = w->cfg;
+    struct hrtd_timer *timers;
+    struct hrtd_batch batch;
+    uint64_t end, seq = 0;
+    unsigned int i;
+    int fd, ret;
+
+    timers = calloc(cfg->batch, sizeof(*timers));
+    fd = open(cfg->dev, O_RDONLY | O_NONBLOCK);
+    if (fd < 0 || !timers) {
+        perror("Error opening the device.");
+        w->failed = 1;
+        free(timers);
+        return NULL;
+    }
+
+    batch.timers = (uintptr_t)timers;
+    batch.count = cfg->batch;
+    batch.pad = 0;
+
+    end = bench_now_ns() + (uint64_t)(cfg->secs * 1e9);
+
+    while (bench_now_ns() < end) {
+        // Don't run ahead of the kernel, or the completion channel overflows.
+        while (pending(w) + cfg->batch > cfg->inflight) {
+            if (drain(w, fd, 1) < 0)
+                goto fail;
+        }
+
+        for (i = 0; i < cfg->batch; i++) {
+            timers[i].expires_ns = cfg->delay_us * 1000ULL;
+            timers[i].user_data = seq++;
+            timers[i].flags = HRTD_RELATIVE;
+        }
+
+        ret = ioctl(fd, HRTD_ADD, &batch);
+        if (ret < 0) {
+            goto fail;
+        }
+        w->added += ret;
+
+        for (i = 0; i < (unsigned int)ret; i++) {
+            if (timers[i].user_data % 100 < cfg->cancel_pct && ioctl(fd, HRTD_CANCEL, &timers[i].id) == 0)
+                w->cancelled++;
+        }
+
+        if (drain(w, fd, 0) < 0)
+            goto fail;
+    }
+
+    // Wait for the rest of the timers.
+    while (pending(w) > 0) {
+        if (drain(w, fd, 1) < 0)
+            goto fail;
+    }
+
+    ioctl(fd, HRTD_STATS, &w->stats);
+    close(fd);
+    free(timers);
+    return NULL;
+
+fail:
+    perror("Error");
+    w->failed = 1;
+    close(fd);
+    free(timers);
+    return NULL;
+}
+
+static void hist_merge(struct bench_hist *sum, const struct bench_hist *h) {
+    unsigned int b;
+
+    for (b = 0; b < BENCH_HIST_BUCKETS; b++)
+        sum->buckets[b] += h->buckets[b];
+    sum->count += h->count;
+    if (h->max > sum->max)
+        sum->max = h->max;
+}
+
+static void hist_print(const char *name, const struct bench_hist *h) {
+    printf("%-9s p50 %8llu ns, p99 %8llu ns, p99.9 %8llu ns, max %9llu ns\n", name,
+           (unsigned long long)bench_hist_percentile(h, 5000), (unsigned long long)bench_hist_percentile(h, 9900),
+           (unsigned long long)bench_hist_percentile(h, 9990), (unsigned long long)h->max);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s [-t threads] [-d secs] [-u delay us] [-b batch] [-i inflight] [-c cancel %%] <device>\n",
+            prog);
+    exit(1);
+}
+
+// This is a user space program.
+int main(int argc, char **argv) {
+    struct config cfg = { .threads = 1, .secs = 5, .delay_us = 100, .batch = 64, .inflight = 8192 };
+    static struct bench_hist lateness, delivery;
+    uint64_t added = 0, cancelled = 0, expired = 0, overflow = 0, start;
+    struct worker *workers;
+    double secs;
+    unsigned int i;
+    int opt, failed = 0;
+
+    while ((opt = getopt(argc, argv, "t:d:u:b:i:c:")) != -1) {
+        switch (opt) {
+            case 't': cfg.threads = atoi(optarg); break;
+            case 'd': cfg.secs = atof(optarg); break;
+            case 'u': cfg.delay_us = atoi(optarg); break;
+            case 'b': cfg.batch = atoi(optarg); break;
+            case 'i': cfg.inflight = atoi(optarg); break;
+            case 'c': cfg.cancel_pct = atoi(optarg); break;
+            default: usage(argv[0]);
+        }
+    }
+    if (optind != argc - 1 || !cfg.threads || !cfg.batch || cfg.batch > HRTD_MAX_BATCH || cfg.inflight < cfg.batch)
+        usage(argv[0]);
+    cfg.dev = argv[optind];
+
+    workers = calloc(cfg.threads, sizeof(*workers));
+    if (!workers)
+        return 1;
+
+    start = bench_now_ns();
+    for (i = 0; i < cfg.threads; i++) {
+        workers[i].cfg = &cfg;
+        if (pthread_create(&workers[i].thread, NULL, worker_fn, &workers[i]) != 0) {
+            perror("pthread_create failed");
+            return 1;
+        }
+    }
+
+    for (i = 0; i < cfg.threads; i++) {
+        pthread_join(workers[i].thread, NULL);
+        failed |= workers[i].failed;
+        added += workers[i].added;
+        cancelled += workers[i].cancelled;
+        expired += workers[i].expired;
+        overflow += workers[i].stats.overflow;
+        hist_merge(&lateness, &workers[i].lateness);
+        hist_merge(&delivery, &workers[i].delivery);
+    }
+    secs = (bench_now_ns() - start) / 1e9;
+
+    printf("%u threads, delay %u us, batch %u, inflight %u: %.0f timers/s added, %.0f expired/s, "
+           "%llu cancelled, %llu lost\n",
+           cfg.threads, cfg.delay_us, cfg.batch, cfg.inflight, added / secs, expired / secs,
+           (unsigned long long)cancelled, (unsigned long long)overflow);
+    hist_print("lateness", &lateness);
+    hist_print("delivery", &delivery);
+
+    free(workers);
+
+    return failed;
+}
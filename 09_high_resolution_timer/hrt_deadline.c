@@ -0,0 +1,854 @@
+// Linux kernel headers are in the "linux" subfolder.
+// Linux kernel headers contain all the header and make files that are needed to build a Linux kernel module.
+#include <linux/module.h>
+#include <linux/init.h>
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>  // For `ktime_get_ns()`.
+#include <linux/fs.h>  // "fs" stands for "file system."
+#include <linux/percpu.h>
+#include <linux/slab.h>  // For `kmem_cache_alloc()` and `kvmalloc_array()`.
+#include <linux/spinlock.h>
+#include <linux/mutex.h>
+#include <linux/wait.h>
+#include <linux/poll.h>  // For `poll_wait()`.
+#include <linux/xarray.h>
+#include <linux/uaccess.h>  // For `copy_from_user()` and `copy_to_user()`.
+#include <linux/uio.h>  // For `struct iov_iter` and `copy_to_iter()`.
+#include <linux/log2.h>  // For `is_power_of_2()`.
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+
+#include <lat_hist.h>
+#include "hrt_deadline.h"
+
+// A deadline scheduler for user space. Arming one hrtimer per deadline doesn't scale to hundreds
+// of thousands of deadlines per second: every hrtimer is a node in the per-CPU rbtree of the
+// hrtimer core, and every start reprograms the clock event device. Instead, every CPU keeps its
+// deadlines in a binary min-heap, and one pinned hrtimer per CPU is programmed to the earliest of
+// them. The callback expires what is due and re-arms the timer for the next deadline. It expires at
+// most `HRTD_EXPIRE_BATCH` entries per run, so a burst of deadlines can't keep the CPU in hard
+// interrupt context with the heap locked for an unbounded time.
+//
+// A timing wheel would make adding O(1), but it rounds every deadline to the resolution of its
+// slots. The heap keeps the exact deadline, costs O(log n) to add or cancel, and the hrtimer is
+// only reprogrammed when a new deadline is earlier than all others.
+//
+// Timers are queued on the heap of the CPU that adds them, so threads on different CPUs don't
+// share a lock. If a CPU goes offline, the hrtimer core moves its hrtimer to another CPU, which
+// then expires the rest of that heap. Everything is protected by the heap's lock, not by running
+// on the right CPU.
+
+// Timers that `hrtd_add()` copies in and queues at a time.
+#define HRTD_CHUNK 16
+
+// Slots of a heap when it's first used. It doubles whenever it's full.
+#define HRTD_MIN_HEAP 1024
+
+// Entries that one run of the timer callback expires at most. The rest is left for the next run.
+#define HRTD_EXPIRE_BATCH 256
+
+/**
+ * @brief One pending timer.
+ */
+struct hrtd_entry {
+    u64 expires;  // CLOCK_MONOTONIC time in nanoseconds.
+    u64 user_data;
+    struct hrtd_file *owner;
+    u32 id;  // Index in `owner->timers`.
+    unsigned int cpu;  // CPU of the heap that holds the entry. Set before the entry is in `owner->timers`.
+    unsigned int idx;  // Position in the heap. Written under the heap's lock.
+};
+
+/**
+ * @brief The deadlines of one CPU and the hrtimer that expires them.
+ * @details
+ * Lock order: `lock`, then the `timers` xarray and the `lock` of a file.
+ */
+struct hrtd_cpu {
+    spinlock_t lock;  // Protects everything below, and `idx` of the entries in `heap`.
+    struct hrtd_entry **heap;  // Min-heap by `expires`, `size` slots.
+    unsigned int nr;  // Entries in the heap.
+    unsigned int size;
+    struct hrtimer timer;  // Queued, or running its callback, whenever the heap isn't empty.
+};
+
+/**
+ * @brief An open file: a set of timers and the channel that their expiries are read from.
+ * @details
+ * The callbacks of all CPUs add expiries to `events`, so they take `lock`. There is one reader at a
+ * time, it only moves `tail` and needs no spinlock.
+ */
+struct hrtd_file {
+    struct xarray timers;  // Pending entries by ID.
+    u32 next_id;  // For `xa_alloc_cyclic()`.
+    atomic_t pending;  // Entries that were added and have neither expired nor been cancelled.
+
+    spinlock_t lock;
+    struct hrtd_expiry *events;  // `nr_events` entries.
+    unsigned int head;  // Next expiry to write. Written under `lock`.
+    unsigned int tail;  // Next expiry to read. Written by `hrtd_read_iter()`.
+    u64 expired, overflow;  // Written under `lock`.
+
+    atomic64_t added, cancelled;
+    struct mutex read_lock;
+    wait_queue_head_t wq;  // Readers and `poll()` wait here for expiries.
+};
+
+// Global variables.
+static DEFINE_PER_CPU(struct hrtd_cpu, hrtd_cpus);
+static struct lat_hist __percpu *hrtd_hists;  // Lateness of the expiries per CPU.
+static struct kmem_cache *hrtd_cache;  // For `struct hrtd_entry`.
+static struct dentry *debugfs_dir;
+static int major_dev_num;  // Major device number that will be allocated by our kernel module.
+
+static unsigned int nr_events = 16384;
+module_param(nr_events, uint, 0444);
+MODULE_PARM_DESC(nr_events, "Expiries buffered per open file (power of two)");
+
+static unsigned int max_pending = 1 << 20;
+module_param(max_pending, uint, 0644);
+MODULE_PARM_DESC(max_pending, "Most pending timers per open file");
+
+static unsigned int slack_ns;
+module_param(slack_ns, uint, 0644);
+MODULE_PARM_DESC(slack_ns, "How late the hrtimer may fire, so the hrtimer core can batch it with other timers");
+
+/**
+ * @brief Puts entry `e` into slot `idx` of the heap.
+ */
+static void hrtd_heap_set(struct hrtd_cpu *hc, unsigned int idx, struct hrtd_entry *e) {
+    hc->heap[idx] = e;
+    e->idx = idx;
+}
+
+/**
+ * @brief Moves the entry in slot `idx` up, until its parent expires no later than it does.
+ */
+static void hrtd_sift_up(struct hrtd_cpu *hc, unsigned int idx) {
+    struct hrtd_entry *e = hc->heap[idx];
+    unsigned int parent;
+
+    while (idx) {
+        parent = (idx - 1) / 2;
+        if (hc->heap[parent]->expires <= e->expires)
+            break;
+        hrtd_heap_set(hc, idx, hc->heap[parent]);
+        idx = parent;
+    }
+    hrtd_heap_set(hc, idx, e);
+}
+
+/**
+ * @brief Moves the entry in slot `idx` down, until both children expire no earlier than it does.
+ */
+static void hrtd_sift_down(struct hrtd_cpu *hc, unsigned int idx) {
+    struct hrtd_entry *e = hc->heap[idx];
+    unsigned int child;
+
+    for (;;) {
+        child = 2 * idx + 1;
+        if (child >= hc->nr)
+            break;
+        if (child + 1 < hc->nr && hc->heap[child + 1]->expires < hc->heap[child]->expires)
+            child++;
+        if (e->expires <= hc->heap[child]->expires)
+            break;
+        hrtd_heap_set(hc, idx, hc->heap[child]);
+        idx = child;
+    }
+    hrtd_heap_set(hc, idx, e);
+}
+
+static void hrtd_heap_push(struct hrtd_cpu *hc, struct hrtd_entry *e) {
+    hc->heap[hc->nr] = e;
+    hrtd_sift_up(hc, hc->nr++);
+}
+
+/**
+ * @brief Removes the entry in slot `idx`. The last entry takes its place.
+ */
+static void hrtd_heap_remove(struct hrtd_cpu *hc, unsigned int idx) {
+    struct hrtd_entry *last = hc->heap[--hc->nr];
+
+    if (idx == hc->nr)
+        return;
+
+    hrtd_heap_set(hc, idx, last);
+
+    // The last entry can belong above or below the slot, depending on where in the heap it is.
+    if (idx && last->expires < hc->heap[(idx - 1) / 2]->expires)
+        hrtd_sift_up(hc, idx);
+    else
+        hrtd_sift_down(hc, idx);
+}
+
+/**
+ * @brief Makes room for `n` more entries in a heap that has `size` slots.
+ * @details
+ * Allocating can sleep, so it is done without the lock. If another task grew the heap meanwhile,
+ * the new array is thrown away and the caller simply checks again.
+ *
+ * @return Zero, or -ENOMEM.
+ */
+static int hrtd_grow(struct hrtd_cpu *hc, unsigned int size, unsigned int n) {
+    struct hrtd_entry **heap, **old;
+    unsigned int new_size = max3(2 * size, size + n, (unsigned int)HRTD_MIN_HEAP);
+    unsigned long flags;
+
+    heap = kvmalloc_array(new_size, sizeof(*heap), GFP_KERNEL);
+    if (!heap)
+        return -ENOMEM;
+
+    spin_lock_irqsave(&hc->lock, flags);
+    if (hc->size == size) {
+        memcpy(heap, hc->heap, hc->nr * sizeof(*heap));
+        old = hc->heap;
+        hc->heap = heap;
+        hc->size = new_size;
+    } else {
+        old = heap;
+    }
+    spin_unlock_irqrestore(&hc->lock, flags);
+
+    kvfree(old);
+    return 0;
+}
+
+/**
+ * @brief Adds an expiry to the completion channel of the file that owns `e`.
+ *
+ * @param[in] now: When the callback that expires `e` started.
+ */
+static void hrtd_complete(struct hrtd_entry *e, u64 now) {
+    struct hrtd_file *f = e->owner;
+    struct hrtd_expiry *ev;
+    unsigned int head;
+
+    spin_lock(&f->lock);
+
+    head = f->head;
+
+    // Pairs with the `smp_store_release()` of `tail` in `hrtd_read_iter()`.
+    if (head - smp_load_acquire(&f->tail) >= nr_events) {
+        f->overflow++;
+    } else {
+        ev = &f->events[head & (nr_events - 1)];
+        ev->id = e->id;
+        ev->user_data = e->user_data;
+        ev->expires_ns = e->expires;
+        ev->fired_ns = now;
+
+        // Publish the expiry. The reader sees its contents before it sees the new `head`.
+        smp_store_release(&f->head, head + 1);
+    }
+    f->expired++;
+
+    spin_unlock(&f->lock);
+}
+
+/**
+ * @brief Wakes up the readers of `f`. Does nothing, not even a lock, if nobody waits.
+ */
+static void hrtd_wake(struct hrtd_file *f) {
+    if (f && wq_has_sleeper(&f->wq))
+        wake_up_interruptible(&f->wq);
+}
+
+/**
+ * @brief Timer expiry callback function. Runs in hard interrupt context.
+ * @details
+ * Expires up to `HRTD_EXPIRE_BATCH` entries of the heap that are due, then programs the timer to the
+ * next deadline. If due entries are left, it programs the timer to the current time instead.
+ *
+ * @return If the timer should be restarted or not.
+ */
+static enum hrtimer_restart hrtd_timer_fn(struct hrtimer *timer) {
+    struct hrtd_cpu *hc = container_of(timer, struct hrtd_cpu, timer);
+    struct lat_hist *hist = this_cpu_ptr(hrtd_hists);
+    struct hrtd_file *wake = NULL;
+    enum hrtimer_restart ret = HRTIMER_NORESTART;
+    struct hrtd_entry *e;
+    unsigned int budget = HRTD_EXPIRE_BATCH;
+    u64 now, next;
+
+    spin_lock(&hc->lock);
+
+    now = ktime_get_ns();
+
+    while (budget && hc->nr && (e = hc->heap[0])->expires <= now) {
+        budget--;
+        hrtd_heap_remove(hc, 0);
+        lat_hist_record(hist, now - e->expires);
+        hrtd_complete(e, now);
+
+        // Expiries usually come in runs of the same file, so wake its readers once per run.
+        if (e->owner != wake) {
+            hrtd_wake(wake);
+            wake = e->owner;
+        }
+
+        // From here on, `HRTD_CANCEL` can't find the entry. The file itself can't go away until we
+        // drop `hc->lock`, see `hrtd_release()`.
+        atomic_dec(&e->owner->pending);
+        xa_erase(&e->owner->timers, e->id);
+        kmem_cache_free(hrtd_cache, e);
+    }
+    hrtd_wake(wake);
+
+    // After a CPU went offline, its timer runs on another CPU, and `hrtd_queue()` may have started
+    // it again while we waited for the lock. It is already programmed then.
+    if (hc->nr && !hrtimer_is_queued(timer)) {
+        next = hc->heap[0]->expires;
+
+        // The batch is used up, but entries are still due. Run again right away. Taking the time
+        // anew queues us behind the other hrtimers that expired meanwhile, and the lock is dropped
+        // in between, so the rest of the run doesn't hold up everything else.
+        if (!budget && next <= now)
+            next = ktime_get_ns();
+
+        hrtimer_set_expires_range_ns(timer, ns_to_ktime(next), READ_ONCE(slack_ns));
+        ret = HRTIMER_RESTART;
+    }
+
+    spin_unlock(&hc->lock);
+
+    return ret;
+}
+
+/**
+ * @brief Checks one timer of `HRTD_ADD`, and allocates its entry and ID.
+ *
+ * @param[inout] t: The timer. Its `id` is filled in.
+ * @param[out] ep: The new entry. It isn't queued yet.
+ *
+ * @return Zero, or a negative errno.
+ */
+static int hrtd_prepare(struct hrtd_file *f, struct hrtd_timer *t, struct hrtd_entry **ep) {
+    struct hrtd_entry *e;
+    u64 expires = t->expires_ns;
+    u32 id;
+    int ret;
+
+    if (t->flags & ~HRTD_RELATIVE)
+        return -EINVAL;
+    if ((t->flags & HRTD_RELATIVE) && check_add_overflow(expires, ktime_get_ns(), &expires))
+        return -EINVAL;
+    if (expires > (u64)KTIME_MAX)
+        return -EINVAL;
+
+    if ((unsigned int)atomic_inc_return(&f->pending) > READ_ONCE(max_pending)) {
+        ret = -ENOSPC;
+        goto err_pending;
+    }
+
+    e = kmem_cache_alloc(hrtd_cache, GFP_KERNEL);
+    if (!e) {
+        ret = -ENOMEM;
+        goto err_pending;
+    }
+
+    // Reserve the ID now, while we may sleep. `hrtd_queue()` stores the entry under it without
+    // allocating. IDs go round, so a cancelled ID isn't handed out again right away.
+    ret = xa_alloc_cyclic_irq(&f->timers, &id, NULL, xa_limit_32b, &f->next_id, GFP_KERNEL);
+    if (ret < 0)
+        goto err_free;
+
+    e->expires = expires;
+    e->user_data = t->user_data;
+    e->owner = f;
+    e->id = id;
+    t->id = id;
+    *ep = e;
+    return 0;
+
+err_free:
+    kmem_cache_free(hrtd_cache, e);
+err_pending:
+    atomic_dec(&f->pending);
+    return ret;
+}
+
+/**
+ * @brief Undoes `hrtd_prepare()` for an entry that was never queued.
+ */
+static void hrtd_unprepare(struct hrtd_file *f, struct hrtd_entry *e) {
+    xa_erase_irq(&f->timers, e->id);
+    kmem_cache_free(hrtd_cache, e);
+    atomic_dec(&f->pending);
+}
+
+/**
+ * @brief Queues `n` prepared entries on the heap of the CPU we run on.
+ * @details
+ * The timer of that CPU is pinned, so it can only be started from that CPU. That's why interrupts
+ * stay off from picking the heap until the timer is programmed.
+ *
+ * @return Zero, or -ENOMEM if the heap couldn't grow.
+ */
+static int hrtd_queue(struct hrtd_file *f, struct hrtd_entry **entries, unsigned int n) {
+    struct hrtd_cpu *hc;
+    unsigned long flags;
+    unsigned int i, size;
+    u64 first;
+    int ret;
+
+    for (;;) {
+        local_irq_save(flags);
+        hc = this_cpu_ptr(&hrtd_cpus);
+        spin_lock(&hc->lock);
+        if (hc->nr + n <= hc->size)
+            break;
+
+        size = hc->size;
+        spin_unlock(&hc->lock);
+        local_irq_restore(flags);
+
+        // We may run on another CPU after this, so check again.
+        ret = hrtd_grow(hc, size, n);
+        if (ret)
+            return ret;
+    }
+
+    first = hc->nr ? hc->heap[0]->expires : U64_MAX;
+
+    for (i = 0; i < n; i++) {
+        entries[i]->cpu = smp_processor_id();
+
+        // The ID was reserved by `hrtd_prepare()`, so this doesn't allocate.
+        xa_store(&f->timers, entries[i]->id, entries[i], GFP_ATOMIC);
+        hrtd_heap_push(hc, entries[i]);
+    }
+
+    // Only reprogram the timer if the earliest deadline of this CPU moved. Otherwise the timer is
+    // already queued for a deadline that is earlier than all of the new ones.
+    if (hc->heap[0]->expires < first)
+        hrtimer_start_range_ns(&hc->timer, ns_to_ktime(hc->heap[0]->expires), READ_ONCE(slack_ns),
+                               HRTIMER_MODE_ABS_PINNED);
+
+    spin_unlock(&hc->lock);
+    local_irq_restore(flags);
+
+    return 0;
+}
+
+/**
+ * @brief Handles `HRTD_ADD`. Copies the timers in chunks, queues every chunk under one lock and
+ * copies the IDs back.
+ *
+ * @return The number of timers that were added, or a negative errno if none was.
+ */
+static long hrtd_add(struct hrtd_file *f, const struct hrtd_batch *batch) {
+    struct hrtd_timer __user *utimers = u64_to_user_ptr(batch->timers);
+    struct hrtd_timer timers[HRTD_CHUNK];
+    struct hrtd_entry *entries[HRTD_CHUNK];
+    u32 done, n, i;
+    long ret = 0;
+
+    if (batch->count > HRTD_MAX_BATCH)
+        return -EINVAL;
+
+    for (done = 0; done < batch->count && !ret; done += n) {
+        n = min_t(u32, batch->count - done, HRTD_CHUNK);
+        if (copy_from_user(timers, utimers + done, n * sizeof(timers[0]))) {
+            ret = -EFAULT;
+            break;
+        }
+
+        // Stop at the first timer that fails, but still queue the ones before it.
+        for (i = 0; i < n; i++) {
+            ret = hrtd_prepare(f, &timers[i], &entries[i]);
+            if (ret)
+                break;
+        }
+        n = i;
+        if (!n)
+            break;
+
+        if (hrtd_queue(f, entries, n)) {
+            for (i = 0; i < n; i++)
+                hrtd_unprepare(f, entries[i]);
+            ret = -ENOMEM;
+            break;
+        }
+        atomic64_add(n, &f->added);
+
+        // The timers may have expired already, that's fine. The IDs just can't be cancelled anymore.
+        if (copy_to_user(utimers + done, timers, n * sizeof(timers[0]))) {
+            ret = -EFAULT;
+            done += n;
+            break;
+        }
+    }
+
+    return done ? done : ret;
+}
+
+/**
+ * @brief Handles `HRTD_CANCEL`.
+ *
+ * @return Zero, or -ENOENT if the timer already expired or doesn't exist.
+ */
+static int hrtd_cancel(struct hrtd_file *f, u64 id) {
+    struct hrtd_entry *e;
+    struct hrtd_cpu *hc;
+    unsigned long flags;
+    unsigned int cpu = 0;
+
+    if (id > U32_MAX)
+        return -ENOENT;
+
+    // The callback erases the entry before it frees it, so the entry can't be freed while we hold
+    // the lock of the xarray.
+    xa_lock_irqsave(&f->timers, flags);
+    e = xa_load(&f->timers, id);
+    if (e)
+        cpu = e->cpu;
+    xa_unlock_irqrestore(&f->timers, flags);
+
+    if (!e)
+        return -ENOENT;
+
+    hc = per_cpu_ptr(&hrtd_cpus, cpu);
+    spin_lock_irqsave(&hc->lock, flags);
+
+    // The timer may have expired since. It's still pending if the ID still leads to it, because the
+    // callback erases the ID under `hc->lock`. An ID is only handed out again after 2^32 others, so
+    // a new timer with the same ID can't be in the way.
+    if (xa_load(&f->timers, id) != e) {
+        spin_unlock_irqrestore(&hc->lock, flags);
+        return -ENOENT;
+    }
+
+    // The timer stays programmed if this was the earliest deadline. It fires early, finds nothing to
+    // expire and moves on to the next deadline.
+    hrtd_heap_remove(hc, e->idx);
+    xa_erase(&f->timers, id);
+
+    spin_unlock_irqrestore(&hc->lock, flags);
+
+    kmem_cache_free(hrtd_cache, e);
+    atomic_dec(&f->pending);
+    atomic64_inc(&f->cancelled);
+
+    return 0;
+}
+
+/**
+ * @brief The `unlocked_ioctl()` callback function.
+ *
+ * @param[in] cmd: `HRTD_ADD`, `HRTD_CANCEL` or `HRTD_STATS`.
+ * @param[in] arg: User space pointer to the argument of the command.
+ *
+ * @return See the commands in hrt_deadline.h. -ENOTTY for unknown commands.
+ */
+static long hrtd_ioctl(struct file *filp, unsigned int cmd, unsigned long arg) {
+    struct hrtd_file *f = filp->private_data;
+    void __user *uarg = (void __user *)arg;
+    struct hrtd_batch batch;
+    struct hrtd_stats stats;
+    u64 id;
+
+    switch (cmd) {
+        case HRTD_ADD:
+            if (copy_from_user(&batch, uarg, sizeof(batch)))
+                return -EFAULT;
+            return hrtd_add(f, &batch);
+
+        case HRTD_CANCEL:
+            if (copy_from_user(&id, uarg, sizeof(id)))
+                return -EFAULT;
+            return hrtd_cancel(f, id);
+
+        case HRTD_STATS:
+            stats.added = atomic64_read(&f->added);
+            stats.cancelled = atomic64_read(&f->cancelled);
+            stats.expired = READ_ONCE(f->expired);
+            stats.overflow = READ_ONCE(f->overflow);
+            if (copy_to_user(uarg, &stats, sizeof(stats)))
+                return -EFAULT;
+            return 0;
+
+        default:
+            return -ENOTTY;
+    }
+}
+
+/**
+ * @brief The `read_iter()` callback function. Writes from kernel space to user space.
+ * @details
+ * Returns as many whole `struct hrtd_expiry` as fit. Blocks until there is one, unless the file
+ * was opened with O_NONBLOCK.
+ *
+ * @param[in] iocb: Describes the I/O request.
+ * @param[inout] to: The user space buffers to copy into.
+ *
+ * @return The number of bytes that were read successfully.
+ */
+static ssize_t hrtd_read_iter(struct kiocb *iocb, struct iov_iter *to) {
+    struct hrtd_file *f = iocb->ki_filp->private_data;
+    unsigned int head, tail, n;
+    size_t copied = 0, len;
+    ssize_t ret = 0;
+
+    if (iov_iter_count(to) < sizeof(struct hrtd_expiry))
+        return -EINVAL;
+
+    if (mutex_lock_interruptible(&f->read_lock))
+        return -ERESTARTSYS;
+
+    // Pairs with the `smp_store_release()` in `hrtd_complete()`.
+    while ((head = smp_load_acquire(&f->head)) == f->tail) {
+        mutex_unlock(&f->read_lock);
+
+        if ((iocb->ki_filp->f_flags & O_NONBLOCK) || (iocb->ki_flags & IOCB_NOWAIT))
+            return -EAGAIN;
+        if (wait_event_interruptible(f->wq, smp_load_acquire(&f->head) != READ_ONCE(f->tail)))
+            return -ERESTARTSYS;
+        if (mutex_lock_interruptible(&f->read_lock))
+            return -ERESTARTSYS;
+    }
+
+    tail = f->tail;
+
+    // Copy the expiries up to the end of the ring in one go, then the ones at its start.
+    while (tail != head && iov_iter_count(to) >= sizeof(struct hrtd_expiry)) {
+        n = min3(head - tail, nr_events - (tail & (nr_events - 1)),
+                 (unsigned int)(iov_iter_count(to) / sizeof(struct hrtd_expiry)));
+        len = n * sizeof(struct hrtd_expiry);
+        if (copy_to_iter(&f->events[tail & (nr_events - 1)], len, to) != len) {
+            ret = -EFAULT;
+            break;
+        }
+        tail += n;
+        copied += len;
+    }
+
+    // Hand the slots back to the callbacks.
+    smp_store_release(&f->tail, tail);
+
+    mutex_unlock(&f->read_lock);
+
+    return copied ? copied : ret;
+}
+
+/**
+ * @brief The `poll()` callback function. The file is readable while there are expiries.
+ */
+static __poll_t hrtd_poll(struct file *filp, poll_table *wait) {
+    struct hrtd_file *f = filp->private_data;
+
+    poll_wait(filp, &f->wq, wait);
+
+    return smp_load_acquire(&f->head) != READ_ONCE(f->tail) ? EPOLLIN | EPOLLRDNORM : 0;
+}
+
+/**
+ * @brief The `open()` callback function. Every open file gets its own timers and completion channel.
+ *
+ * @return Zero, or -ENOMEM.
+ */
+static int hrtd_open(struct inode *inode, struct file *filp) {
+    struct hrtd_file *f;
+
+    f = kzalloc(sizeof(*f), GFP_KERNEL);
+    if (!f)
+        return -ENOMEM;
+
+    f->events = kvmalloc_array(nr_events, sizeof(*f->events), GFP_KERNEL);
+    if (!f->events) {
+        kfree(f);
+        return -ENOMEM;
+    }
+
+    // The timer callbacks erase IDs in hard interrupt context, so the xarray's lock disables
+    // interrupts. IDs start at 1, so 0 is never a valid ID.
+    xa_init_flags(&f->timers, XA_FLAGS_ALLOC1 | XA_FLAGS_LOCK_IRQ);
+    spin_lock_init(&f->lock);
+    mutex_init(&f->read_lock);
+    init_waitqueue_head(&f->wq);
+
+    filp->private_data = f;
+    return 0;
+}
+
+/**
+ * @brief The `release()` callback function. Cancels all timers of the file.
+ */
+static int hrtd_release(struct inode *inode, struct file *filp) {
+    struct hrtd_file *f = filp->private_data;
+    struct hrtd_entry *e;
+    unsigned long id;
+    unsigned int cpu;
+
+    // No ioctl can run anymore, so only the callbacks still remove entries.
+    xa_for_each(&f->timers, id, e)
+        hrtd_cancel(f, id);
+
+    // A callback that expired the last entries may still be waking up our readers. It does that
+    // under the lock of its heap, so once we got every lock, no callback uses the file anymore.
+    for_each_possible_cpu(cpu) {
+        spin_lock_irq(&per_cpu_ptr(&hrtd_cpus, cpu)->lock);
+        spin_unlock_irq(&per_cpu_ptr(&hrtd_cpus, cpu)->lock);
+    }
+
+    xa_destroy(&f->timers);
+    kvfree(f->events);
+    kfree(f);
+
+    return 0;
+}
+
+static struct file_operations fops = {
+    // Set file operations function pointers to our own functions.
+    .owner = THIS_MODULE,
+    .open = hrtd_open,
+    .release = hrtd_release,
+    .read_iter = hrtd_read_iter,
+    .poll = hrtd_poll,
+    .unlocked_ioctl = hrtd_ioctl,
+    .compat_ioctl = compat_ptr_ioctl,  // The structs are the same on 32 bit, only `arg` needs converting.
+};
+
+/**
+ * @brief Prints the lateness percentiles of all CPUs, and the pending timers per CPU, into the
+ * debugfs file `latency`.
+ */
+static int latency_show(struct seq_file *m, void *unused) {
+    struct lat_hist *sum;
+    unsigned int cpu;
+
+    sum = kzalloc(sizeof(*sum), GFP_KERNEL);
+    if (!sum)
+        return -ENOMEM;
+
+    for_each_possible_cpu(cpu)
+        lat_hist_add(sum, per_cpu_ptr(hrtd_hists, cpu));
+
+    lat_hist_show(m, sum);
+
+    for_each_possible_cpu(cpu)
+        if (READ_ONCE(per_cpu_ptr(&hrtd_cpus, cpu)->nr))
+            seq_printf(m, "cpu%u pending: %u\n", cpu, READ_ONCE(per_cpu_ptr(&hrtd_cpus, cpu)->nr));
+
+    kfree(sum);
+    return 0;
+}
+
+/**
+ * @brief Clears the histograms of all CPUs.
+ */
+static ssize_t latency_write(struct file *file, const char __user *user_buf, size_t len, loff_t *off) {
+    unsigned int cpu;
+
+    for_each_possible_cpu(cpu)
+        lat_hist_reset(per_cpu_ptr(hrtd_hists, cpu));
+
+    return len;
+}
+
+static int latency_open(struct inode *inode, struct file *file) {
+    return single_open(file, latency_show, NULL);
+}
+
+static const struct file_operations latency_fops = {
+    .owner = THIS_MODULE,
+    .open = latency_open,
+    .read = seq_read,
+    .write = latency_write,
+    .llseek = seq_lseek,
+    .release = single_release,
+};
+
+/**
+ * @brief Cancels the timers and frees the heaps of all CPUs. The heaps are empty by now, every
+ * file was closed before the module can be removed.
+ */
+static void hrtd_stop(void) {
+    struct hrtd_cpu *hc;
+    unsigned int cpu;
+
+    for_each_possible_cpu(cpu) {
+        hc = per_cpu_ptr(&hrtd_cpus, cpu);
+        hrtimer_cancel(&hc->timer);
+        kvfree(hc->heap);
+        hc->heap = NULL;
+    }
+}
+
+/**
+ * @brief Callback function for when the module is loaded into the kernel.
+ *
+ * @return Zero if the loading of the module was successful.
+ */
+static int __init my_init(void) {
+    struct hrtd_cpu *hc;
+    unsigned int cpu;
+
+    pr_info("hrt_deadline - Hello, Kernel!\n");
+
+    if (nr_events < 2 || !is_power_of_2(nr_events)) {
+        pr_err("hrt_deadline - nr_events must be a power of two\n");
+        return -EINVAL;
+    }
+
+    hrtd_cache = KMEM_CACHE(hrtd_entry, 0);
+    if (!hrtd_cache)
+        return -ENOMEM;
+
+    hrtd_hists = alloc_percpu(struct lat_hist);
+    if (!hrtd_hists) {
+        kmem_cache_destroy(hrtd_cache);
+        return -ENOMEM;
+    }
+
+    // Every possible CPU, so a CPU that comes online later can take timers right away. The heaps
+    // are only allocated when the first timer is added on a CPU.
+    for_each_possible_cpu(cpu) {
+        hc = per_cpu_ptr(&hrtd_cpus, cpu);
+        spin_lock_init(&hc->lock);
+        hrtimer_init(&hc->timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS_PINNED);
+        hc->timer.function = &hrtd_timer_fn;
+    }
+
+    major_dev_num = register_chrdev(0, "hrt_deadline", &fops);
+
+    // Check for error while registering the character device.
+    if (major_dev_num < 0) {
+        pr_err("hrt_deadline - Error registering character device\n");
+        free_percpu(hrtd_hists);
+        kmem_cache_destroy(hrtd_cache);
+        return major_dev_num;
+    }
+
+    // Export the lateness percentiles as /sys/kernel/debug/hrt_deadline/latency. Reading it prints
+    // them, writing anything to it clears the histograms. debugfs is optional, so errors are ignored.
+    debugfs_dir = debugfs_create_dir("hrt_deadline", NULL);
+    debugfs_create_file("latency", 0600, debugfs_dir, NULL, &latency_fops);
+
+    pr_info("hrt_deadline - Major device number: %d\n", major_dev_num);
+
+    return 0;
+}
+
+/**
+ * @brief Callback function for when the module is removed from the kernel.
+ */
+static void __exit my_exit(void) {
+    debugfs_remove_recursive(debugfs_dir);
+    unregister_chrdev(major_dev_num, "hrt_deadline");
+    hrtd_stop();
+    free_percpu(hrtd_hists);
+    kmem_cache_destroy(hrtd_cache);
+
+    pr_info("hrt_deadline - Goodbye, Kernel!\n");
+}
+
+// Specify the function to use when the module is loaded into the kernel.
+module_init(my_init);
+
+// Specify the function to use when the module is removed from the kernel.
+module_exit(my_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("Preston");
+MODULE_DESCRIPTION("A deadline scheduler on top of one high resolution timer per CPU");
@@ -0,0 +1,71 @@
+#ifndef HRT_DEADLINE_H
+#define HRT_DEADLINE_H
+
+// This header is shared by the kernel module and the user space programs, so only use the
+// fixed-size types from <linux/types.h>. Pointers are passed as `__u64`, so every struct has the
+// same layout on 32 and 64 bit.
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+// The deadline scheduler. Every open file of the device is a set of timers and a completion channel:
+// `HRTD_ADD` adds timers, `HRTD_CANCEL` cancels one, and `read()` returns a `struct hrtd_expiry` for
+// every timer that expired. `poll()` reports EPOLLIN while there are expiries to read. Closing the
+// file cancels all of its timers.
+
+// Flags of `struct hrtd_timer`.
+#define HRTD_RELATIVE (1U << 0)  // `expires_ns` is the time from now instead of a CLOCK_MONOTONIC time.
+
+// Most timers that one `HRTD_ADD` call accepts.
+#define HRTD_MAX_BATCH 4096
+
+/**
+ * @brief One timer of `HRTD_ADD`.
+ */
+struct hrtd_timer {
+    __u64 expires_ns;  // In: when the timer expires, as CLOCK_MONOTONIC time (`clock_gettime()`).
+    __u64 user_data;  // In: returned as is in the expiry.
+    __u64 id;  // Out: the ID of the timer, for `HRTD_CANCEL`. Unique among the pending timers of the file.
+    __u32 flags;  // In: `HRTD_*` flags.
+    __u32 pad;
+};
+
+/**
+ * @brief Argument of `HRTD_ADD`.
+ */
+struct hrtd_batch {
+    __u64 timers;  // User space pointer to an array of `count` timers.
+    __u32 count;
+    __u32 pad;
+};
+
+/**
+ * @brief What `read()` returns for every expired timer.
+ */
+struct hrtd_expiry {
+    __u64 id;
+    __u64 user_data;
+    __u64 expires_ns;  // When the timer should have expired.
+    __u64 fired_ns;  // When it did. `fired_ns - expires_ns` is the lateness.
+};
+
+/**
+ * @brief Argument of `HRTD_STATS`. Counts since the file was opened.
+ */
+struct hrtd_stats {
+    __u64 added;
+    __u64 cancelled;
+    __u64 expired;
+    __u64 overflow;  // Expiries that were lost because the completion channel was full.
+};
+
+// Adds `count` timers. Returns the number of timers that were added, which is less than `count` if
+// an error happened after the first one. If no timer was added: -EFAULT, -EINVAL, -ENOMEM, or
+// -ENOSPC if the file already has `max_pending` (a module parameter) timers.
+#define HRTD_ADD _IOW('t', 'a', struct hrtd_batch)
+
+// Cancels the timer with this ID. -ENOENT if it already expired or was never added.
+#define HRTD_CANCEL _IOW('t', 'c', __u64)
+
+#define HRTD_STATS _IOR('t', 's', struct hrtd_stats)
+
+#endif  // #ifndef HRT_DEADLINE_H
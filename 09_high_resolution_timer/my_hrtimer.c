@@ -3,54 +3,310 @@
 #include <linux/module.h>
 #include <linux/init.h>
 #include <linux/hrtimer.h>
-#include <linux/jiffies.h>
+#include <linux/ktime.h>  // For `ktime_get_ns()`.
+#include <linux/fs.h>  // "fs" stands for "file system."
+#include <linux/percpu.h>
+#include <linux/cpu.h>  // For `cpus_read_lock()`.
+#include <linux/slab.h>  // For `kvzalloc_node()` and `kvfree()`.
+#include <linux/mutex.h>
+#include <linux/log2.h>  // For `is_power_of_2()`.
+#include <linux/uio.h>  // For `struct iov_iter` and `copy_to_iter()`.
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+
+#include <lat_hist.h>
+#include "my_hrtimer.h"
+
+/**
+ * @brief The sampler of one CPU: its timer and a single-producer, single-consumer ring of samples.
+ * @details
+ * Only the timer callback of this CPU writes `head`, and only the reader writes `tail`, so neither
+ * side needs a lock. When the ring is full, the timer drops the sample instead of waiting.
+ */
+struct hrt_cpu {
+    struct hrtimer timer;
+    struct hrt_sample *samples;  // `nr_samples` entries.
+    unsigned int head;  // Next sample to write. Written by the timer callback.
+    unsigned int tail;  // Next sample to read. Written by `my_read_iter()`.
+    u64 dropped;  // Samples that didn't fit into the ring.
+    unsigned int cpu;  // CPU that the timer was started on. It runs elsewhere after that CPU went offline.
+};
 
 // Global variables.
-static struct hrtimer my_hrtimer;
-u64 start_time;
+static DEFINE_PER_CPU(struct hrt_cpu, hrt_cpus);
+static struct lat_hist __percpu *hrt_hists;  // Lateness per CPU. Too big for a static per-CPU variable in a module.
+static struct dentry *debugfs_dir;
+static struct cpumask hrt_active;  // CPUs that run a sampler.
+static ktime_t period;
+static int major_dev_num;  // Major device number that will be allocated by our kernel module.
+static DEFINE_MUTEX(read_lock);  // There is one consumer for all rings, readers take turns.
+
+static unsigned int period_us = 1000;
+module_param(period_us, uint, 0444);
+MODULE_PARM_DESC(period_us, "Sampling period in microseconds (at least 10)");
+
+static unsigned int nr_samples = 4096;
+module_param(nr_samples, uint, 0444);
+MODULE_PARM_DESC(nr_samples, "Samples buffered per CPU (power of two)");
 
 /**
- * @brief Timer expiry callback function.
- * 
+ * @brief Timer expiry callback function. Runs in hard interrupt context on the timer's CPU.
+ *
  * @return If the timer should be restarted or not.
  */
 static enum hrtimer_restart test_hrtimer_handler(struct hrtimer *timer) {
-    // Get the current time. `jiffies` is a global variable which will count the processor ticks.
-    u64 now_time = jiffies;
+    struct hrt_cpu *hc = container_of(timer, struct hrt_cpu, timer);
+    struct hrt_sample *s;
+    unsigned int head = hc->head;
+    u64 overruns;
+
+    // `ktime_get_ns()` reads the clocksource directly, so it has nanosecond resolution. `jiffies`
+    // only advance once per tick (1-10 ms).
+    u64 now = ktime_get_ns();
+    u64 expires = ktime_to_ns(hrtimer_get_expires(timer));
+
+    // Only this timer writes its histogram, so it needs no lock. Look it up through `hc->cpu`
+    // rather than the CPU we run on: after a CPU went offline, the hrtimer core moves its timer to
+    // another CPU, and its samples must not end up in that CPU's histogram.
+    lat_hist_record(per_cpu_ptr(hrt_hists, hc->cpu), now > expires ? now - expires : 0);
+
+    // Move the expiry forward by whole periods until it is in the future. Returns how many periods
+    // were added, so anything above one means we missed periods.
+    overruns = hrtimer_forward_now(timer, period);
 
-    // Calculate our delta time in milliseconds.
-    u64 delta_time_in_msecs = jiffies_to_msecs(now_time - start_time);
+    // Pairs with the `smp_store_release()` of `tail` in `my_read_iter()`.
+    if (head - smp_load_acquire(&hc->tail) >= nr_samples) {
+        hc->dropped++;
+        return HRTIMER_RESTART;
+    }
 
-    pr_info("my_hrtimer - delta_time_in_msecs = %llu.\n", delta_time_in_msecs);
+    s = &hc->samples[head & (nr_samples - 1)];
+    s->time_ns = now;
+    s->expires_ns = expires;
+    s->cpu = smp_processor_id();
+    s->pid = task_pid_nr(current);
+    s->overruns = overruns - 1;
 
-    return HRTIMER_NORESTART;
+    // Publish the sample. The reader sees its contents before it sees the new `head`.
+    smp_store_release(&hc->head, head + 1);
+
+    return HRTIMER_RESTART;
+}
+
+/**
+ * @brief The `read_iter()` callback function. Writes from kernel space to user space.
+ * @details
+ * Returns as many whole `struct hrt_sample` as fit, collected from the rings of all CPUs.
+ *
+ * @param[in] iocb: Describes the I/O request.
+ * @param[inout] to: The user space buffers to copy into.
+ *
+ * @return The number of bytes that were read successfully. Zero if there is no sample.
+ */
+static ssize_t my_read_iter(struct kiocb *iocb, struct iov_iter *to) {
+    struct hrt_cpu *hc;
+    size_t copied = 0;
+    unsigned int head, tail;
+    unsigned int cpu;
+    ssize_t ret = 0;
+
+    if (iov_iter_count(to) < sizeof(struct hrt_sample))
+        return -EINVAL;
+
+    if (mutex_lock_interruptible(&read_lock))
+        return -ERESTARTSYS;
+
+    for_each_cpu(cpu, &hrt_active) {
+        hc = per_cpu_ptr(&hrt_cpus, cpu);
+
+        // Pairs with the `smp_store_release()` in `test_hrtimer_handler()`.
+        head = smp_load_acquire(&hc->head);
+        tail = hc->tail;
+
+        while (tail != head && iov_iter_count(to) >= sizeof(struct hrt_sample)) {
+            if (copy_to_iter(&hc->samples[tail & (nr_samples - 1)], sizeof(struct hrt_sample), to) !=
+                sizeof(struct hrt_sample)) {
+                ret = -EFAULT;
+                break;
+            }
+            tail++;
+            copied += sizeof(struct hrt_sample);
+        }
+
+        // Hand the slots back to the timer.
+        smp_store_release(&hc->tail, tail);
+
+        if (ret || tail != head)
+            break;  // Fault, or `to` is full.
+    }
+
+    mutex_unlock(&read_lock);
+
+    return copied ? copied : ret;
+}
+
+static struct file_operations fops = {
+    // Set file operations function pointers to our own functions.
+    .owner = THIS_MODULE,
+    .read_iter = my_read_iter,  // Used by `read()`, `readv()` and io_uring.
+};
+
+/**
+ * @brief Prints the lateness percentiles of all CPUs into the debugfs file `latency`.
+ */
+static int latency_show(struct seq_file *m, void *unused) {
+    struct lat_hist *sum;
+    unsigned int cpu;
+
+    sum = kzalloc(sizeof(*sum), GFP_KERNEL);
+    if (!sum)
+        return -ENOMEM;
+
+    // The timers keep running while we fold their histograms.
+    for_each_cpu(cpu, &hrt_active)
+        lat_hist_add(sum, per_cpu_ptr(hrt_hists, cpu));
+
+    lat_hist_show(m, sum);
+
+    kfree(sum);
+    return 0;
+}
+
+/**
+ * @brief Clears the histograms of all CPUs, e.g. before putting the system under load.
+ */
+static ssize_t latency_write(struct file *file, const char __user *user_buf, size_t len, loff_t *off) {
+    unsigned int cpu;
+
+    for_each_cpu(cpu, &hrt_active)
+        lat_hist_reset(per_cpu_ptr(hrt_hists, cpu));
+
+    return len;
+}
+
+static int latency_open(struct inode *inode, struct file *file) {
+    return single_open(file, latency_show, NULL);
+}
+
+static const struct file_operations latency_fops = {
+    .owner = THIS_MODULE,
+    .open = latency_open,
+    .read = seq_read,
+    .write = latency_write,
+    .llseek = seq_lseek,
+    .release = single_release,
+};
+
+/**
+ * @brief Starts the timer of the CPU this function runs on. Called on every CPU by `on_each_cpu()`.
+ */
+static void hrt_start_on_cpu(void *unused) {
+    struct hrt_cpu *hc = this_cpu_ptr(&hrt_cpus);
+
+    if (!hc->samples)
+        return;
+
+    // Start the timer with `hrtimer_start()`:
+    // • 1st arg is the timer that will be started.
+    // • 2nd arg is the amount of time to wait before the first expiry.
+    // • 3rd arg is the timer mode. `HRTIMER_MODE_REL_PINNED` is "relative" timer mode, and the timer
+    //   stays on this CPU instead of being moved to another one.
+    hrtimer_start(&hc->timer, period, HRTIMER_MODE_REL_PINNED);
+}
+
+/**
+ * @brief Cancels the timers and frees the rings of all CPUs.
+ */
+static void hrt_stop(void) {
+    struct hrt_cpu *hc;
+    unsigned int cpu;
+
+    for_each_cpu(cpu, &hrt_active) {
+        hc = per_cpu_ptr(&hrt_cpus, cpu);
+
+        // We don't want to remove the kernel module while the timer is still running.
+        // No harm is done if the timer was never started.
+        hrtimer_cancel(&hc->timer);
+
+        pr_info("my_hrtimer - CPU %u dropped %llu samples.\n", cpu, hc->dropped);
+        kvfree(hc->samples);
+        hc->samples = NULL;
+    }
 }
 
 /**
  * @brief Callback function for when the module is loaded into the kernel.
- * 
+ *
  * @return Zero if the loading of the module was successful.
  */
 static int __init my_init(void) {
-    // Can't use stdout because there is no stdout for the Linux kernel. 
+    struct hrt_cpu *hc;
+    unsigned int cpu;
+
+    // Can't use stdout because there is no stdout for the Linux kernel.
     // We will instead write to the kernel's log.
     pr_info("my_hrtimer - Hello, Kernel!\n");
 
-    // Initialize our high resolution timer.
-    hrtimer_init(&my_hrtimer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+    if (period_us < 10 || nr_samples < 2 || !is_power_of_2(nr_samples)) {
+        pr_err("my_hrtimer - period_us must be at least 10 and nr_samples a power of two\n");
+        return -EINVAL;
+    }
+    period = us_to_ktime(period_us);
 
-    // Set the timer expiry callback function. When our timer's time
-    // has been reached, then our `test_hrtimer_handler()` function will be called.
-    my_hrtimer.function = &test_hrtimer_handler;
+    hrt_hists = alloc_percpu(struct lat_hist);
+    if (!hrt_hists)
+        return -ENOMEM;
 
-    // Set the starting time to the current time.
-    start_time = jiffies;
+    // Keep the set of online CPUs stable until all timers are running.
+    cpus_read_lock();
 
-    // Start the timer with `hrtimer_start()`:
-    // • 1st arg is the timer that will be started.
-    // • 2nd arg is the amount of time to wait. Value passed to `ms_to_ktime()` is in milliseconds.
-    // • 3rd arg is the timer mode. `HRTIMER_MODE_REL` is "relative" timer mode.
-    hrtimer_start(&my_hrtimer, ms_to_ktime(100), HRTIMER_MODE_REL);
+    for_each_online_cpu(cpu) {
+        hc = per_cpu_ptr(&hrt_cpus, cpu);
+
+        // Allocate the ring on the CPU's own node, it's only written from that CPU.
+        hc->samples = kvzalloc_node(array_size(nr_samples, sizeof(*hc->samples)), GFP_KERNEL, cpu_to_node(cpu));
+        if (!hc->samples) {
+            cpus_read_unlock();
+            hrt_stop();
+            free_percpu(hrt_hists);
+            return -ENOMEM;
+        }
+
+        hc->cpu = cpu;
+
+        // Initialize our high resolution timer.
+        hrtimer_init(&hc->timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL_PINNED);
+
+        // Set the timer expiry callback function. When our timer's time
+        // has been reached, then our `test_hrtimer_handler()` function will be called.
+        hc->timer.function = &test_hrtimer_handler;
+
+        cpumask_set_cpu(cpu, &hrt_active);
+    }
+
+    // A pinned timer has to be started on its own CPU.
+    on_each_cpu(hrt_start_on_cpu, NULL, 1);
+
+    cpus_read_unlock();
+
+    // Register the character device that the samples are read from.
+    major_dev_num = register_chrdev(0, "my_hrtimer", &fops);
+
+    // Check for error while registering the character device.
+    if (major_dev_num < 0) {
+        pr_err("my_hrtimer - Error registering character device\n");
+        hrt_stop();
+        free_percpu(hrt_hists);
+        return major_dev_num;
+    }
+
+    // Export the latency percentiles as /sys/kernel/debug/my_hrtimer/latency. Reading it prints
+    // them, writing anything to it clears the histograms. debugfs is optional, so errors are ignored.
+    debugfs_dir = debugfs_create_dir("my_hrtimer", NULL);
+    debugfs_create_file("latency", 0600, debugfs_dir, NULL, &latency_fops);
+
+    pr_info("my_hrtimer - Sampling every %u us on %u CPUs. Major device number: %d\n",
+            period_us, cpumask_weight(&hrt_active), major_dev_num);
 
     return 0;
 }
@@ -64,9 +320,10 @@ static int __init my_init(void) {
  *   • Makes this function only available within this kernel module.
  */
 static void __exit my_exit(void) {
-    // We don't want to remove the kernel module while the timer is still running.
-    // No harm is done if the timer has already expired by the time we call `hrtimer_cancel()`.
-    hrtimer_cancel(&my_hrtimer);
+    debugfs_remove_recursive(debugfs_dir);
+    unregister_chrdev(major_dev_num, "my_hrtimer");
+    hrt_stop();
+    free_percpu(hrt_hists);
 
     pr_info("my_hrtimer - Goodbye, Kernel!\n");
 }
@@ -0,0 +1,20 @@
+#ifndef MY_HRTIMER_H
+#define MY_HRTIMER_H
+
+// This header is shared by the kernel module and the user space programs, so only use the
+// fixed-size types from <linux/types.h>.
+#include <linux/types.h>
+
+/**
+ * @brief One sample, taken by the timer of one CPU. Reading the device returns an array of these.
+ */
+struct hrt_sample {
+    __u64 time_ns;  // When the timer callback ran, from `ktime_get_ns()` (CLOCK_MONOTONIC).
+    __u64 expires_ns;  // When the timer was programmed to expire. `time_ns - expires_ns` is the lateness.
+    __u32 cpu;  // CPU that took the sample.
+    __u32 pid;  // Task that was interrupted by the timer. Zero is the idle task.
+    __u32 overruns;  // Periods that were missed before this sample, zero normally.
+    __u32 pad;
+};
+
+#endif  // #ifndef MY_HRTIMER_H
@@ -0,0 +1,67 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>  // For open, close and read.
+#include <fcntl.h>  // For the flags being associated with our character device.
+
+#include "my_hrtimer.h"
+
+// Drains samples from the sampler device for a few seconds and prints a summary per CPU.
+//
+// Usage: test <device> [seconds]
+
+#define MAX_CPUS 1024
+
+// This is a user space program.
+int main(int argc, char **argv) {
+    static struct hrt_sample buf[1024];
+    static unsigned long count[MAX_CPUS];
+    static unsigned long long max_late[MAX_CPUS], sum_late[MAX_CPUS];
+    int seconds, tick, fd, i;
+    unsigned long long late;
+    ssize_t n;
+
+    // The first argument to this program is the file that should be opened.
+    if (argc < 2) {
+        // We can't do anything if no file was passed as an argument.
+        printf("I need the file to open as an argument!\n");
+        return 0;
+    }
+    seconds = argc > 2 ? atoi(argv[2]) : 3;
+
+    fd = open(argv[1], O_RDONLY);
+
+    // Check if we couldn't open the file.
+    if (fd < 0) {
+        perror("Error opening file.");
+        return fd;
+    }
+
+    for (tick = 0; tick < seconds * 10; tick++) {
+        // The driver never blocks. Drain whatever is there, then let the rings fill up again.
+        while ((n = read(fd, buf, sizeof(buf))) > 0) {
+            for (i = 0; i < n / (ssize_t)sizeof(buf[0]); i++) {
+                if (buf[i].cpu >= MAX_CPUS)
+                    continue;
+                late = buf[i].time_ns - buf[i].expires_ns;
+                count[buf[i].cpu]++;
+                sum_late[buf[i].cpu] += late;
+                if (late > max_late[buf[i].cpu])
+                    max_late[buf[i].cpu] = late;
+            }
+        }
+        if (n < 0) {
+            perror("Error reading from device.");
+            return 1;
+        }
+        usleep(100000);
+    }
+
+    for (i = 0; i < MAX_CPUS; i++)
+        if (count[i])
+            printf("CPU %3d: %8lu samples, lateness avg %6llu ns, max %8llu ns\n",
+                   i, count[i], sum_late[i] / count[i], max_late[i]);
+
+    close(fd);  // Close the file.
+
+    return 0;
+}
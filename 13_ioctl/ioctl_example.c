@@ -4,13 +4,566 @@
 #include <linux/init.h>
 #include <linux/fs.h>  // "fs" stands for "file system."
 #include <linux/ioctl.h>
+#include <linux/slab.h>  // For `kmem_cache_create()`.
+#include <linux/mempool.h>
+#include <linux/rhashtable.h>
+#include <linux/rcupdate.h>
+#include <linux/uaccess.h>  // For `copy_from_user()` and `copy_to_user()`.
+#include <linux/mm.h>  // For `alloc_page()` and `vm_map_pages()`.
+#include <linux/vmalloc.h>  // For `vmap()`.
+#include <linux/kthread.h>
+#include <linux/capability.h>  // For `capable()`.
+#include <linux/mutex.h>
+#include <linux/wait.h>
+#include <linux/log2.h>  // For `is_power_of_2()`.
 
+#include <cdev_stats.h>
 #include "ioctl_test.h"
 
+// Defines the tracepoints. Exactly one source file of a module has to do this.
+#define CREATE_TRACE_POINTS
+#include "ioctl_example_trace.h"
+
+// Descriptors that `batch_ioctl()` copies in and out at a time.
+#define BATCH_CHUNK 128
+
+// Chunks kept in reserve, so batches still make progress when memory is tight.
+#define BATCH_RESERVE 16
+
 /* Global variables */
 static int major_dev_num;  // Major device number that will be allocated by our kernel module.
-static int32_t answer = 42;  // Global variable for reading and writing.
+static struct rhashtable kv_table;  // The key-value store, holds `struct kv_entry`s.
+
+// The entries of the store and the chunks of `batch_ioctl()` come from their own slab caches instead
+// of `kmalloc()`. The slab allocator keeps per-CPU freelists for every cache, so in the common case
+// an allocation just pops an object that this CPU freed a moment ago.
+static struct kmem_cache *kv_cache;
+static struct kmem_cache *chunk_cache;
+static mempool_t *chunk_pool;  // `BATCH_RESERVE` chunks from `chunk_cache` that are always there.
+
+// Per-CPU counters, in /sys/module/ioctl_example/stats/{ioctl,ring}. `ring` counts the passes over
+// a submission queue and the bytes of the SQEs they took.
+CDEV_STATS_DEFINE(ioctl);
+CDEV_STATS_DEFINE(ring);
+
+static struct attribute *stats_attrs[] = {
+    &ioctl_attr.attr,
+    &ring_attr.attr,
+    NULL,
+};
+
+static const struct attribute_group stats_group = {
+    .name = "stats",
+    .attrs = stats_attrs,
+};
+
+/**
+ * @brief One key-value pair of the store.
+ */
+struct kv_entry {
+    struct rhash_head node;  // Links the entry into its bucket of `kv_table`.
+    u64 key;
+    s64 value;  // Written in place with `WRITE_ONCE()`, so readers never see a torn value on 64 bit.
+    struct rcu_head rcu;  // For freeing the entry after all readers are done with it.
+};
+
+// `rhashtable` is a resizable hash table. Lookups only need `rcu_read_lock()` and take no locks at
+// all. Inserts and removals lock just the bucket they change (a bit lock in the bucket pointer), and
+// the table grows and shrinks in the background as the number of entries changes. So readers
+// scale across all cores, and writers only contend if they hit the same bucket.
+static const struct rhashtable_params kv_params = {
+    .key_len = sizeof(u64),
+    .key_offset = offsetof(struct kv_entry, key),
+    .head_offset = offsetof(struct kv_entry, node),
+    .automatic_shrinking = true,
+};
+
+
+/**
+ * @brief Looks up `key`. Doesn't take any locks.
+ *
+ * @param[out] value: The value of `key`, if it exists.
+ * @return Zero, or -ENOENT if the key doesn't exist.
+ */
+static int kv_get(u64 key, s64 *value) {
+    struct kv_entry *e;
+    int ret = -ENOENT;
+
+    rcu_read_lock();
+    e = rhashtable_lookup(&kv_table, &key, kv_params);
+    if (e) {
+        *value = READ_ONCE(e->value);
+        ret = 0;
+    }
+    rcu_read_unlock();
+
+    return ret;
+}
+
+/**
+ * @brief Stores `value` under `key`, adding the key if it doesn't exist yet.
+ *
+ * @return Zero, or a negative errno if a new entry couldn't be added.
+ */
+static int kv_put(u64 key, s64 value) {
+    struct kv_entry *e, *old;
+    int ret = 0;
+
+    // Updating an existing key is the common case. It's a lookup and a store, no locks.
+    rcu_read_lock();
+    e = rhashtable_lookup(&kv_table, &key, kv_params);
+    if (e) {
+        WRITE_ONCE(e->value, value);
+        rcu_read_unlock();
+        return 0;
+    }
+    rcu_read_unlock();
+
+    e = kmem_cache_alloc(kv_cache, GFP_KERNEL);
+    if (!e)
+        return -ENOMEM;
+    e->key = key;
+    e->value = value;
+
+    // Another caller may have added the same key since our lookup. Then the insert fails, returns the
+    // entry that won, and we update that one instead.
+    rcu_read_lock();
+    old = rhashtable_lookup_get_insert_fast(&kv_table, &e->node, kv_params);
+    if (IS_ERR(old)) {
+        ret = PTR_ERR(old);
+    } else if (old) {
+        WRITE_ONCE(old->value, value);
+    }
+    rcu_read_unlock();
+
+    if (old)
+        kmem_cache_free(kv_cache, e);
+
+    return ret;
+}
+
+/**
+ * @brief Frees a deleted entry once no reader can see it anymore.
+ */
+static void kv_free_rcu(struct rcu_head *rcu) {
+    kmem_cache_free(kv_cache, container_of(rcu, struct kv_entry, rcu));
+}
+
+/**
+ * @brief Removes `key` from the store.
+ *
+ * @return Zero, or -ENOENT if the key doesn't exist.
+ */
+static int kv_delete(u64 key) {
+    struct kv_entry *e;
+    int ret = -ENOENT;
+
+    rcu_read_lock();
+    e = rhashtable_lookup(&kv_table, &key, kv_params);
+
+    // If two callers delete the same key, only one of them succeeds to remove it.
+    if (e && rhashtable_remove_fast(&kv_table, &e->node, kv_params) == 0) {
+        // Lock-free readers may still be looking at the entry. Free it after they're all done.
+        call_rcu(&e->rcu, kv_free_rcu);
+        ret = 0;
+    }
+    rcu_read_unlock();
+
+    return ret;
+}
+
+/**
+ * @brief Frees an entry when the whole table is destroyed.
+ */
+static void kv_free_entry(void *ptr, void *arg) {
+    kmem_cache_free(kv_cache, ptr);
+}
+
+/**
+ * @brief Runs one batch descriptor.
+ *
+ * @param[in,out] op: The descriptor. Its `status` is set, and its `value` for `IOCTL_OP_GET`.
+ */
+static void run_op(struct ioctl_op *op) {
+    switch (op->op) {
+        case IOCTL_OP_GET:
+            op->status = kv_get(op->key, &op->value);
+            break;
+        case IOCTL_OP_PUT:
+            op->status = kv_put(op->key, op->value);
+            break;
+        case IOCTL_OP_DELETE:
+            op->status = kv_delete(op->key);
+            break;
+        default:
+            op->status = -EINVAL;
+            break;
+    }
+}
+
+/**
+ * @brief Handles `IOCTL_BATCH`: copies the descriptors in, runs them and copies them back out.
+ * @details
+ * The descriptors go through one buffer of `BATCH_CHUNK` descriptors, so a batch of any size needs
+ * the same, small allocation. It comes from `chunk_pool`: when memory is tight and the slab cache
+ * can't hand out a chunk right away, we take one of the reserve or wait for another batch to give
+ * its chunk back, instead of waiting on memory reclaim for an unbounded time.
+ *
+ * @param[in] batch: The argument of the command, copied in already.
+ * @return Zero, or a negative errno if the batch itself was bad. Errors of single operations are
+ *     reported in their `status`.
+ */
+static long batch_ioctl(const struct ioctl_batch *batch) {
+    struct ioctl_op __user *uops;
+    struct ioctl_op *ops;
+    size_t size;
+    long ret = 0;
+    u32 done, n, i;
+
+    if (batch->count == 0)
+        return 0;
+    if (batch->count > IOCTL_MAX_BATCH)
+        return -EINVAL;
+
+    // Never fails, it sleeps until a chunk is free.
+    ops = mempool_alloc(chunk_pool, GFP_KERNEL);
+    uops = u64_to_user_ptr(batch->ops);
+
+    for (done = 0; done < batch->count; done += n) {
+        n = min_t(u32, batch->count - done, BATCH_CHUNK);
+        size = n * sizeof(*ops);
+
+        // One copy per chunk instead of one per value.
+        if (copy_from_user(ops, uops + done, size)) {
+            ret = -EFAULT;
+            break;
+        }
+
+        // Every operation is atomic on its own, but other callers can run theirs in between.
+        for (i = 0; i < n; i++)
+            run_op(&ops[i]);
+
+        if (copy_to_user(uops + done, ops, size)) {
+            ret = -EFAULT;
+            break;
+        }
+    }
+
+    mempool_free(ops, chunk_pool);
+    return ret;
+}
+
+/**
+ * @brief The shared-memory rings of one open file. See `struct kv_ring_hdr` for the protocol.
+ * @details
+ * The driver keeps its own copies of the cursors that it writes, `sq_head` and `cq_tail`, and only
+ * publishes them in the header. User space can write anything into the mapping, so the driver
+ * never trusts what it reads back from there: it copies every SQE before using it, and bad
+ * cursors only make it take fewer entries.
+ */
+struct kv_ring {
+    struct kv_ring_hdr *hdr;  // Page 0 of the mapping.
+    struct kv_sqe *sqes;
+    struct kv_cqe *cqes;
+    u32 sq_entries, cq_entries;
+    u32 sq_head;  // Next SQE to take. Only changed by the consumer.
+    u32 cq_tail;  // Next CQE to fill. Only changed by the consumer.
+
+    struct page **pages;
+    unsigned int nr_pages;
+    void *vaddr;  // Contiguous kernel mapping of `pages`.
+
+    struct mutex sq_lock;  // There is only one consumer at a time.
+    wait_queue_head_t cq_wq;  // `KV_ENTER_GETEVENTS` sleeps here until there are completions.
+
+    struct task_struct *sq_thread;  // The `KV_RING_SQPOLL` thread, NULL without it.
+    wait_queue_head_t sq_wq;  // The SQPOLL thread sleeps here when it has been idle for `sq_idle`.
+    unsigned long sq_idle;  // In jiffies.
+};
+
+/**
+ * @brief Takes as many SQEs as there are, and as fit into the CQ, runs them and posts their completions.
+ * @note Call with `ring->sq_lock` held, or from the SQPOLL thread.
+ *
+ * @return The number of SQEs that were taken.
+ */
+static u32 kv_ring_consume(struct kv_ring *ring) {
+    struct kv_ring_hdr *hdr = ring->hdr;
+    u32 sq_mask = ring->sq_entries - 1, cq_mask = ring->cq_entries - 1;
+    u32 todo, used, n, i;
+    struct ioctl_op op;
+    struct kv_sqe *sqe;
+    struct kv_cqe *cqe;
+
+    // Pairs with the store-release of the tail in user space: the entries before it are filled in.
+    todo = min(smp_load_acquire(&hdr->sq_tail) - ring->sq_head, ring->sq_entries);
+
+    // Pairs with the store-release of the head in user space: the CQEs before it were read.
+    used = ring->cq_tail - smp_load_acquire(&hdr->cq_head);
+    n = used > ring->cq_entries ? 0 : min(todo, ring->cq_entries - used);
+
+    for (i = 0; i < n; i++) {
+        sqe = &ring->sqes[(ring->sq_head + i) & sq_mask];
+        cqe = &ring->cqes[(ring->cq_tail + i) & cq_mask];
+
+        // User space may change the SQE while we look at it, so read every field exactly once.
+        op.op = READ_ONCE(sqe->op);
+        op.key = READ_ONCE(sqe->key);
+        op.value = READ_ONCE(sqe->value);
+        run_op(&op);
+
+        cqe->user_data = READ_ONCE(sqe->user_data);
+        cqe->value = op.value;
+        cqe->status = op.status;
+
+        // A full ring is a lot of operations. Don't hog the CPU for all of them.
+        if ((i & 255) == 255)
+            cond_resched();
+    }
+
+    if (!n)
+        return 0;
+
+    // Publish the completions before the slots of the SQEs are given back, and both only after
+    // everything was written.
+    WRITE_ONCE(ring->cq_tail, ring->cq_tail + n);
+    smp_store_release(&hdr->cq_tail, ring->cq_tail);
+    ring->sq_head += n;
+    smp_store_release(&hdr->sq_head, ring->sq_head);
+
+    cdev_stats_add(&ring_stats, n * sizeof(*sqe), 0);
+
+    // `wq_has_sleeper()` has the barrier that pairs with the waiter, and saves the lock of the
+    // waitqueue when nobody waits, which is the usual case for a busy ring.
+    if (wq_has_sleeper(&ring->cq_wq))
+        wake_up_interruptible(&ring->cq_wq);
+
+    return n;
+}
+
+/**
+ * @brief Whether the consumer can make progress: there are SQEs, and room for their completions.
+ */
+static bool kv_ring_sq_ready(struct kv_ring *ring) {
+    return READ_ONCE(ring->hdr->sq_tail) != ring->sq_head &&
+           ring->cq_tail - READ_ONCE(ring->hdr->cq_head) < ring->cq_entries;
+}
+
+/**
+ * @brief Wait condition of `KV_ENTER_GETEVENTS`: the CQ isn't empty.
+ */
+static bool kv_ring_cq_ready(struct kv_ring *ring) {
+    return READ_ONCE(ring->hdr->cq_head) != READ_ONCE(ring->cq_tail);
+}
+
+/**
+ * @brief The `KV_RING_SQPOLL` thread. Polls the SQ, and sleeps after it was idle for a while.
+ */
+static int kv_ring_sq_thread(void *data) {
+    struct kv_ring *ring = data;
+    unsigned long idle_since = jiffies;
+
+    while (!kthread_should_stop()) {
+        if (kv_ring_consume(ring)) {
+            idle_since = jiffies;
+            cond_resched();
+            continue;
+        }
+
+        // Spinning keeps the latency down as long as there is work every now and then.
+        if (time_before(jiffies, idle_since + ring->sq_idle)) {
+            cond_resched();
+            cpu_relax();
+            continue;
+        }
+
+        // Tell user space that it has to wake us up, then check the SQ once more: a submission
+        // that came in before the flag was visible would otherwise wait for the next one. Pairs with
+        // the full barrier between storing `sq_tail` and loading `flags` in user space.
+        WRITE_ONCE(ring->hdr->flags, KV_RING_NEED_WAKEUP);
+        smp_mb();
+        wait_event_idle(ring->sq_wq, kv_ring_sq_ready(ring) || kthread_should_stop());
+        WRITE_ONCE(ring->hdr->flags, 0);
+        idle_since = jiffies;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Stops the SQPOLL thread and frees the rings. Works on partially set up rings, too.
+ */
+static void kv_ring_free(struct kv_ring *ring) {
+    unsigned int i;
+
+    if (ring->sq_thread)
+        kthread_stop(ring->sq_thread);
+
+    if (ring->vaddr)
+        vunmap(ring->vaddr);
+
+    // Nothing maps the pages anymore: either they were never handed to `mmap()` (the setup failed),
+    // or the file is being released, which only happens after the last mapping of it is gone.
+    for (i = 0; i < ring->nr_pages; i++)
+        if (ring->pages[i])
+            __free_page(ring->pages[i]);
+
+    kfree(ring->pages);
+    kfree(ring);
+}
+
+/**
+ * @brief Handles `KV_RING_SETUP`: allocates the rings of the open file and starts the SQPOLL thread.
+ *
+ * @param[in] filp: The open file. The rings are kept in `filp->private_data`.
+ * @param[in,out] params: The argument of the command. `map_size` is filled in.
+ * @return Zero, or a negative errno. -EBUSY if the file has rings already, -EPERM if `KV_RING_SQPOLL`
+ * is asked for without CAP_SYS_ADMIN.
+ */
+static long kv_ring_setup(struct file *filp, struct kv_ring_params *params) {
+    struct kv_ring *ring;
+    struct task_struct *task;
+    size_t size;
+    unsigned int i;
+
+    if (!is_power_of_2(params->entries) || params->entries > KV_RING_MAX_ENTRIES ||
+        params->flags & ~KV_RING_SQPOLL)
+        return -EINVAL;
+    if (params->sq_thread_cpu >= 0 &&
+        (params->sq_thread_cpu >= nr_cpu_ids || !cpu_online(params->sq_thread_cpu)))
+        return -EINVAL;
+
+    // Every SQPOLL ring is a kernel thread that busy-polls for a while, possibly bound to a CPU of
+    // the caller's choice. Opening the device must not be enough to start any number of those.
+    if ((params->flags & KV_RING_SQPOLL) && !capable(CAP_SYS_ADMIN))
+        return -EPERM;
 
+    ring = kzalloc(sizeof(*ring), GFP_KERNEL);
+    if (!ring)
+        return -ENOMEM;
+
+    ring->sq_entries = params->entries;
+    ring->cq_entries = 2 * params->entries;  // Room for the completions of a full SQ, and more.
+    mutex_init(&ring->sq_lock);
+    init_waitqueue_head(&ring->cq_wq);
+    init_waitqueue_head(&ring->sq_wq);
+    ring->sq_idle = msecs_to_jiffies(params->sq_thread_idle ? params->sq_thread_idle : 1000);
+
+    // The header page, then the SQEs, then the CQEs.
+    size = PAGE_SIZE + ring->sq_entries * sizeof(struct kv_sqe) + ring->cq_entries * sizeof(struct kv_cqe);
+    ring->nr_pages = DIV_ROUND_UP(size, PAGE_SIZE);
+    ring->pages = kcalloc(ring->nr_pages, sizeof(*ring->pages), GFP_KERNEL);
+    if (!ring->pages)
+        goto err;
+
+    // `vm_map_pages()` can only map order-0 pages, so allocate them one by one.
+    for (i = 0; i < ring->nr_pages; i++) {
+        ring->pages[i] = alloc_page(GFP_KERNEL | __GFP_ZERO);
+        if (!ring->pages[i])
+            goto err;
+    }
+
+    // Map the pages next to each other in kernel space, so the driver can index the arrays directly.
+    ring->vaddr = vmap(ring->pages, ring->nr_pages, VM_MAP, PAGE_KERNEL);
+    if (!ring->vaddr)
+        goto err;
+
+    ring->hdr = ring->vaddr;
+    ring->hdr->sq_entries = ring->sq_entries;
+    ring->hdr->cq_entries = ring->cq_entries;
+    ring->hdr->sq_off = PAGE_SIZE;
+    ring->hdr->cq_off = PAGE_SIZE + ring->sq_entries * sizeof(struct kv_sqe);
+    ring->sqes = ring->vaddr + ring->hdr->sq_off;
+    ring->cqes = ring->vaddr + ring->hdr->cq_off;
+
+    if (params->flags & KV_RING_SQPOLL) {
+        task = kthread_create(kv_ring_sq_thread, ring, "ioctl_example/sq");
+        if (IS_ERR(task)) {
+            kv_ring_free(ring);
+            return PTR_ERR(task);
+        }
+        if (params->sq_thread_cpu >= 0)
+            kthread_bind(task, params->sq_thread_cpu);
+        ring->sq_thread = task;
+        wake_up_process(task);
+    }
+
+    // Only one set of rings per file. The full barrier of `cmpxchg()` makes sure that `my_mmap()`
+    // and `example_ioctl()` see the rings completely set up.
+    if (cmpxchg(&filp->private_data, NULL, ring)) {
+        kv_ring_free(ring);
+        return -EBUSY;
+    }
+
+    params->map_size = ring->nr_pages * PAGE_SIZE;
+    return 0;
+
+err:
+    kv_ring_free(ring);
+    return -ENOMEM;
+}
+
+/**
+ * @brief Handles `KV_RING_ENTER`, the doorbell.
+ * @details
+ * Without SQPOLL, the calling thread consumes the SQ itself. With SQPOLL, it only wakes up the
+ * thread if asked to. Either way, it can wait for completions after that.
+ *
+ * @param[in] ring: The rings of the open file.
+ * @param[in] flags: `KV_ENTER_*` flags.
+ * @return The number of SQEs that were taken, or a negative errno.
+ */
+static long kv_ring_enter(struct kv_ring *ring, unsigned long flags) {
+    long ret = 0;
+    int err;
+
+    if (flags & ~(KV_ENTER_GETEVENTS | KV_ENTER_SQ_WAKEUP))
+        return -EINVAL;
+
+    if (ring->sq_thread) {
+        if (flags & KV_ENTER_SQ_WAKEUP)
+            wake_up(&ring->sq_wq);
+    } else {
+        mutex_lock(&ring->sq_lock);
+        ret = kv_ring_consume(ring);
+        mutex_unlock(&ring->sq_lock);
+    }
+
+    if (flags & KV_ENTER_GETEVENTS) {
+        err = wait_event_interruptible(ring->cq_wq, kv_ring_cq_ready(ring));
+
+        // The SQEs were taken. Report those, the signal can wait for the next call.
+        if (err && !ret)
+            return err;
+    }
+
+    return ret;
+}
+
+/**
+ * @brief The `mmap()` callback function. Maps the rings of `KV_RING_SETUP` into user space.
+ *
+ * @param[in] filp: An opened file in the Linux kernel.
+ * @param[in] vma: The user space memory area that should be filled with our pages.
+ *
+ * @return Zero if the mapping was successful.
+ */
+static int my_mmap(struct file *filp, struct vm_area_struct *vma) {
+    struct kv_ring *ring = READ_ONCE(filp->private_data);
+
+    // There is nothing to map before `KV_RING_SETUP`.
+    if (!ring)
+        return -ENODEV;
+
+    // Both sides write into the rings, a private copy of the pages is useless.
+    if (!(vma->vm_flags & VM_SHARED))
+        return -EINVAL;
+
+    // Don't let the mapping grow with `mremap()` and keep the rings out of core dumps.
+    vm_flags_set(vma, VM_DONTEXPAND | VM_DONTDUMP);
+
+    return vm_map_pages(vma, ring->pages, ring->nr_pages);
+}
 
 /**
  * @brief Callback function for when the device file is opened.
@@ -36,53 +589,211 @@ static int my_open(struct inode *inode, struct file *filep) {
  * @return Return code.
  */
 static int my_release(struct inode *inode, struct file *filep) {
+    // The rings of `KV_RING_SETUP`, if there are any. Nobody can use them anymore: every mapping
+    // holds a reference to the file, so we only get here after the last `munmap()`.
+    if (filep->private_data)
+        kv_ring_free(filep->private_data);
+
     pr_info("ioctl_example - File is closed.\n");
     return 0;
 }
 
 /**
- * @brief 
- * 
- * @param[in] file: Our device file.
+ * @brief The argument of any command, copied into kernel space. See `example_ioctl()`.
+ */
+union ioctl_arg {
+    __s32 answer;
+    struct mystruct greeter;
+    struct ioctl_info info;
+    struct ioctl_batch batch;
+    struct kv_pair pair;
+    struct kv_ring_params ring;
+};
+
+/**
+ * @brief Every command of the current ABI.
+ * @details
+ * `min_size` is the size of the first version of the argument. Callers with an older struct than
+ * that are rejected. For now, it's the size of the current version everywhere.
+ */
+static const struct {
+    unsigned int cmd;
+    unsigned int min_size;
+} ioctl_cmds[] = {
+    { WRITE_FROM_USER_TO_KERNEL, sizeof(__s32) },
+    { WRITE_FROM_KERNEL_TO_USER, sizeof(__s32) },
+    { GREETER, sizeof(struct mystruct) },
+    { IOCTL_INFO, sizeof(struct ioctl_info) },
+    { IOCTL_BATCH, sizeof(struct ioctl_batch) },
+    { KV_GET, sizeof(struct kv_pair) },
+    { KV_PUT, sizeof(struct kv_pair) },
+    { KV_DELETE, sizeof(struct kv_pair) },
+    { KV_RING_SETUP, sizeof(struct kv_ring_params) },
+    { KV_RING_ENTER, 0 },
+};
+
+/**
+ * @brief Maps the commands of ABI version 1 to the current ones.
+ * @details
+ * Version 1 encoded the size of a pointer into `WRITE_FROM_USER_TO_KERNEL`,
+ * `WRITE_FROM_KERNEL_TO_USER` and `GREETER` instead of the size of their argument. So the numbers
+ * differed between 32 and 64 bit programs, and both directions of the answer had the same `nr`.
+ * The arguments themselves didn't change, so old binaries keep working.
+ *
+ * @return The current command, or `cmd` itself if it isn't an old one.
+ */
+static unsigned int ioctl_legacy(unsigned int cmd) {
+    switch (cmd) {
+        // A 32 bit pointer has the size of the argument, so 32 bit programs use the current number.
+        case _IOW(IOCTL_MAGIC, 'b', u64):
+            return WRITE_FROM_USER_TO_KERNEL;
+        case _IOR(IOCTL_MAGIC, 'b', u32):
+        case _IOR(IOCTL_MAGIC, 'b', u64):
+            return WRITE_FROM_KERNEL_TO_USER;
+        case _IOR(IOCTL_MAGIC, 'c', u32):
+        case _IOR(IOCTL_MAGIC, 'c', u64):
+            return GREETER;
+    }
+
+    return cmd;
+}
+
+/**
+ * @brief Runs one command. See `my_ioctl()`.
+ * @details
+ * Copying the argument in and out is done here, for all commands: the size in the command number
+ * is the size of the caller's struct, which may be an older or newer version than ours. See
+ * ioctl_test.h for the rules. The commands themselves only work on the kernel copy in `data`.
+ *
+ * @param[in] filp: Our device file.
  * @param[in] cmd: The command.
  * @param[in] arg: Potential argument(s).
- * @return Return code.
+ * @return Return code. -ENOTTY for unknown commands, -EFAULT if the argument couldn't be copied.
  */
-static long int my_ioctl(struct file *file, unsigned cmd, unsigned long arg) {
-    struct mystruct test;
+static long example_ioctl(struct file *filp, unsigned int cmd, unsigned long arg) {
+    void __user *uarg = (void __user *)arg;
+    unsigned int i, usize, ksize;
+    union ioctl_arg data;
+    struct kv_ring *ring;
+    s64 value = 0;
+    long ret;
+
+    cmd = ioctl_legacy(cmd);
+    usize = _IOC_SIZE(cmd);
+
+    // Find the command by everything but its size.
+    for (i = 0; i < ARRAY_SIZE(ioctl_cmds); i++)
+        if (!((ioctl_cmds[i].cmd ^ cmd) & ~IOCSIZE_MASK))
+            break;
+    if (i == ARRAY_SIZE(ioctl_cmds))
+        return -ENOTTY;
+    if (usize < ioctl_cmds[i].min_size)
+        return -EINVAL;
+
+    cmd = ioctl_cmds[i].cmd;
+    ksize = _IOC_SIZE(cmd);
+
+    // Commands that only return data start out with zeros, so no uninitialized bytes leak out.
+    // `copy_struct_from_user()` zero-extends older structs, and returns -E2BIG for newer ones
+    // with fields that we don't know.
+    if (_IOC_DIR(cmd) & _IOC_WRITE) {
+        ret = copy_struct_from_user(&data, ksize, uarg, usize);
+        if (ret)
+            return ret;
+    } else {
+        memset(&data, 0, ksize);
+    }
 
     // The function that will be executed depends on the command.
     // IOCtl is a very driver-specific function because on every device there are different
     // commands that are available.
-    switch(cmd) {
+    switch (cmd) {
         case WRITE_FROM_USER_TO_KERNEL:
-            if (copy_from_user(&answer, (int32_t *) arg, sizeof(answer)))
-                pr_err("ioctl_example - Error copying data from user!.\n");
-            else
-                pr_info("ioctl_example - Updated the answer to %d\n", answer);
+            ret = kv_put(IOCTL_ANSWER_KEY, data.answer);
             break;
         case WRITE_FROM_KERNEL_TO_USER:
-            if (copy_to_user((int32_t *) arg, &answer, sizeof(answer)))
-                pr_err("ioctl_example - Error copying data to user!.\n");
-            else
-                pr_info("ioctl_example - The answer was copied!\n");
+            // A deleted answer reads as zero.
+            kv_get(IOCTL_ANSWER_KEY, &value);
+            data.answer = value;
+            ret = 0;
             break;
         case GREETER:
-            if (copy_from_user(&test, (struct mystruct *) arg, sizeof(test)))
-                pr_err("ioctl_example - Error copying data from user!.\n");
-            else
-                pr_info("ioctl_example - %d greetings to %s\n", test.repeat, test.name);
+            // Greeting in the kernel log is what this command is for, so this one stays.
+            pr_info("ioctl_example - %d greetings to %.*s\n", data.greeter.repeat,
+                    (int)sizeof(data.greeter.name), data.greeter.name);
+            ret = 0;
+            break;
+        case IOCTL_INFO:
+            data.info.abi_version = IOCTL_ABI_VERSION;
+            data.info.max_batch = IOCTL_MAX_BATCH;
+            data.info.ring_max_entries = KV_RING_MAX_ENTRIES;
+            ret = 0;
+            break;
+        case IOCTL_BATCH:
+            ret = batch_ioctl(&data.batch);
+            break;
+        case KV_GET:
+            ret = kv_get(data.pair.key, &data.pair.value);
+            break;
+        case KV_PUT:
+            ret = kv_put(data.pair.key, data.pair.value);
+            break;
+        case KV_DELETE:
+            ret = kv_delete(data.pair.key);
+            break;
+        case KV_RING_SETUP:
+            ret = kv_ring_setup(filp, &data.ring);
+            break;
+        case KV_RING_ENTER:
+            ring = READ_ONCE(filp->private_data);
+            ret = ring ? kv_ring_enter(ring, arg) : -ENODEV;
+            break;
+        default:
+            ret = -ENOTTY;
             break;
     }
 
-    return 0;
+    // Copy the result back, cut to the size of the caller's struct.
+    if (ret >= 0 && (_IOC_DIR(cmd) & _IOC_READ) && copy_to_user(uarg, &data, min(usize, ksize)))
+        return -EFAULT;
+
+    return ret;
+}
+
+/**
+ * @brief The `unlocked_ioctl()` callback function. Counts and traces `example_ioctl()`.
+ * @details
+ * This is the hot path, so it doesn't print anything. Calls are counted per CPU in
+ * /sys/module/ioctl_example/stats/ioctl, and every call can be traced with the
+ * `ioctl_example:ioctl_example_ioctl` tracepoint.
+ *
+ * @param[in] file: Our device file.
+ * @param[in] cmd: The command.
+ * @param[in] arg: Potential argument(s).
+ * @return Return code.
+ */
+static long int my_ioctl(struct file *file, unsigned cmd, unsigned long arg) {
+    long ret = example_ioctl(file, cmd, arg);
+
+    // Count the size of the argument that was copied in or out. `KV_RING_ENTER` returns a count.
+    cdev_stats_add(&ioctl_stats, ret < 0 ? 0 : _IOC_SIZE(cmd), ret < 0 ? ret : 0);
+    trace_ioctl_example_ioctl(cmd, arg, ret);
+    return ret;
 }
 
 static struct file_operations fops = {
     // Set file operations function pointers to our own functions.
+    // An open file can hold mapped rings and a running SQPOLL thread, so the module must not be
+    // removed while a file is open. `.owner` makes the VFS hold a reference on the module.
+    .owner = THIS_MODULE,
     .open = my_open,
     .release = my_release,
     .unlocked_ioctl = my_ioctl,
+
+    // 32 bit programs on a 64 bit kernel. The structs have the same layout in both, and pointers
+    // inside of them are `__u64`s, so the only thing to convert is the argument pointer itself.
+    .compat_ioctl = compat_ptr_ioctl,
+    .mmap = my_mmap,  // Maps the rings of `KV_RING_SETUP`.
 };
 
 /**
@@ -91,6 +802,34 @@ static struct file_operations fops = {
  * @return Zero if the loading of the module was successful.
  */
 static int __init my_init(void) {
+    int ret;
+
+    // `KMEM_CACHE()` names the cache after the struct, and it shows up in /proc/slabinfo.
+    kv_cache = KMEM_CACHE(kv_entry, 0);
+    if (!kv_cache)
+        return -ENOMEM;
+
+    chunk_cache = kmem_cache_create("ioctl_example_chunk", BATCH_CHUNK * sizeof(struct ioctl_op), 0, 0, NULL);
+    if (!chunk_cache) {
+        ret = -ENOMEM;
+        goto err_kv_cache;
+    }
+
+    chunk_pool = mempool_create_slab_pool(BATCH_RESERVE, chunk_cache);
+    if (!chunk_pool) {
+        ret = -ENOMEM;
+        goto err_chunk_cache;
+    }
+
+    ret = rhashtable_init(&kv_table, &kv_params);
+    if (ret)
+        goto err_chunk_pool;
+
+    // Start out with the answer every example expects.
+    ret = kv_put(IOCTL_ANSWER_KEY, 42);
+    if (ret)
+        goto err_table;
+
     // `register_chrdev()`:
     //   Will allocate device numbers, create a character device, and link the device numbers to the character device.
     //   • 1st arg is the major device number that it should allocate for the device number.
@@ -103,12 +842,29 @@ static int __init my_init(void) {
     // Check for error while registering the character device.
     if (major_dev_num < 0) {
         pr_err("ioctl_example - Error registering character device\n");
-        return major_dev_num;
+        ret = major_dev_num;
+        goto err_table;
     }
 
+    ret = cdev_stats_register(&stats_group);
+    if (ret)
+        goto err_chrdev;
+
     // The registration of the character device worked.
     pr_info("ioctl_example - Major device number: %d\n", major_dev_num);
     return 0;
+
+err_chrdev:
+    unregister_chrdev(major_dev_num, "ioctl_example");
+err_table:
+    rhashtable_free_and_destroy(&kv_table, kv_free_entry, NULL);
+err_chunk_pool:
+    mempool_destroy(chunk_pool);
+err_chunk_cache:
+    kmem_cache_destroy(chunk_cache);
+err_kv_cache:
+    kmem_cache_destroy(kv_cache);
+    return ret;
 }
 
 /**
@@ -120,9 +876,21 @@ static int __init my_init(void) {
  *   • Makes this function only available within this kernel module.
  */
 static void __exit my_exit(void) {
+    cdev_stats_unregister(&stats_group);
+
     // Delete the character device and free the allocated device numbers via `unregister_chrdev()`.
     // `unregister_chrdev()`'s 2nd arg is the label that appears in `/proc/devices`.
     unregister_chrdev(major_dev_num, "ioctl_example");
+
+    // Nobody can call us anymore, so the remaining entries can be freed right away.
+    rhashtable_free_and_destroy(&kv_table, kv_free_entry, NULL);
+
+    // Wait for the `kv_free_rcu()` calls of deleted entries, they still use `kv_cache`.
+    rcu_barrier();
+
+    mempool_destroy(chunk_pool);
+    kmem_cache_destroy(chunk_cache);
+    kmem_cache_destroy(kv_cache);
 }
 
 // Specify the function to use when the module is loaded into the kernel.
@@ -0,0 +1,44 @@
+// Tracepoints of ioctl_example. They cost a not-taken branch while disabled. Enable them with e.g.
+//   echo 1 > /sys/kernel/tracing/events/ioctl_example/enable
+// or record them with `perf record -e 'ioctl_example:*'`.
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM ioctl_example
+
+// Unlike other headers, this one is read several times by <trace/define_trace.h>.
+#if !defined(IOCTL_EXAMPLE_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define IOCTL_EXAMPLE_TRACE_H
+
+#include <linux/tracepoint.h>
+
+TRACE_EVENT(ioctl_example_ioctl,
+    TP_PROTO(unsigned int cmd, unsigned long arg, long ret),
+    TP_ARGS(cmd, arg, ret),
+
+    TP_STRUCT__entry(
+        __field(unsigned int, cmd)
+        __field(unsigned long, arg)
+        __field(long, ret)
+    ),
+
+    TP_fast_assign(
+        __entry->cmd = cmd;
+        __entry->arg = arg;
+        __entry->ret = ret;
+    ),
+
+    // Split the command into the fields of `_IOC()`, that's easier to match against ioctl_test.h.
+    TP_printk("cmd=%#x (type '%c' nr %u size %u) arg=%#lx ret=%ld",
+              __entry->cmd, _IOC_TYPE(__entry->cmd), _IOC_NR(__entry->cmd), _IOC_SIZE(__entry->cmd),
+              __entry->arg, __entry->ret)
+);
+
+#endif  // #if !defined(IOCTL_EXAMPLE_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+
+// <trace/define_trace.h> includes this file again, from the path below. The Makefile adds our
+// directory to the include path for that.
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE ioctl_example_trace
+#include <trace/define_trace.h>
@@ -1,19 +1,195 @@
 #ifndef IOCTL_TEST_H
 #define IOCTL_TEST_H
 
+// This header is shared by the kernel module and the user space programs, so only use the
+// fixed-size types from <linux/types.h>. Every struct has the same layout on 32 and 64 bit: all
+// fields are naturally aligned, and pointers are passed as `__u64`. So 32 bit programs on a 64 bit
+// kernel go through the same code as 64 bit ones.
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+// Version of the ABI below. `IOCTL_INFO` returns the version of the driver.
+//   1: The first commands. Their size was the size of a pointer, see `ioctl_legacy()` in the driver.
+//   2: Commands are encoded with the size of their argument, and structs can grow.
+#define IOCTL_ABI_VERSION 2
+
+// Magic number of all commands of this driver.
+#define IOCTL_MAGIC 'a'
+
+// Structs can grow in later versions, by adding fields at the end. The size in the command number
+// tells the driver which version of the struct a program was built with, like the `size` argument
+// of `openat2()` and `clone3()`:
+//   • An older, smaller struct is extended with zeros, so new fields must have zero as the default.
+//   • A newer, larger struct is accepted if the fields that the driver doesn't know are all zero.
+//     Otherwise the command fails with -E2BIG.
+//   • Structs that the driver writes back are cut to the size of the caller's struct. Fields that
+//     the driver doesn't know are left alone, check `IOCTL_INFO` to see what it filled in.
+// Unknown commands fail with -ENOTTY, and bad user space pointers with -EFAULT.
+
 struct mystruct {
-    int repeat;
+    __s32 repeat;
     char name[64];
 };
 
+// The driver is a key-value store with 64 bit keys and values. Key 0 is `answer`, the value that
+// the scalar commands below read and write.
+#define IOCTL_ANSWER_KEY 0
+
+// Operations of a batch descriptor.
+#define IOCTL_OP_GET 0  // Copy the value of `key` into `value`. -ENOENT if the key doesn't exist.
+#define IOCTL_OP_PUT 1  // Store `value` under `key`, adding the key if needed.
+#define IOCTL_OP_DELETE 2  // Remove `key`. -ENOENT if the key doesn't exist.
+
+// Most descriptors that one `IOCTL_BATCH` call accepts.
+#define IOCTL_MAX_BATCH 4096
+
+/**
+ * @brief Argument of `IOCTL_INFO`.
+ */
+struct ioctl_info {
+    __u32 abi_version;  // `IOCTL_ABI_VERSION` of the driver.
+    __u32 max_batch;  // `IOCTL_MAX_BATCH`.
+    __u32 ring_max_entries;  // `KV_RING_MAX_ENTRIES`.
+    __u32 pad;
+};
+
+/**
+ * @brief One operation of a batch.
+ */
+struct ioctl_op {
+    __u32 op;  // `IOCTL_OP_*`.
+    __s32 status;  // Set by the driver: 0 on success, a negative errno if this operation failed.
+    __u64 key;
+    __s64 value;  // In for `IOCTL_OP_PUT`, out for `IOCTL_OP_GET`.
+};
+
+/**
+ * @brief Argument of the single key commands `KV_GET`, `KV_PUT` and `KV_DELETE`.
+ */
+struct kv_pair {
+    __u64 key;
+    __s64 value;  // In for `KV_PUT`, out for `KV_GET`, unused for `KV_DELETE`.
+};
+
+/**
+ * @brief Argument of `IOCTL_BATCH`.
+ */
+struct ioctl_batch {
+    __u64 ops;  // User space pointer to an array of `count` descriptors, as a `__u64` so it's the same on 32 and 64 bit.
+    __u32 count;
+    __u32 pad;
+};
+
+// Shared-memory rings, like io_uring. `KV_RING_SETUP` creates a submission queue (SQ) and a
+// completion queue (CQ) for the open file, and `mmap()` at offset 0 maps both of them. User space
+// puts `struct kv_sqe`s into the SQ and reaps `struct kv_cqe`s from the CQ. The driver consumes the
+// SQ when `KV_RING_ENTER` rings the doorbell, or all by itself with `KV_RING_SQPOLL`, so a busy
+// program doesn't need any system call at all.
+//
+// All cursors are free-running `__u32` positions. `pos & (entries - 1)` is the index into the array.
+//   Submit: fill `sqes[sq_tail & mask]`, then store `sq_tail + 1` into `sq_tail` with release
+//           semantics. The entry is free again once `sq_head` (load-acquire) moved past it.
+//   Reap:   while `cq_head != cq_tail` (load-acquire), use `cqes[cq_head & mask]`, then store
+//           `cq_head + 1` into `cq_head` with release semantics.
+// The driver stops taking SQEs while the CQ is full, so completions are never dropped.
+//
+// The `KV_RING_SQPOLL` thread goes to sleep when it had nothing to do for `sq_thread_idle` ms.
+// After storing `sq_tail`, issue a full barrier and check `flags`. If `KV_RING_NEED_WAKEUP` is set,
+// call `KV_RING_ENTER` with `KV_ENTER_SQ_WAKEUP`. The same goes for after reaping a full CQ.
+
+#define KV_RING_MAX_ENTRIES 32768  // Most SQ entries. The CQ has twice as many.
+
+// `struct kv_ring_params.flags`.
+// A kernel thread polls the SQ, no `KV_RING_ENTER` needed while it's awake. Needs CAP_SYS_ADMIN,
+// `KV_RING_SETUP` fails with -EPERM otherwise.
+#define KV_RING_SQPOLL 0x1
+
+// `struct kv_ring_hdr.flags`, set by the driver.
+#define KV_RING_NEED_WAKEUP 0x1  // The SQPOLL thread went to sleep. Call `KV_RING_ENTER` with `KV_ENTER_SQ_WAKEUP`.
+
+// Argument of `KV_RING_ENTER`, passed by value.
+#define KV_ENTER_GETEVENTS 0x1  // Sleep until the CQ isn't empty.
+#define KV_ENTER_SQ_WAKEUP 0x2  // Wake up the SQPOLL thread.
+
+/**
+ * @brief Argument of `KV_RING_SETUP`.
+ */
+struct kv_ring_params {
+    __u32 entries;  // In: SQ entries, a power of two up to `KV_RING_MAX_ENTRIES`.
+    __u32 flags;  // In: `KV_RING_*` flags.
+    __u32 sq_thread_idle;  // In: `KV_RING_SQPOLL` thread goes to sleep after this many ms without work. 0 means 1000.
+    __s32 sq_thread_cpu;  // In: CPU of the `KV_RING_SQPOLL` thread, -1 for any.
+    __u32 map_size;  // Out: bytes to `mmap()`.
+    __u32 pad;
+};
+
+/**
+ * @brief Header at offset 0 of the mapping. The cursors are on cache lines of their own, because
+ *     each of them is written by one side and polled by the other.
+ */
+struct kv_ring_hdr {
+    __u32 sq_head;  // Written by the driver.
+    __u32 pad0[15];
+    __u32 sq_tail;  // Written by user space.
+    __u32 pad1[15];
+    __u32 cq_head;  // Written by user space.
+    __u32 pad2[15];
+    __u32 cq_tail;  // Written by the driver.
+    __u32 pad3[15];
+    __u32 flags;  // `KV_RING_NEED_WAKEUP`. Written by the driver.
+    __u32 sq_entries;
+    __u32 cq_entries;
+    __u32 sq_off;  // Offset of the `struct kv_sqe` array from the start of the mapping.
+    __u32 cq_off;  // Offset of the `struct kv_cqe` array.
+};
+
+/**
+ * @brief Submission queue entry. One operation, like `struct ioctl_op`.
+ */
+struct kv_sqe {
+    __u32 op;  // `IOCTL_OP_*`.
+    __u32 pad;
+    __u64 key;
+    __s64 value;  // In for `IOCTL_OP_PUT`.
+    __u64 user_data;  // Copied into the completion as it is.
+};
+
+/**
+ * @brief Completion queue entry.
+ */
+struct kv_cqe {
+    __u64 user_data;  // Of the SQE.
+    __s64 value;  // Out for `IOCTL_OP_GET`.
+    __s32 status;  // 0 on success, or a negative errno.
+    __u32 pad;
+};
+
 // Write from the user space to the kernel space.
 // First 2 args will be combined to a magic number, which will be our command's number.
-// 3rd arg will be the type of argument we are passing.
-#define WRITE_FROM_USER_TO_KERNEL _IOW('a', 'b', int32_t *)
+// 3rd arg will be the type of argument we are passing. It's the type itself, not a pointer to it:
+// the size of the type is part of the command number.
+#define WRITE_FROM_USER_TO_KERNEL _IOW(IOCTL_MAGIC, 'b', __s32)
+
+// Write from the kernel space to the user space. Every command has its own number.
+#define WRITE_FROM_KERNEL_TO_USER _IOR(IOCTL_MAGIC, 'j', __s32)
+
+// Prints greetings in the kernel log. The struct goes from user space to the driver, so it's `_IOW()`.
+#define GREETER _IOW(IOCTL_MAGIC, 'c', struct mystruct)
+
+// Returns the ABI version and the limits of the driver.
+#define IOCTL_INFO _IOR(IOCTL_MAGIC, 'k', struct ioctl_info)
+
+// Run a whole array of `struct ioctl_op` in one call. The descriptors are copied in and out in chunks
+// of 128, so a batch costs one syscall and two copies per 128 operations.
+#define IOCTL_BATCH _IOWR(IOCTL_MAGIC, 'd', struct ioctl_batch)
 
-// Write from the kernel space to the user space.
-#define WRITE_FROM_KERNEL_TO_USER _IOR('a', 'b', int32_t *)
+// Single key commands. They fail with -ENOENT if the key doesn't exist.
+#define KV_GET _IOWR(IOCTL_MAGIC, 'e', struct kv_pair)
+#define KV_PUT _IOW(IOCTL_MAGIC, 'f', struct kv_pair)
+#define KV_DELETE _IOW(IOCTL_MAGIC, 'g', struct kv_pair)
 
-#define GREETER _IOR('a', 'c', struct mystruct *)
+// Shared-memory rings, see `struct kv_ring_hdr`. One set of rings per open file.
+#define KV_RING_SETUP _IOWR(IOCTL_MAGIC, 'h', struct kv_ring_params)
+#define KV_RING_ENTER _IO(IOCTL_MAGIC, 'i')  // Consumes the SQ and returns the number of SQEs it took. Takes `KV_ENTER_*` flags.
 
 #endif  // #ifndef IOCTL_TEST_H
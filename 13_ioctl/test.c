@@ -2,15 +2,302 @@
 #include <stdlib.h>
 #include <unistd.h>  // For open and close.
 #include <fcntl.h>  // For the flags being associated with our character device.
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 
 #include "ioctl_test.h"
 
+// Runs the scalar commands once, then measures how many key-value operations per second we get
+// with one operation per `ioctl()` and with batches of growing size. Then it runs `KV_GET` from
+// more and more threads at once, to show how the lock-free lookups scale across cores. Last, it
+// runs the same operations through the shared-memory rings, with a doorbell `ioctl()` per batch
+// and with the SQPOLL thread, which needs no system call at all.
+//
+// Usage: test [number of operations] [most threads]
+//
+// Build it with `-m32` as well, to run the same tests through the 32 bit compat path of the driver.
+
+#define NR_KEYS 256  // Keys used by the benchmarks.
+#define RING_ENTRIES 4096  // SQ entries of the ring benchmark.
+
+/**
+ * @brief Arguments of one lookup thread.
+ */
+struct lookup_thread {
+    pthread_t thread;
+    int fd;
+    unsigned long count;  // Lookups to do.
+    int failed;
+};
+
+/**
+ * @brief The user space side of the rings of `KV_RING_SETUP`.
+ */
+struct ring {
+    int fd;
+    struct kv_ring_hdr *hdr;
+    struct kv_sqe *sqes;
+    struct kv_cqe *cqes;
+    unsigned int map_size;
+};
+
+/**
+ * @brief Returns the current time of the monotonic clock in seconds.
+ */
+static double now_in_secs(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief Runs `total` operations with one `KV_PUT` or `KV_GET` per `ioctl()` and prints the rate.
+ *
+ * This is the baseline for `bench()`. A batch of one still goes through `IOCTL_BATCH`, which copies
+ * a descriptor array in and out, so it is not quite the same as a single key command.
+ *
+ * @return Zero on success, -1 if an `ioctl()` failed.
+ */
+static int bench_scalar(int fd, unsigned long total) {
+    struct kv_pair pair;
+    unsigned long done;
+    double secs;
+
+    // Half reads, half writes, spread over all registers. Every `KV_GET` reads the key that the
+    // `KV_PUT` before it wrote, so it can't fail with ENOENT.
+    secs = now_in_secs();
+    for (done = 0; done < total; done++) {
+        pair.key = (done / 2) % NR_KEYS;
+        pair.value = done;
+        if (ioctl(fd, done & 1 ? KV_GET : KV_PUT, &pair) < 0) {
+            perror(done & 1 ? "KV_GET failed" : "KV_PUT failed");
+            return -1;
+        }
+    }
+    secs = now_in_secs() - secs;
+
+    printf("per call  : %10.0f ops/s (%6.1f ns/op)\n", done / secs, secs * 1e9 / done);
+    return 0;
+}
+
+/**
+ * @brief Runs `total` operations in batches of `batch_size` and prints the rate.
+ *
+ * @return Zero on success, -1 if an `ioctl()` failed.
+ */
+static int bench(int fd, struct ioctl_op *ops, unsigned int batch_size, unsigned long total) {
+    struct ioctl_batch batch = { .ops = (uintptr_t)ops, .count = batch_size };
+    unsigned long done;
+    unsigned int i;
+    double secs;
+
+    // Half reads, half writes, spread over all registers.
+    for (i = 0; i < batch_size; i++) {
+        ops[i].op = i & 1 ? IOCTL_OP_GET : IOCTL_OP_PUT;
+        ops[i].key = i % NR_KEYS;
+        ops[i].value = i;
+    }
+
+    secs = now_in_secs();
+    for (done = 0; done < total; done += batch_size) {
+        if (ioctl(fd, IOCTL_BATCH, &batch) < 0) {
+            perror("IOCTL_BATCH failed");
+            return -1;
+        }
+    }
+    secs = now_in_secs() - secs;
+
+    printf("batch %5u: %10.0f ops/s (%6.1f ns/op)\n", batch_size, done / secs, secs * 1e9 / done);
+    return 0;
+}
+
+/**
+ * @brief Body of a lookup thread. Looks up the benchmark keys round robin.
+ */
+static void *lookup_main(void *arg) {
+    struct lookup_thread *t = arg;
+    struct kv_pair pair;
+    unsigned long i;
+
+    for (i = 0; i < t->count; i++) {
+        pair.key = i % NR_KEYS;
+        if (ioctl(t->fd, KV_GET, &pair) < 0) {
+            t->failed = 1;
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Runs `total` lookups, split across `nr_threads` threads, and prints the rate.
+ *
+ * @return Zero on success, -1 if a thread failed.
+ */
+static int bench_lookups(int fd, unsigned int nr_threads, unsigned long total) {
+    struct lookup_thread threads[nr_threads];
+    unsigned int i;
+    int failed = 0;
+    double secs;
+
+    secs = now_in_secs();
+    for (i = 0; i < nr_threads; i++) {
+        threads[i] = (struct lookup_thread){ .fd = fd, .count = total / nr_threads };
+        pthread_create(&threads[i].thread, NULL, lookup_main, &threads[i]);
+    }
+    for (i = 0; i < nr_threads; i++) {
+        pthread_join(threads[i].thread, NULL);
+        failed |= threads[i].failed;
+    }
+    secs = now_in_secs() - secs;
+
+    if (failed) {
+        perror("KV_GET failed");
+        return -1;
+    }
+
+    printf("%3u threads: %10.0f lookups/s\n", nr_threads, total / secs);
+    return 0;
+}
+
+/**
+ * @brief Opens the device and maps a new set of rings.
+ *
+ * @param[in] flags: `KV_RING_*` flags.
+ * @return Zero on success, -1 otherwise.
+ */
+static int ring_open(struct ring *r, unsigned int flags) {
+    struct kv_ring_params params = { .entries = RING_ENTRIES, .flags = flags, .sq_thread_cpu = -1 };
+    void *map;
+
+    // The rings belong to the open file, so every set of rings needs a file of its own.
+    r->fd = open("/dev/mydevice", O_RDWR);
+    if (r->fd < 0)
+        return -1;
+
+    if (ioctl(r->fd, KV_RING_SETUP, &params) < 0) {
+        close(r->fd);
+        return -1;
+    }
+
+    map = mmap(NULL, params.map_size, PROT_READ | PROT_WRITE, MAP_SHARED, r->fd, 0);
+    if (map == MAP_FAILED) {
+        close(r->fd);
+        return -1;
+    }
+
+    r->map_size = params.map_size;
+    r->hdr = map;
+    r->sqes = (struct kv_sqe *)((char *)map + r->hdr->sq_off);
+    r->cqes = (struct kv_cqe *)((char *)map + r->hdr->cq_off);
+    return 0;
+}
+
+static void ring_close(struct ring *r) {
+    munmap(r->hdr, r->map_size);
+    close(r->fd);  // Stops the SQPOLL thread and frees the rings.
+}
+
+/**
+ * @brief Runs `total` operations through the rings, `batch_size` SQEs at a time, and prints the rate.
+ *
+ * Without SQPOLL, every batch costs one `KV_RING_ENTER`, which runs the batch right away. With
+ * SQPOLL, we only call into the driver when its thread went to sleep.
+ *
+ * @return Zero on success, -1 if an operation failed.
+ */
+static int bench_ring(unsigned int flags, unsigned int batch_size, unsigned long total) {
+    unsigned long submitted = 0, done = 0, syscalls = 0;
+    unsigned int sq_tail, cq_head, cq_tail, i;
+    struct kv_sqe *sqe;
+    struct kv_cqe *cqe;
+    struct ring r;
+    double secs;
+
+    if (ring_open(&r, flags) < 0) {
+        // SQPOLL needs CAP_SYS_ADMIN. Run as root to benchmark it too.
+        if (errno == EPERM && (flags & KV_RING_SQPOLL)) {
+            printf("sqpoll   skipped, needs CAP_SYS_ADMIN\n");
+            return 0;
+        }
+        perror("Setting up the rings failed");
+        return -1;
+    }
+
+    sq_tail = r.hdr->sq_tail;
+    cq_head = r.hdr->cq_head;
+
+    secs = now_in_secs();
+    while (done < total) {
+        // Fill up to one batch of free SQEs. A slot is free once the driver's head moved past it.
+        for (i = 0; i < batch_size && submitted < total; i++, submitted++) {
+            if (sq_tail - __atomic_load_n(&r.hdr->sq_head, __ATOMIC_ACQUIRE) == RING_ENTRIES)
+                break;
+            sqe = &r.sqes[sq_tail++ & (RING_ENTRIES - 1)];
+            sqe->op = submitted & 1 ? IOCTL_OP_GET : IOCTL_OP_PUT;
+            sqe->key = submitted % NR_KEYS;
+            sqe->value = submitted;
+            sqe->user_data = submitted;
+        }
+        __atomic_store_n(&r.hdr->sq_tail, sq_tail, __ATOMIC_RELEASE);
+
+        if (!(flags & KV_RING_SQPOLL)) {
+            if (ioctl(r.fd, KV_RING_ENTER, 0) < 0) {
+                perror("KV_RING_ENTER failed");
+                ring_close(&r);
+                return -1;
+            }
+            syscalls++;
+        } else {
+            // Pairs with the barrier of the SQPOLL thread between setting the flag and its last look.
+            __atomic_thread_fence(__ATOMIC_SEQ_CST);
+            if (__atomic_load_n(&r.hdr->flags, __ATOMIC_RELAXED) & KV_RING_NEED_WAKEUP) {
+                ioctl(r.fd, KV_RING_ENTER, KV_ENTER_SQ_WAKEUP);
+                syscalls++;
+            }
+        }
+
+        // Reap whatever completed so far.
+        cq_tail = __atomic_load_n(&r.hdr->cq_tail, __ATOMIC_ACQUIRE);
+        for (; cq_head != cq_tail; cq_head++, done++) {
+            cqe = &r.cqes[cq_head & (r.hdr->cq_entries - 1)];
+            if (cqe->status < 0 && cqe->status != -ENOENT) {
+                printf("Operation %llu failed: %d\n", (unsigned long long)cqe->user_data, cqe->status);
+                ring_close(&r);
+                return -1;
+            }
+        }
+        __atomic_store_n(&r.hdr->cq_head, cq_head, __ATOMIC_RELEASE);
+    }
+    secs = now_in_secs() - secs;
+
+    printf("%s batch %5u: %10.0f ops/s (%6.1f ns/op), %lu system calls\n",
+           flags & KV_RING_SQPOLL ? "sqpoll  " : "doorbell", batch_size, done / secs, secs * 1e9 / done, syscalls);
+
+    ring_close(&r);
+    return 0;
+}
+
 // This is a user space program.
 int main(int argc, char **argv) {
+    static struct ioctl_op ops[IOCTL_MAX_BATCH];
+    static const unsigned int batch_sizes[] = { 1, 16, 256, IOCTL_MAX_BATCH };
+    unsigned long total;
+    unsigned int i, max_threads;
+    struct kv_pair pair;
     int fd;  // File descriptor.
     int answer;
     struct mystruct test = {4, "Preston"};
+    struct ioctl_info info;
+
+    total = argc > 1 ? strtoul(argv[1], NULL, 0) : 1000000;
+    max_threads = argc > 2 ? (unsigned int)atoi(argv[2]) : (unsigned int)sysconf(_SC_NPROCESSORS_ONLN);
 
     {  /* Test #1 */
         // Open our device [driver] with read-only permissions.
@@ -22,30 +309,94 @@ int main(int argc, char **argv) {
             return fd;
         }
 
-        printf("WRITE_FROM_USER_TO_KERNEL = %ld\n", WRITE_FROM_USER_TO_KERNEL);
-        printf("WRITE_FROM_KERNEL_TO_USER = %ld\n", WRITE_FROM_KERNEL_TO_USER);
-        printf("GREETER = %ld\n\n", GREETER);
+        // The command numbers are the same for 32 and 64 bit programs.
+        printf("WRITE_FROM_USER_TO_KERNEL = %#lx\n", (unsigned long)WRITE_FROM_USER_TO_KERNEL);
+        printf("WRITE_FROM_KERNEL_TO_USER = %#lx\n", (unsigned long)WRITE_FROM_KERNEL_TO_USER);
+        printf("GREETER = %#lx\n\n", (unsigned long)GREETER);
+
+        // Check which version of the ABI the driver speaks.
+        if (ioctl(fd, IOCTL_INFO, &info) < 0) {
+            perror("IOCTL_INFO failed");
+            return 1;
+        }
+        printf("ABI version %u (ours is %u), batches of up to %u, rings of up to %u entries\n\n",
+               info.abi_version, IOCTL_ABI_VERSION, info.max_batch, info.ring_max_entries);
 
         // Write default `answer` from kernel to user.
-        ioctl(fd, WRITE_FROM_KERNEL_TO_USER, &answer);
+        if (ioctl(fd, WRITE_FROM_KERNEL_TO_USER, &answer) < 0)
+            perror("WRITE_FROM_KERNEL_TO_USER failed");
         printf("Wrote `answer` from kernel to user.\n`answer` is: %d\n\n", answer);
 
         answer = 123;
 
         // Write new `answer` from user to kernel.
-        ioctl(fd, WRITE_FROM_USER_TO_KERNEL, &answer);
+        if (ioctl(fd, WRITE_FROM_USER_TO_KERNEL, &answer) < 0)
+            perror("WRITE_FROM_USER_TO_KERNEL failed");
         printf("Wrote `answer` from user to kernel.\n`answer` is: %d\n\n", answer);
 
         // Write new `answer` from kernel to user.
-        ioctl(fd, WRITE_FROM_KERNEL_TO_USER, &answer);
+        if (ioctl(fd, WRITE_FROM_KERNEL_TO_USER, &answer) < 0)
+            perror("WRITE_FROM_KERNEL_TO_USER failed");
         printf("Wrote `answer` from kernel to user.\n`answer` is: %d\n\n", answer);
 
         // Perform the greeting as specifed by `struct mystruct test`.
-        ioctl(fd, GREETER, &test);
-        printf("Performed greeting in the kernel log: {%d, %s}\n", test.repeat, test.name);
+        if (ioctl(fd, GREETER, &test) < 0)
+            perror("GREETER failed");
+        printf("Performed greeting in the kernel log: {%d, %s}\n\n", test.repeat, test.name);
+
+        // Errors are reported now: an unknown command and a bad pointer.
+        if (ioctl(fd, _IO(IOCTL_MAGIC, 'z')) < 0)
+            perror("Unknown command (expected ENOTTY)");
+        if (ioctl(fd, WRITE_FROM_KERNEL_TO_USER, NULL) < 0)
+            perror("NULL pointer (expected EFAULT)");
 
         close(fd);  // Close the file.
     }
 
+    {  /* Test #2 */
+        fd = open("/dev/mydevice", O_RDWR);
+
+        // Check if we couldn't open the file.
+        if (fd < 0) {
+            perror("Error opening file.");
+            return fd;
+        }
+
+        // Add, read back and delete one key with the single key commands.
+        pair = (struct kv_pair){ .key = 0xfeed, .value = -7 };
+        ioctl(fd, KV_PUT, &pair);
+        pair.value = 0;
+        ioctl(fd, KV_GET, &pair);
+        printf("\nKey 0x%llx has the value %lld\n", (unsigned long long)pair.key, (long long)pair.value);
+        ioctl(fd, KV_DELETE, &pair);
+        if (ioctl(fd, KV_GET, &pair) < 0)
+            perror("Key 0xfeed after KV_DELETE");
+
+        printf("\nRunning %lu key-value operations per call and per batch size:\n", total);
+        if (bench_scalar(fd, total) < 0)
+            return 1;
+        for (i = 0; i < sizeof(batch_sizes) / sizeof(batch_sizes[0]); i++)
+            if (bench(fd, ops, batch_sizes[i], total) < 0)
+                return 1;
+
+        // The batches above put all benchmark keys into the store.
+        printf("\nRunning %lu lookups with 1 to %u threads:\n", total, max_threads);
+        for (i = 1; i <= max_threads; i *= 2)
+            if (bench_lookups(fd, i, total) < 0)
+                return 1;
+
+        close(fd);  // Close the file.
+    }
+
+    {  /* Test #3 */
+        printf("\nRunning %lu key-value operations through the rings:\n", total);
+        for (i = 0; i < 3; i++)
+            if (bench_ring(0, batch_sizes[i], total) < 0)
+                return 1;
+        for (i = 0; i < 3; i++)
+            if (bench_ring(KV_RING_SQPOLL, batch_sizes[i], total) < 0)
+                return 1;
+    }
+
     return 0;
 }
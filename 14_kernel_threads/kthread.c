@@ -4,75 +4,779 @@
 #include <linux/init.h>
 #include <linux/kthread.h>  // Provides all the functions needed for thread handling.
 #include <linux/sched.h>  // Scheduler.
-#include <linux/delay.h>  // We'll use some delay functions in our threads.
+#include <linux/fs.h>  // "fs" stands for "file system."
+#include <linux/slab.h>  // For `kmem_cache_create()`.
+#include <linux/mempool.h>
+#include <linux/list.h>
+#include <linux/spinlock.h>
+#include <linux/wait.h>
+#include <linux/percpu.h>
+#include <linux/cpumask.h>
+#include <linux/topology.h>  // For `cpu_to_node()` and `cpumask_of_node()`.
+#include <linux/uaccess.h>  // For `copy_to_user()` and `copy_from_user()`.
+#include <linux/seqlock.h>
+#include <linux/average.h>  // For `DECLARE_EWMA()`.
+#include <linux/math64.h>  // For `mul_u64_u64_div_u64()`.
+#include <linux/timekeeping.h>  // For `ktime_get_ns()`.
+
+#include <cdev_stats.h>  // For `cdev_stats_register()`.
+#include "kthread_pool.h"
+
+/**
+ * @brief One unit of work, queued on the deque of a worker.
+ */
+struct kpool_work {
+    struct list_head node;
+    u32 op;  // One of the `KPOOL_OP_*` operations.
+    int nid;  // NUMA node whose mempool the work item goes back to.
+    u64 arg;
+};
+
+/**
+ * @brief A worker thread that is bound to one CPU, with its own deque of work items.
+ * @details
+ * The owner takes work from the tail of its deque (newest first, its data is most likely still in
+ * the cache), other workers steal from the head (oldest first). Every worker only takes its own lock
+ * unless it runs out of work, so the workers don't contend with each other while all of them are busy.
+ */
+struct kpool_worker {
+    struct task_struct *task;
+    unsigned int cpu;
+
+    spinlock_t lock;  // Protects `deque`.
+    struct list_head deque;
+    wait_queue_head_t wq;  // The worker sleeps here while there is no work anywhere.
+    bool idle;
+};
+
+// Counters of the pool, see `struct kpool_counters`. The snapshot prints them in this order.
+enum kpool_counter {
+    KPOOL_SUBMITTED,  // Work items that were queued.
+    KPOOL_STARTED,  // Work items that a worker took off a deque.
+    KPOOL_COMPLETED,  // Work items that finished.
+    KPOOL_STOLEN,  // Work items that ran on another worker than the one they were queued to.
+    NR_KPOOL_COUNTERS,
+};
+
+static const char * const kpool_counter_names[NR_KPOOL_COUNTERS] = {
+    "submitted", "started", "completed", "stolen",
+};
+
+/**
+ * @brief The counters of one CPU.
+ * @details
+ * Only the CPU itself writes them, with `this_cpu_*()`: no lock, no atomic instruction. They are
+ * kept apart from `struct kpool_worker`, whose lock the thieves take, so counting never shares a
+ * cache line with anybody. Readers sum them up over all CPUs, see `kpool_stats_fold()`.
+ *
+ * The pool has no shared counter of queued or running work items either. Both are differences of
+ * these sums, see `kpool_inflight()`, so submitting and running work never writes a shared cache line.
+ */
+struct kpool_counters {
+    u64 count[NR_KPOOL_COUNTERS];
+    u64 checksum;  // Sum of all results, so the work can't be optimized away.
+};
+
+/**
+ * @brief What /sys/module/kthread/stats/snapshot shows. Taken by the stats thread every `stats_interval_ms`.
+ */
+struct kpool_snapshot {
+    u64 time_ns;  // When it was taken, from `ktime_get_ns()`.
+    u64 interval_ns;  // Time since the snapshot before.
+    u64 total[NR_KPOOL_COUNTERS];
+    u64 delta[NR_KPOOL_COUNTERS];  // Since the snapshot before.
+    u64 rate[NR_KPOOL_COUNTERS];  // Per second, over the last interval.
+    unsigned long ewma[NR_KPOOL_COUNTERS];  // Per second, moving average over the last intervals.
+    s64 inflight;  // Submitted, but not completed yet.
+    s64 queued;  // Sitting in a deque.
+    unsigned int idle;  // Workers that are sleeping.
+    unsigned int nr_workers;
+};
+
+// Moving average of the rates. Every snapshot moves it 1/8 of the way to the latest rate, and the
+// value keeps 4 bits of fraction.
+DECLARE_EWMA(kpool_rate, 4, 8)
 
 /* Global variables */
-static struct task_struct *kthread_1;
-static struct task_struct *kthread_2;
-static int t1_data = 1, t2_data = 2;  // Data to be passed to the threads' functions.
+static int major_dev_num;  // Major device number that will be allocated by our kernel module.
+static DEFINE_PER_CPU(struct kpool_worker, workers);  // One worker per CPU, on the CPU's own node.
+static struct cpumask kpool_cpus;  // CPUs that have a worker.
+static struct cpumask kpool_idle;  // CPUs whose worker is sleeping.
+static DECLARE_WAIT_QUEUE_HEAD(kpool_done_wq);  // `KPOOL_WAIT` callers sleep here.
+static DEFINE_PER_CPU_ALIGNED(struct kpool_counters, kpool_counters);
+
+// The latest snapshot. Only the stats thread writes it, readers copy it without taking the lock.
+static DEFINE_SPINLOCK(kpool_snap_lock);
+static seqcount_spinlock_t kpool_snap_seq = SEQCNT_SPINLOCK_ZERO(kpool_snap_seq, &kpool_snap_lock);
+static struct kpool_snapshot kpool_snap;
+static struct task_struct *kpool_stats_task;
+
+static char *cpus;
+module_param(cpus, charp, 0444);
+MODULE_PARM_DESC(cpus, "CPUs that get a worker, as a list like 2-7,10 (default: all online CPUs)");
+
+static unsigned int reserve = KPOOL_MAX_BATCH;
+module_param(reserve, uint, 0444);
+MODULE_PARM_DESC(reserve, "Work items kept in reserve per NUMA node (default: one full batch)");
+
+static unsigned int stats_interval_ms = 1000;
+module_param(stats_interval_ms, uint, 0644);
+MODULE_PARM_DESC(stats_interval_ms, "How often the stats thread takes a snapshot of the counters, in ms (default: 1000, at least 10)");
+
+// Work items come from their own slab cache instead of `kmalloc()`. The slab allocator keeps a
+// per-CPU freelist of them, so allocating and freeing one is usually a few instructions on
+// CPU-local memory. On top of that, every node has a mempool with `reserve` preallocated items,
+// see `kpool_alloc_work()`.
+static struct kmem_cache *kpool_work_cache;
+static mempool_t **kpool_work_pools;  // Indexed by NUMA node.
+
+/**
+ * @brief Executes a single work item.
+ *
+ * @return The result of the work item.
+ */
+static u64 kpool_run(struct kpool_work *work) {
+    u64 x = work->arg | 1;
+    u64 i;
+
+    switch (work->op) {
+        case KPOOL_OP_SPIN:
+            for (i = 0; i < work->arg; i++) {
+                x ^= x << 13;
+                x ^= x >> 7;
+                x ^= x << 17;
+
+                // Long work items must not hog the CPU.
+                if ((i & 0xffff) == 0xffff)
+                    cond_resched();
+            }
+            return x;
+
+        default:
+            return 0;
+    }
+}
+
+/**
+ * @brief `alloc` function of the mempools. Allocates a work item on the pool's node.
+ */
+static void *kpool_pool_alloc(gfp_t gfp, void *pool_data) {
+    return kmem_cache_alloc_node(kpool_work_cache, gfp, (int)(long)pool_data);
+}
+
+/**
+ * @brief `free` function of the mempools. Gives a work item back to the slab cache.
+ */
+static void kpool_pool_free(void *element, void *pool_data) {
+    kmem_cache_free(kpool_work_cache, element);
+}
+
+/**
+ * @brief Allocates a work item on node `nid` without ever waiting for memory reclaim.
+ * @details
+ * Under memory pressure, `kmalloc(GFP_KERNEL)` can block for a long time while the kernel reclaims
+ * memory. Here the slab cache is only tried without direct reclaim. If that fails, the item comes
+ * out of the node's reserve, and if the reserve is empty, too, we fail right away. So a submission
+ * either succeeds quickly or returns -ENOMEM, it never stalls.
+ *
+ * @return The work item, or NULL.
+ */
+static struct kpool_work *kpool_alloc_work(int nid) {
+    struct kpool_work *work = mempool_alloc(kpool_work_pools[nid], GFP_NOWAIT | __GFP_NOWARN);
+
+    if (work)
+        work->nid = nid;
+    return work;
+}
+
+/**
+ * @brief Frees a work item. If the reserve of its node isn't full, the item refills it.
+ */
+static void kpool_free_work(struct kpool_work *work) {
+    mempool_free(work, kpool_work_pools[work->nid]);
+}
+
+/**
+ * @brief Returns true if any deque holds a work item. Only called by workers that are about to sleep.
+ */
+static bool kpool_has_work(void) {
+    unsigned int cpu;
 
+    for_each_cpu(cpu, &kpool_cpus) {
+        if (!list_empty_careful(&per_cpu_ptr(&workers, cpu)->deque))
+            return true;
+    }
+
+    return false;
+}
+
+/**
+ * @brief Returns the number of work items that were submitted, but not completed yet.
+ * @details
+ * The completions are summed up first. A work item is counted as submitted before its worker can
+ * take it (the deque lock orders the two), so the result is never too small: zero means that
+ * everything submitted before the call has completed.
+ */
+static s64 kpool_inflight(void) {
+    u64 submitted = 0, completed = 0;
+    unsigned int cpu;
+
+    for_each_possible_cpu(cpu)
+        completed += READ_ONCE(per_cpu_ptr(&kpool_counters, cpu)->count[KPOOL_COMPLETED]);
+
+    // Pairs with the deque lock, which the submitter releases after counting.
+    smp_rmb();
+
+    for_each_possible_cpu(cpu)
+        submitted += READ_ONCE(per_cpu_ptr(&kpool_counters, cpu)->count[KPOOL_SUBMITTED]);
+
+    return submitted - completed;
+}
 
 /**
- * @brief This function will be executed by the threads.
- * 
- * @param[in] thread_number: Number/identifier of the thread.
+ * @brief Takes the newest work item from the worker's own deque.
+ */
+static struct kpool_work *kpool_pop(struct kpool_worker *w) {
+    struct kpool_work *work;
+
+    spin_lock(&w->lock);
+    work = list_last_entry_or_null(&w->deque, struct kpool_work, node);
+    if (work)
+        list_del(&work->node);
+    spin_unlock(&w->lock);
+
+    return work;
+}
+
+/**
+ * @brief Takes the oldest work item from the deque of another worker.
+ */
+static struct kpool_work *kpool_steal(struct kpool_worker *thief) {
+    struct kpool_worker *victim;
+    struct kpool_work *work;
+    unsigned int cpu;
+
+    // Start with our neighbor, so that not every thief goes after the same victim.
+    for_each_cpu_wrap(cpu, &kpool_cpus, thief->cpu + 1) {
+        if (cpu == thief->cpu)
+            continue;
+
+        victim = per_cpu_ptr(&workers, cpu);
+
+        // Peek without the lock first, there is no point in bouncing the lock of an empty deque.
+        if (list_empty_careful(&victim->deque))
+            continue;
+
+        spin_lock(&victim->lock);
+        work = list_first_entry_or_null(&victim->deque, struct kpool_work, node);
+        if (work)
+            list_del(&work->node);
+        spin_unlock(&victim->lock);
+
+        if (work)
+            return work;
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief This function will be executed by every worker thread.
+ *
+ * @param[in] data: The `struct kpool_worker` of this thread.
  * @return Return code.
  */
-int thread_function(void * thread_number) {
-    unsigned int i = 0;
-    int thread_num = *(int *)thread_number;
+static int kpool_thread(void *data) {
+    struct kpool_worker *w = data;
+    struct kpool_work *work;
 
     /* Working loop */
     while (!kthread_should_stop()) {
-        pr_info("kthread - Thread %d has executed. Iteration #%u\n", thread_num, i++);
-        msleep(thread_num * 1000);  // Millisecond sleep.
-    }
+        work = kpool_pop(w);
+        if (!work) {
+            work = kpool_steal(w);
+            if (work)
+                this_cpu_inc(kpool_counters.count[KPOOL_STOLEN]);
+        }
+
+        if (work) {
+            this_cpu_inc(kpool_counters.count[KPOOL_STARTED]);
+            this_cpu_add(kpool_counters.checksum, kpool_run(work));
+            this_cpu_inc(kpool_counters.count[KPOOL_COMPLETED]);
+            kpool_free_work(work);
+            continue;
+        }
 
-    pr_info("kthread - Thread %d finished execution!\n", thread_num);
+        // There is no work anywhere, so the pool may just have drained. Checking for `KPOOL_WAIT`
+        // callers here, once per idle period instead of after every work item, keeps the shared
+        // waitqueue off the hot path. Its barrier orders our completions before the check.
+        if (wq_has_sleeper(&kpool_done_wq))
+            wake_up_all(&kpool_done_wq);
+
+        // Tell submitters that we're idle and sleep until one of them wakes us up. Setting the idle
+        // bit before `wait_event_interruptible()` checks the deques pairs with the barrier in
+        // `kpool_submit()`, so a wake-up can't get lost.
+        WRITE_ONCE(w->idle, true);
+        cpumask_set_cpu(w->cpu, &kpool_idle);
+        wait_event_interruptible(w->wq, kpool_has_work() || kthread_should_stop());
+        cpumask_clear_cpu(w->cpu, &kpool_idle);
+        WRITE_ONCE(w->idle, false);
+    }
 
     return 0;  // Indicate the function has executed correctly.
 }
 
+/**
+ * @brief Queues `req->count` work items on the worker of the current CPU.
+ *
+ * @return Zero on success, a negative error code otherwise.
+ */
+static int kpool_submit(const struct kpool_submit *req) {
+    struct kpool_worker *w, *helper;
+    struct kpool_work *work, *tmp;
+    LIST_HEAD(batch);
+    unsigned int cpu;
+    u32 i;
+
+    if (req->op != KPOOL_OP_SPIN || req->count == 0 || req->count > KPOOL_MAX_BATCH)
+        return -EINVAL;
+
+    // Prefer the worker of the CPU we're running on. If this CPU has no worker (the `cpus` parameter
+    // left it out, or it came online after the module was loaded), take a worker on the same node.
+    cpu = raw_smp_processor_id();
+    if (!cpumask_test_cpu(cpu, &kpool_cpus)) {
+        cpu = cpumask_any_and(cpumask_of_node(cpu_to_node(cpu)), &kpool_cpus);
+        if (cpu >= nr_cpu_ids)
+            cpu = cpumask_first(&kpool_cpus);
+    }
+    w = per_cpu_ptr(&workers, cpu);
+
+    // Allocate the whole batch before touching a deque, so we never queue half of it. The work items
+    // live on the worker's node, where they will be read.
+    for (i = 0; i < req->count; i++) {
+        work = kpool_alloc_work(cpu_to_node(cpu));
+        if (!work)
+            goto err;
+        work->op = req->op;
+        work->arg = req->arg;
+        list_add_tail(&work->node, &batch);
+    }
+
+    // Counted before the work items become visible to the workers, see `kpool_inflight()`.
+    this_cpu_add(kpool_counters.count[KPOOL_SUBMITTED], req->count);
+
+    spin_lock(&w->lock);
+    list_splice_tail(&batch, &w->deque);
+    spin_unlock(&w->lock);
+
+    // Pairs with the idle bit that a worker sets before it looks at the deques and goes to sleep.
+    smp_mb();
+
+    if (READ_ONCE(w->idle))
+        wake_up(&w->wq);
+
+    // Wake up idle workers to steal the rest of the batch, but not more than there is work for.
+    i = req->count - 1;
+    for_each_cpu(cpu, &kpool_idle) {
+        if (i-- == 0)
+            break;
+        helper = per_cpu_ptr(&workers, cpu);
+        if (helper != w)
+            wake_up(&helper->wq);
+    }
+
+    return 0;
+
+err:
+    list_for_each_entry_safe(work, tmp, &batch, node)
+        kpool_free_work(work);
+    return -ENOMEM;
+}
+
+/**
+ * @brief Sums up the counters of all CPUs.
+ *
+ * @param[out] total: The sum of every counter.
+ * @return The sum of the checksums.
+ */
+static u64 kpool_sum_counters(u64 total[NR_KPOOL_COUNTERS]) {
+    struct kpool_counters *c;
+    u64 checksum = 0;
+    unsigned int cpu;
+    int i;
+
+    memset(total, 0, NR_KPOOL_COUNTERS * sizeof(u64));
+
+    // Submitters can run on any CPU, and a worker moves to another CPU if its own goes offline.
+    for_each_possible_cpu(cpu) {
+        c = per_cpu_ptr(&kpool_counters, cpu);
+        for (i = 0; i < NR_KPOOL_COUNTERS; i++)
+            total[i] += READ_ONCE(c->count[i]);
+        checksum += READ_ONCE(c->checksum);
+    }
+
+    return checksum;
+}
+
+/**
+ * @brief Sums up the statistics of all workers, for `KPOOL_STATS`.
+ * @details
+ * Unlike the snapshot, this walks every CPU, so the numbers are exact at the time of the call.
+ * The test program relies on that to see how many of its own work items were stolen.
+ */
+static void kpool_get_stats(struct kpool_stats *stats) {
+    u64 total[NR_KPOOL_COUNTERS];
+
+    memset(stats, 0, sizeof(*stats));
+    stats->checksum = kpool_sum_counters(total);
+    stats->submitted = total[KPOOL_SUBMITTED];
+    stats->completed = total[KPOOL_COMPLETED];
+    stats->stolen = total[KPOOL_STOLEN];
+    stats->nr_workers = cpumask_weight(&kpool_cpus);
+}
+
+/**
+ * @brief Takes a new snapshot: folds the per-CPU counters and updates the rates.
+ *
+ * @param[in,out] ewma: Moving averages of the rates, kept by the stats thread.
+ */
+static void kpool_stats_fold(struct ewma_kpool_rate *ewma) {
+    struct kpool_snapshot snap;
+    u64 now = ktime_get_ns();
+    int i;
+
+    kpool_sum_counters(snap.total);
+    snap.time_ns = now;
+    snap.interval_ns = now - kpool_snap.time_ns;
+
+    for (i = 0; i < NR_KPOOL_COUNTERS; i++) {
+        snap.delta[i] = snap.total[i] - kpool_snap.total[i];
+        snap.rate[i] = mul_u64_u64_div_u64(snap.delta[i], NSEC_PER_SEC, snap.interval_ns ?: 1);
+        ewma_kpool_rate_add(&ewma[i], snap.rate[i]);
+        snap.ewma[i] = ewma_kpool_rate_read(&ewma[i]);
+    }
+
+    // Taken in one pass over the CPUs, so they can be off by the work items that moved meanwhile.
+    snap.inflight = snap.total[KPOOL_SUBMITTED] - snap.total[KPOOL_COMPLETED];
+    snap.queued = snap.total[KPOOL_SUBMITTED] - snap.total[KPOOL_STARTED];
+    snap.idle = cpumask_weight(&kpool_idle);
+    snap.nr_workers = cpumask_weight(&kpool_cpus);
+
+    // Only this thread writes the snapshot, the lock just keeps the seqcount's writers honest.
+    spin_lock(&kpool_snap_lock);
+    write_seqcount_begin(&kpool_snap_seq);
+    kpool_snap = snap;
+    write_seqcount_end(&kpool_snap_seq);
+    spin_unlock(&kpool_snap_lock);
+}
+
+/**
+ * @brief The stats thread. Takes a snapshot every `stats_interval_ms`.
+ * @details
+ * Folding walks every CPU, so it's done here, once per interval, instead of on every read of the
+ * sysfs file. However often monitoring reads the file, a read is a copy of one struct.
+ */
+static int kpool_stats_thread(void *unused) {
+    struct ewma_kpool_rate ewma[NR_KPOOL_COUNTERS];
+    int i;
+
+    for (i = 0; i < NR_KPOOL_COUNTERS; i++)
+        ewma_kpool_rate_init(&ewma[i]);
+
+    for (;;) {
+        // Sleep without adding to the load average. Setting the state before checking
+        // `kthread_should_stop()` makes sure that the wake-up of `kthread_stop()` isn't lost.
+        set_current_state(TASK_IDLE);
+        if (kthread_should_stop()) {
+            __set_current_state(TASK_RUNNING);
+            break;
+        }
+        schedule_timeout(msecs_to_jiffies(max(READ_ONCE(stats_interval_ms), 10U)));
+
+        kpool_stats_fold(ewma);
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Prints the latest snapshot into /sys/module/kthread/stats/snapshot.
+ */
+static ssize_t snapshot_show(struct kobject *kobj, struct kobj_attribute *attr, char *buf) {
+    struct kpool_snapshot snap;
+    unsigned int seq;
+    int len, i;
+
+    do {
+        seq = read_seqcount_begin(&kpool_snap_seq);
+        snap = kpool_snap;
+    } while (read_seqcount_retry(&kpool_snap_seq, seq));
+
+    len = sysfs_emit(buf, "age_ms: %llu\ninterval_ms: %llu\n",
+                     div_u64(ktime_get_ns() - snap.time_ns, NSEC_PER_MSEC),
+                     div_u64(snap.interval_ns, NSEC_PER_MSEC));
+    len += sysfs_emit_at(buf, len, "%-10s %14s %10s %10s %10s\n", "counter", "total", "delta", "rate/s", "ewma/s");
+    for (i = 0; i < NR_KPOOL_COUNTERS; i++)
+        len += sysfs_emit_at(buf, len, "%-10s %14llu %10llu %10llu %10lu\n", kpool_counter_names[i],
+                             snap.total[i], snap.delta[i], snap.rate[i], snap.ewma[i]);
+    len += sysfs_emit_at(buf, len, "inflight: %lld\nqueued: %lld\nidle_workers: %u/%u\n",
+                         snap.inflight, snap.queued, snap.idle, snap.nr_workers);
+
+    return len;
+}
+
+static struct kobj_attribute snapshot_attr = __ATTR_RO(snapshot);
+
+static struct attribute *stats_attrs[] = {
+    &snapshot_attr.attr,
+    NULL,
+};
+
+static const struct attribute_group stats_group = {
+    .name = "stats",
+    .attrs = stats_attrs,
+};
+
+/**
+ * @brief Starts the stats thread and creates the sysfs file.
+ *
+ * @return Zero on success, a negative error code otherwise.
+ */
+static int kpool_stats_start(void) {
+    struct task_struct *task;
+    int ret;
+
+    // The first snapshot is the baseline for the deltas of the stats thread.
+    kpool_sum_counters(kpool_snap.total);
+    kpool_snap.time_ns = ktime_get_ns();
+
+    task = kthread_create(kpool_stats_thread, NULL, "kpool/stats");
+    if (IS_ERR(task))
+        return PTR_ERR(task);
+
+    // Monitoring isn't urgent, the workers come first.
+    set_user_nice(task, MAX_NICE);
+    kpool_stats_task = task;
+    wake_up_process(task);
+
+    ret = cdev_stats_register(&stats_group);
+    if (ret) {
+        kthread_stop(task);
+        return ret;
+    }
+
+    return 0;
+}
+
+static void kpool_stats_stop(void) {
+    cdev_stats_unregister(&stats_group);
+    kthread_stop(kpool_stats_task);
+}
+
+/**
+ * @brief The `unlocked_ioctl()` callback function.
+ *
+ * @param[in] file: Our device file.
+ * @param[in] cmd: The command.
+ * @param[in] arg: Pointer to the argument of the command in user space.
+ * @return Zero on success, a negative error code otherwise.
+ */
+static long int my_ioctl(struct file *file, unsigned cmd, unsigned long arg) {
+    struct kpool_submit req;
+    struct kpool_stats stats;
+
+    switch (cmd) {
+        case KPOOL_SUBMIT:
+            if (copy_from_user(&req, (struct kpool_submit __user *)arg, sizeof(req)))
+                return -EFAULT;
+            return kpool_submit(&req);
+
+        case KPOOL_STATS:
+            kpool_get_stats(&stats);
+            if (copy_to_user((struct kpool_stats __user *)arg, &stats, sizeof(stats)))
+                return -EFAULT;
+            return 0;
+
+        case KPOOL_WAIT:
+            return wait_event_interruptible(kpool_done_wq, kpool_inflight() == 0);
+
+        default:
+            return -ENOTTY;
+    }
+}
+
+static struct file_operations fops = {
+    // Set file operations function pointers to our own functions.
+    .owner = THIS_MODULE,
+    .unlocked_ioctl = my_ioctl,
+};
+
+/**
+ * @brief Stops all worker threads and frees the work that they didn't get to.
+ */
+static void kpool_stop(void) {
+    struct kpool_worker *w;
+    struct kpool_work *work, *tmp;
+    unsigned int cpu;
+
+    for_each_cpu(cpu, &kpool_cpus) {
+        w = per_cpu_ptr(&workers, cpu);
+        kthread_stop(w->task);
+
+        list_for_each_entry_safe(work, tmp, &w->deque, node)
+            kpool_free_work(work);
+    }
+}
+
+/**
+ * @brief Destroys the mempools and the slab cache. All work items must have been freed.
+ */
+static void kpool_destroy_pools(void) {
+    int nid;
+
+    if (kpool_work_pools) {
+        for_each_node(nid)
+            mempool_destroy(kpool_work_pools[nid]);  // Accepts NULL.
+        kfree(kpool_work_pools);
+    }
+
+    kmem_cache_destroy(kpool_work_cache);
+}
+
+/**
+ * @brief Creates the slab cache, and a mempool for every node that has a worker.
+ *
+ * @return Zero on success, -ENOMEM otherwise.
+ */
+static int kpool_create_pools(void) {
+    unsigned int cpu;
+    int nid;
+
+    kpool_work_cache = kmem_cache_create("kpool_work", sizeof(struct kpool_work), 0, 0, NULL);
+    if (!kpool_work_cache)
+        return -ENOMEM;
+
+    kpool_work_pools = kcalloc(nr_node_ids, sizeof(*kpool_work_pools), GFP_KERNEL);
+    if (!kpool_work_pools)
+        goto err;
+
+    for_each_cpu(cpu, &kpool_cpus) {
+        nid = cpu_to_node(cpu);
+        if (kpool_work_pools[nid])
+            continue;
+
+        // The reserve lives on the node, too. The pool remembers its node in `pool_data`.
+        kpool_work_pools[nid] = mempool_create_node(reserve, kpool_pool_alloc, kpool_pool_free,
+                                                    (void *)(long)nid, GFP_KERNEL, nid);
+        if (!kpool_work_pools[nid])
+            goto err;
+    }
+
+    return 0;
+
+err:
+    kpool_destroy_pools();
+    return -ENOMEM;
+}
+
 /**
  * @brief Callback function for when the module is loaded into the kernel.
- * 
+ *
  * @return Zero if the loading of the module was successful.
  */
 static int __init my_init(void) {
+    struct kpool_worker *w;
+    cpumask_var_t allowed;
+    unsigned int cpu;
+    int ret = 0;
+
+    if (!zalloc_cpumask_var(&allowed, GFP_KERNEL))
+        return -ENOMEM;
+
+    // Keep the workers off the CPUs that aren't in `cpus`, e.g. cores that are isolated for other
+    // latency-sensitive work.
+    if (cpus && cpulist_parse(cpus, allowed)) {
+        pr_err("kthread - Invalid CPU list \"%s\"\n", cpus);
+        ret = -EINVAL;
+        goto out;
+    }
+    if (!cpus)
+        cpumask_copy(allowed, cpu_online_mask);
+
     // We will start to create and initialize the threads now.
     pr_info("kthread - Init threads\n");
 
-    // Create "kthread_1" via `kthread_create()`:
-    //   • 1st arg: the function that the thread should execute.
-    //   • 2nd arg: pointer to the data that we will pass into the function that will be executed.
-    //   • 3rd arg: string that will identify this thread.
-    kthread_1 = kthread_create(thread_function, &t1_data, "kthread_1");
+    for_each_cpu_and(cpu, allowed, cpu_online_mask) {
+        w = per_cpu_ptr(&workers, cpu);
+        w->cpu = cpu;
+        spin_lock_init(&w->lock);
+        INIT_LIST_HEAD(&w->deque);
+        init_waitqueue_head(&w->wq);
+
+        // Create the worker via `kthread_create_on_node()` and bind it to its CPU with `kthread_bind()`.
+        // This is what `kthread_create_on_cpu()` does, but that one isn't exported to modules on
+        // every kernel. The thread is created on the CPU's node, so its stack is node-local, too.
+        //   • 1st arg: the function that the thread should execute.
+        //   • 2nd arg: pointer to the data that we will pass into the function that will be executed.
+        //   • 3rd arg: NUMA node to allocate the thread's memory on.
+        //   • 4th arg: format string for the name of the thread.
+        w->task = kthread_create_on_node(kpool_thread, w, cpu_to_node(cpu), "kpool/%u", cpu);
 
-    // Check if "kthread_1" failed to be created.
-    if (kthread_1 == NULL) {
-        pr_err("kthread - Thread 1 could not be created!\n");
-        return -1;
+        // Check if the worker failed to be created.
+        if (IS_ERR(w->task)) {
+            pr_err("kthread - Worker for CPU %u could not be created!\n", cpu);
+            kpool_stop();
+            ret = PTR_ERR(w->task);
+            goto out;
+        }
+
+        kthread_bind(w->task, cpu);
+        cpumask_set_cpu(cpu, &kpool_cpus);
+
+        // Start the worker.
+        wake_up_process(w->task);
     }
 
-    // Start "kthread_1."
-    wake_up_process(kthread_1);
-    pr_info("kthread - Thread 1 was created and is now running.\n");
+    if (cpumask_empty(&kpool_cpus)) {
+        pr_err("kthread - None of the CPUs in \"%s\" is online\n", cpus);
+        ret = -EINVAL;
+        goto out;
+    }
 
-    // Create and run "kthread_2." `kthread_run()` will create a thread and run it.
-    kthread_2 = kthread_run(thread_function, &t2_data, "kthread_2");
+    // The workers are idle until the device exists, nothing allocates work items before this.
+    ret = kpool_create_pools();
+    if (ret) {
+        kpool_stop();
+        goto out;
+    }
 
-    // Check if "kthread_2" failed to be created.
-    if (kthread_2 == NULL) {
-        pr_err("kthread - Thread 2 could not be created!\n");
-        kthread_stop(kthread_1);  // Let's stop "kthread_1" if "kthread_2" failed.
-        return -1;  // We can't continue. Indicate that we failed.
+    ret = kpool_stats_start();
+    if (ret) {
+        pr_err("kthread - Could not start the stats thread\n");
+        kpool_stop();
+        kpool_destroy_pools();
+        goto out;
     }
-    else  // Thread 2 has successfully been created and started.
-        pr_info("kthread - Thread 2 was created and is now running.\n");
 
-    pr_info("kthread - Both threads are now running!\n");
+    // Register the character device for the `ioctl()` interface.
+    major_dev_num = register_chrdev(0, "kthread_pool", &fops);
 
-    return 0;
+    // Check for error while registering the character device.
+    if (major_dev_num < 0) {
+        pr_err("kthread - Error registering character device\n");
+        kpool_stats_stop();
+        kpool_stop();
+        kpool_destroy_pools();
+        ret = major_dev_num;
+        goto out;
+    }
+
+    pr_info("kthread - %u workers are now running on CPUs %*pbl! Major device number: %d\n",
+            cpumask_weight(&kpool_cpus), cpumask_pr_args(&kpool_cpus), major_dev_num);
+
+out:
+    free_cpumask_var(allowed);
+    return ret;
 }
 
 /**
@@ -84,10 +788,13 @@ static int __init my_init(void) {
  *   • Makes this function only available within this kernel module.
  */
 static void __exit my_exit(void) {
-    // Stop both threads.
-    pr_info("kthread - Stopping both threads...\n");
-    kthread_stop(kthread_1);
-    kthread_stop(kthread_2);
+    unregister_chrdev(major_dev_num, "kthread_pool");
+    kpool_stats_stop();
+
+    // Stop all workers.
+    pr_info("kthread - Stopping all workers...\n");
+    kpool_stop();
+    kpool_destroy_pools();
 }
 
 // Specify the function to use when the module is loaded into the kernel.
@@ -0,0 +1,41 @@
+#ifndef KTHREAD_POOL_H
+#define KTHREAD_POOL_H
+
+// This header is shared by the kernel module and the user space programs, so only use the
+// fixed-size types from <linux/types.h>.
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+// Operations that a work item can perform.
+#define KPOOL_OP_SPIN 0  // Run `arg` rounds of a xorshift generator. Pure CPU work.
+
+#define KPOOL_MAX_BATCH 4096  // Maximum `count` of a single `KPOOL_SUBMIT`.
+
+/**
+ * @brief Argument of `KPOOL_SUBMIT`. Queues `count` identical work items.
+ */
+struct kpool_submit {
+    __u32 op;  // One of the `KPOOL_OP_*` operations.
+    __u32 count;  // Number of work items to queue, at most `KPOOL_MAX_BATCH`.
+    __u64 arg;  // Argument of the operation.
+};
+
+/**
+ * @brief Argument of `KPOOL_STATS`. Totals over all workers since the module was loaded.
+ */
+struct kpool_stats {
+    __u64 submitted;  // Work items that were queued.
+    __u64 completed;  // Work items that finished.
+    __u64 stolen;  // Work items that ran on another worker than the one they were queued to.
+    __u64 checksum;  // Sum of all results, so the work can't be optimized away.
+    __u32 nr_workers;  // Number of worker threads.
+    __u32 pad;
+};
+
+// First arg is the magic number of this driver, 2nd arg is the command number, 3rd arg is the type
+// of argument we are passing.
+#define KPOOL_SUBMIT _IOW('k', 1, struct kpool_submit)
+#define KPOOL_STATS _IOR('k', 2, struct kpool_stats)
+#define KPOOL_WAIT _IO('k', 3)  // Sleeps until every submitted work item has completed.
+
+#endif  // #ifndef KTHREAD_POOL_H
@@ -0,0 +1,99 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>  // For open and close.
+#include <fcntl.h>  // For the flags being associated with our character device.
+#include <time.h>
+#include <sys/ioctl.h>
+
+#include "kthread_pool.h"
+
+#define SNAPSHOT_FILE "/sys/module/kthread/stats/snapshot"
+
+// Submits CPU-heavy work items to the worker pool, waits for all of them and reports how fast the
+// pool got through them. Last, it prints the latest snapshot of the stats thread.
+//
+// Usage: test <device> [number of work items] [rounds per work item]
+
+/**
+ * @brief Returns the current time of the monotonic clock in seconds.
+ */
+static double now_in_secs(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// This is a user space program.
+int main(int argc, char **argv) {
+    struct kpool_submit req = { .op = KPOOL_OP_SPIN };
+    struct kpool_stats before, after;
+    unsigned long items, left;
+    double start, secs;
+    char buf[4096];
+    ssize_t n;
+    int fd;  // File descriptor.
+
+    // The first argument to this program is the file that should be opened.
+    if (argc < 2) {
+        // We can't do anything if no file was passed as an argument.
+        printf("I need the file to open as an argument!\n");
+        return 0;
+    }
+    items = argc > 2 ? strtoul(argv[2], NULL, 0) : 100000;
+    req.arg = argc > 3 ? strtoull(argv[3], NULL, 0) : 100000;
+
+    fd = open(argv[1], O_RDWR);
+
+    // Check if we couldn't open the file.
+    if (fd < 0) {
+        perror("Error opening file.");
+        return fd;
+    }
+
+    if (ioctl(fd, KPOOL_STATS, &before) < 0) {
+        perror("KPOOL_STATS failed");
+        return 1;
+    }
+
+    start = now_in_secs();
+
+    // Submit the work in batches, every batch goes to the worker of the CPU we're running on.
+    for (left = items; left > 0; left -= req.count) {
+        req.count = left < KPOOL_MAX_BATCH ? left : KPOOL_MAX_BATCH;
+        if (ioctl(fd, KPOOL_SUBMIT, &req) < 0) {
+            perror("KPOOL_SUBMIT failed");
+            return 1;
+        }
+    }
+
+    // Sleep until the pool has finished all work items.
+    if (ioctl(fd, KPOOL_WAIT) < 0) {
+        perror("KPOOL_WAIT failed");
+        return 1;
+    }
+
+    secs = now_in_secs() - start;
+    ioctl(fd, KPOOL_STATS, &after);
+
+    printf("%u workers finished %lu items of %llu rounds in %.3f s = %.0f items/s\n",
+           after.nr_workers, items, (unsigned long long)req.arg, secs, items / secs);
+    printf("%llu items (%.1f%%) were stolen by idle workers\n",
+           (unsigned long long)(after.stolen - before.stolen),
+           100.0 * (after.stolen - before.stolen) / items);
+
+    close(fd);  // Close the file.
+
+    // The snapshot is up to `stats_interval_ms` old, so it may not have all of our work items yet.
+    fd = open(SNAPSHOT_FILE, O_RDONLY);
+    if (fd < 0) {
+        perror("Error opening " SNAPSHOT_FILE);
+        return 1;
+    }
+    printf("\n");
+    while ((n = read(fd, buf, sizeof(buf))) > 0)
+        fwrite(buf, 1, n, stdout);
+    close(fd);
+
+    return 0;
+}
@@ -0,0 +1,137 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>  // For open, close and write.
+#include <fcntl.h>  // For the flags being associated with our character device.
+#include <time.h>
+
+// Writes to the device at a fixed rate, for the wake-up benchmark of the driver. Load the module
+// with `bench_mode` set to the wake-up primitive that should be measured, e.g.
+//   insmod waitqueue.ko bench_mode=3
+// and/or with wake-up coalescing, e.g.
+//   insmod waitqueue.ko coalesce_usecs=100 coalesce_frames=32
+// This program clears the latency histogram and the coalescing stats, hammers the device and prints
+// both at the end. Run it as root, they are in debugfs.
+//
+// Usage: hammer <device> [writes per second, 0 = as fast as possible] [seconds]
+
+#define LATENCY_FILE "/sys/kernel/debug/waitqueue/wake_latency"
+#define COALESCE_FILE "/sys/kernel/debug/waitqueue/coalesce"
+
+/**
+ * @brief Adds `ns` nanoseconds to `ts`.
+ */
+static void ts_add(struct timespec *ts, long ns) {
+    ts->tv_nsec += ns;
+    while (ts->tv_nsec >= 1000000000) {
+        ts->tv_nsec -= 1000000000;
+        ts->tv_sec++;
+    }
+}
+
+/**
+ * @brief Clears a debugfs file of the driver.
+ *
+ * @return Zero on success, -1 if the file doesn't exist.
+ */
+static int clear_file(const char *path) {
+    FILE *f = fopen(path, "w");
+
+    if (!f)
+        return -1;
+    fputs("0\n", f);
+    fclose(f);
+    return 0;
+}
+
+/**
+ * @brief Copies a debugfs file of the driver to stdout.
+ */
+static void print_file(const char *path) {
+    char buf[4096];
+    ssize_t n;
+    int fd = open(path, O_RDONLY);
+
+    if (fd < 0) {
+        perror(path);
+        return;
+    }
+    while ((n = read(fd, buf, sizeof(buf))) > 0)
+        fwrite(buf, 1, n, stdout);
+    close(fd);
+}
+
+// This is a user space program.
+int main(int argc, char **argv) {
+    struct timespec next, start, end;
+    unsigned long rate, writes = 0, total;
+    char buf[4096];
+    double secs;
+    int seconds, fd, len, bench;
+
+    // The first argument to this program is the file that should be opened.
+    if (argc < 2) {
+        // We can't do anything if no file was passed as an argument.
+        printf("I need the file to open as an argument!\n");
+        return 0;
+    }
+    rate = argc > 2 ? strtoul(argv[2], NULL, 0) : 1000;
+    seconds = argc > 3 ? atoi(argv[3]) : 5;
+
+    fd = open(argv[1], O_WRONLY);
+
+    // Check if we couldn't open the file.
+    if (fd < 0) {
+        perror("Error opening file.");
+        return fd;
+    }
+
+    // Start with empty stats. The latency histogram only exists if `bench_mode` is set.
+    if (clear_file(COALESCE_FILE)) {
+        perror("Error opening " COALESCE_FILE " (is debugfs mounted?)");
+        return 1;
+    }
+    bench = clear_file(LATENCY_FILE) == 0;
+
+    total = rate * seconds;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    next = start;
+
+    for (;;) {
+        // Values that no watcher waits for, so only the benchmark thread wakes up.
+        len = snprintf(buf, sizeof(buf), "%lu", 1000 + writes % 1000);
+        if (write(fd, buf, len) != len) {
+            perror("Error writing to device.");
+            return 1;
+        }
+        writes++;
+
+        if (rate) {
+            if (writes >= total)
+                break;
+
+            // Sleep until an absolute deadline, so the time spent writing doesn't lower the rate.
+            ts_add(&next, 1000000000L / rate);
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+        } else if (writes % 1024 == 0) {
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            if (end.tv_sec - start.tv_sec >= seconds)
+                break;
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    secs = end.tv_sec - start.tv_sec + (end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("%lu writes in %.2f s = %.0f writes/s\n\n", writes, secs, writes / secs);
+
+    close(fd);  // Close the file.
+
+    // Print the histogram of the benchmark thread and how many wake-ups of the readers were saved.
+    if (bench) {
+        print_file(LATENCY_FILE);
+        printf("\n");
+    }
+    printf("Wake-up coalescing of the readers:\n");
+    print_file(COALESCE_FILE);
+
+    return 0;
+}
@@ -0,0 +1,167 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>  // For open, close and write.
+#include <fcntl.h>  // For the flags being associated with our character device.
+#include <time.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sys/ioctl.h>
+
+#include "waitqueue.h"
+
+// Measures how long a write takes to wake up a matching subscriber while more and more
+// subscriptions that don't match are pending. The driver keeps subscriptions in sorted trees, so
+// the latency should stay flat as the number of subscriptions grows.
+//
+// Every round, the main thread subscribes the waiter thread's file to one value, then writes
+// that value. The waiter sleeps in `WAITQUEUE_WAIT` and computes the latency from the write
+// timestamp in the event it gets back.
+//
+// Usage: subbench <device> [most subscriptions] [rounds]
+// One open file can hold `max_subs` subscriptions (a module parameter, 131072 by default).
+
+#define NEVER_BASE 1000000000000LL  // The values of the background subscriptions are never written.
+
+static int waiter_fd;
+static int rounds;
+static sem_t done;  // Posted by the waiter after every wake up.
+static double *wake_us;  // Wake-up latency of every round.
+
+/**
+ * @brief Returns the current time of the monotonic clock in nanoseconds. Same clock as
+ *     `ktime_get_ns()` in the kernel.
+ */
+static unsigned long long now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/**
+ * @brief Body of the waiter thread.
+ */
+static void *waiter_main(void *arg) {
+    struct waitqueue_event ev;
+    int i;
+
+    (void)arg;
+    for (i = 0; i < rounds; i++) {
+        if (ioctl(waiter_fd, WAITQUEUE_WAIT, &ev) < 0) {
+            perror("WAITQUEUE_WAIT failed");
+            exit(1);
+        }
+        wake_us[i] = (now_ns() - ev.state.time_ns) / 1e3;
+        sem_post(&done);
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Adds subscriptions to `fd` until it holds `count` of them. Half of them are `==` and half
+ *     `>=` to values that are never written.
+ */
+static int add_background(int fd, long from, long count) {
+    struct waitqueue_sub sub = { 0 };
+    long i;
+
+    for (i = from; i < count; i++) {
+        sub.op = i & 1 ? WAITQUEUE_OP_GE : WAITQUEUE_OP_EQ;
+        sub.value = NEVER_BASE + i;
+        if (ioctl(fd, WAITQUEUE_SUBSCRIBE, &sub) < 0) {
+            perror("WAITQUEUE_SUBSCRIBE failed");
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+// This is a user space program.
+int main(int argc, char **argv) {
+    struct waitqueue_sub sub = { .op = WAITQUEUE_OP_EQ };
+    unsigned long long start, write_ns;
+    long max_subs, nr_subs = 0, step;
+    char buf[32];
+    pthread_t waiter;
+    int bg_fd, i, len;
+
+    // The first argument to this program is the file that should be opened.
+    if (argc < 2) {
+        // We can't do anything if no file was passed as an argument.
+        printf("I need the file to open as an argument!\n");
+        return 0;
+    }
+    max_subs = argc > 2 ? atol(argv[2]) : 100000;
+    rounds = argc > 3 ? atoi(argv[3]) : 1000;
+
+    bg_fd = open(argv[1], O_RDWR);
+    waiter_fd = open(argv[1], O_RDWR);
+
+    // Check if we couldn't open the file.
+    if (bg_fd < 0 || waiter_fd < 0) {
+        perror("Error opening file.");
+        return 1;
+    }
+
+    wake_us = calloc(rounds, sizeof(*wake_us));
+    sem_init(&done, 0, 0);
+
+    printf("%10s %14s %14s %14s\n", "subs", "write us", "wake p50 us", "wake p99 us");
+
+    for (step = 1; ; step *= 10) {
+        // 1, 10, 100, ... background subscriptions, and `max_subs` last.
+        if (step > max_subs)
+            step = max_subs;
+        if (add_background(bg_fd, nr_subs, step) < 0)
+            return 1;
+        nr_subs = step;
+
+        pthread_create(&waiter, NULL, waiter_main, NULL);
+
+        write_ns = 0;
+        for (i = 0; i < rounds; i++) {
+            sub.value = i;
+            sub.cookie = i;
+            if (ioctl(waiter_fd, WAITQUEUE_SUBSCRIBE, &sub) < 0) {
+                perror("WAITQUEUE_SUBSCRIBE failed");
+                return 1;
+            }
+
+            // Give the waiter time to go back to sleep, we want to measure a real wake up.
+            usleep(50);
+
+            len = snprintf(buf, sizeof(buf), "%d", i);
+            start = now_ns();
+            if (write(bg_fd, buf, len) != len) {
+                perror("Error writing to device.");
+                return 1;
+            }
+            write_ns += now_ns() - start;
+
+            sem_wait(&done);
+        }
+
+        pthread_join(waiter, NULL);
+
+        qsort(wake_us, rounds, sizeof(*wake_us), cmp_double);
+        printf("%10ld %14.2f %14.2f %14.2f\n", nr_subs, write_ns / 1e3 / rounds,
+               wake_us[rounds / 2], wake_us[rounds * 99 / 100]);
+
+        if (nr_subs >= max_subs)
+            break;
+    }
+
+    close(waiter_fd);
+    close(bg_fd);  // Close the files. This drops all subscriptions.
+
+    return 0;
+}
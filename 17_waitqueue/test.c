@@ -0,0 +1,92 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>  // For open, close and read.
+#include <fcntl.h>  // For the flags being associated with our character device.
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+
+#include "waitqueue.h"
+
+// Opens the device many times and waits for new values of `watch_var` on all files with a single
+// epoll instance and a single thread. For every new value, it also prints the full state, which
+// says who wrote it and when. Write to the device from another shell to wake it up:
+//   echo 11 > /dev/waitqueue
+//
+// Usage: test <device> [number of files]
+
+#define MAX_EVENTS 64
+
+// This is a user space program.
+int main(int argc, char **argv) {
+    struct epoll_event ev, events[MAX_EVENTS];
+    struct waitqueue_state state;
+    char buf[32];
+    int nfds, epfd, ready, i, fd;
+    ssize_t len;
+
+    // The first argument to this program is the file that should be opened.
+    if (argc < 2) {
+        // We can't do anything if no file was passed as an argument.
+        printf("I need the file to open as an argument!\n");
+        return 0;
+    }
+    nfds = argc > 2 ? atoi(argv[2]) : 1000;
+
+    epfd = epoll_create1(0);
+    if (epfd < 0) {
+        perror("Error creating epoll instance.");
+        return 1;
+    }
+
+    for (i = 0; i < nfds; i++) {
+        // `O_NONBLOCK`: `read()` returns `EAGAIN` instead of sleeping when there is no new value.
+        fd = open(argv[1], O_RDONLY | O_NONBLOCK);
+
+        // Check if we couldn't open the file.
+        if (fd < 0) {
+            perror("Error opening file.");
+            return fd;
+        }
+
+        ev.events = EPOLLIN;
+        ev.data.fd = fd;
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            perror("Error adding file to epoll.");
+            return 1;
+        }
+    }
+
+    printf("Waiting for new values on %d files...\n", nfds);
+
+    for (;;) {
+        ready = epoll_wait(epfd, events, MAX_EVENTS, -1);
+        if (ready < 0) {
+            perror("Error waiting for events.");
+            return 1;
+        }
+
+        for (i = 0; i < ready; i++) {
+            len = read(events[i].data.fd, buf, sizeof(buf) - 1);
+
+            // Another event loop iteration may have consumed the value already.
+            if (len < 0 && errno == EAGAIN)
+                continue;
+            if (len < 0) {
+                perror("Error reading from device.");
+                return 1;
+            }
+
+            buf[len] = '\0';
+            printf("fd %d: watch_var = %s", events[i].data.fd, buf);
+
+            // Only print the state once per batch of events, every file sees the same one.
+            if (i == 0 && ioctl(events[i].data.fd, WAITQUEUE_GET_STATE, &state) == 0)
+                printf("state: value %lld, version %llu, written by pid %u at %llu ns\n",
+                       (long long)state.value, (unsigned long long)state.seq, state.pid,
+                       (unsigned long long)state.time_ns);
+        }
+    }
+
+    return 0;
+}
@@ -4,119 +4,1202 @@
 #include <linux/init.h>
 #include <linux/kthread.h>  // Provides all the functions needed for thread handling.
 #include <linux/sched.h>  // Scheduler.
-#include <linux/delay.h>  // We'll use some delay functions in our threads.
 #include <linux/wait.h>
 #include <linux/jiffies.h>  // Allows us to do a wait with a timeout.
+#include <linux/uio.h>  // For `struct iov_iter`, `copy_to_iter()` and `copy_from_iter()`.
+#include <linux/poll.h>  // For `poll_wait()`.
+#include <linux/slab.h>  // For `kzalloc()`, `kfree()` and `kmem_cache_create()`.
+#include <linux/seqlock.h>
+#include <linux/rbtree.h>
+#include <linux/list.h>
+#include <linux/timekeeping.h>  // For `ktime_get_ns()`.
+#include <linux/swait.h>
+#include <linux/completion.h>
+#include <linux/atomic.h>
+#include <linux/debugfs.h>
+#include <linux/hrtimer.h>
+#include <linux/overflow.h>  // For `check_mul_overflow()`.
+#include <linux/cpumask.h>
+#include <linux/topology.h>  // For `cpu_to_node()` and `cpumask_of_node()`.
+#include <linux/numa.h>  // For `NUMA_NO_NODE`.
+#include <linux/seq_file.h>
+
+#include <cdev_stats.h>
+#include <lat_hist.h>
+#include "waitqueue.h"
+
+// Defines the tracepoints. Exactly one source file of a module has to do this.
+#define CREATE_TRACE_POINTS
+#include "waitqueue_trace.h"
 
 /* Global variables */
 #define MAJOR_DEV_NUM 64  // Major device number that will be allocated by our kernel module.
-static struct task_struct *kthread_1;
-static struct task_struct *kthread_2;
-static int t1_data = 1, t2_data = 2;  // Data to be passed to the threads' functions.
-static long int watch_var = 0;  // Used to monitor with the waitqueues.
-DECLARE_WAIT_QUEUE_HEAD(wq1);  // Static declaration of a waitqueue (will already be initialized).
-static wait_queue_head_t wq2;  // Dynamic declaration of a waitqueue.
+#define MAX_WATCHERS 16  // Most watcher threads that can be started with the `watchers` parameter.
+
+// Every watcher thread waits for values that match one predicate, e.g. "==11" or ">=100".
+static char *watchers[MAX_WATCHERS] = { "==11", "==22" };
+static int nr_watchers = 2;
+module_param_array(watchers, charp, &nr_watchers, 0444);
+MODULE_PARM_DESC(watchers, "Predicates of the watcher threads, \"==X\" or \">=X\", comma separated (default: ==11,==22)");
+
+// Where the watcher threads run. By default, the scheduler puts them anywhere. Every thread can get
+// its own CPUs and NUMA node, e.g. to keep a latency-sensitive one on an isolated core. The thread's
+// own data is allocated on its node.
+static char *watcher_cpus[MAX_WATCHERS];
+module_param_array(watcher_cpus, charp, NULL, 0444);
+MODULE_PARM_DESC(watcher_cpus, "CPUs of every watcher thread, comma separated. One CPU list per thread, without commas, e.g. 2-3,4 (default: any)");
+
+static int watcher_nodes[MAX_WATCHERS] = { [0 ... MAX_WATCHERS - 1] = NUMA_NO_NODE };
+module_param_array(watcher_nodes, int, NULL, 0444);
+MODULE_PARM_DESC(watcher_nodes, "NUMA node of every watcher thread, comma separated. Without CPUs, the thread runs on all CPUs of the node (default: -1, the node of the CPUs)");
+
+static unsigned int max_subs = 131072;
+module_param(max_subs, uint, 0644);
+MODULE_PARM_DESC(max_subs, "Most subscriptions that one open file can hold (default: 131072)");
+
+// Wake-up latency benchmark. A thread waits for every write with the primitive that is selected
+// here, and records the time from the write until it runs in a histogram.
+enum bench_modes {
+    BENCH_OFF,
+    BENCH_WAKE_UP,  // `wait_event_idle()` and `wake_up()`.
+    BENCH_WAKE_UP_INTERRUPTIBLE,  // `wait_event_interruptible()` and `wake_up_interruptible()`.
+    BENCH_SWAIT,  // `swait_event_idle_exclusive()` and `swake_up_one()`.
+    BENCH_COMPLETION,  // `wait_for_completion_interruptible()` and `complete()`.
+    NR_BENCH_MODES,
+};
+
+static const char * const bench_mode_names[NR_BENCH_MODES] = {
+    "off", "wake_up", "wake_up_interruptible", "swait", "completion",
+};
+
+static unsigned int bench_mode;
+module_param(bench_mode, uint, 0444);
+MODULE_PARM_DESC(bench_mode, "Wake-up benchmark: 0 = off, 1 = wake_up, 2 = wake_up_interruptible, 3 = swait, 4 = completion");
+
+static char *bench_cpus;
+module_param(bench_cpus, charp, 0444);
+MODULE_PARM_DESC(bench_cpus, "CPUs of the benchmark thread, e.g. 3 (default: any)");
+
+static int bench_node = NUMA_NO_NODE;
+module_param(bench_node, int, 0444);
+MODULE_PARM_DESC(bench_node, "NUMA node of the benchmark thread (default: -1, the node of the CPUs)");
+
+// Wake-up coalescing, like the interrupt moderation of a network card (`ethtool -C`). Instead of
+// waking up the readers on every write, the first write of a batch arms a timer. The readers are
+// woken up when it expires or when `coalesce_frames` writes are pending, whichever comes first.
+// They still read the latest value, so fewer wake-ups cost latency, but nothing is lost.
+static unsigned int coalesce_usecs;
+module_param(coalesce_usecs, uint, 0644);
+MODULE_PARM_DESC(coalesce_usecs, "Longest time that waking up the readers is deferred, in microseconds (default: 0, wake them up on every write)");
+
+static unsigned int coalesce_frames = 64;
+module_param(coalesce_frames, uint, 0644);
+MODULE_PARM_DESC(coalesce_frames, "Wake up the readers once this many writes are pending (default: 64)");
+
+// With adaptive coalescing, the delay follows the write rate: it is just long enough to collect
+// `coalesce_frames` writes, and writes that come in slower than `coalesce_usecs` aren't deferred at all.
+static bool coalesce_adaptive = true;
+module_param(coalesce_adaptive, bool, 0644);
+MODULE_PARM_DESC(coalesce_adaptive, "Adapt the delay to the write rate (default: on)");
+
+static DEFINE_SPINLOCK(watch_lock);  // Serializes writers, and protects the subscriptions.
+
+// Used to monitor with the waitqueues. A seqcount lets readers take snapshots without any lock.
+// It's tied to `watch_lock`, which writers hold anyway, so it doesn't need a lock of its own.
+static struct waitqueue_state watch_state;
+static seqcount_spinlock_t watch_seq = SEQCNT_SPINLOCK_ZERO(watch_seq, &watch_lock);
+
+static struct rb_root_cached subs[2] = { RB_ROOT_CACHED, RB_ROOT_CACHED };  // Pending subscriptions, one tree per `WAITQUEUE_OP_*`.
+static DECLARE_WAIT_QUEUE_HEAD(read_wq);  // Static declaration of a waitqueue (will already be initialized).
+static struct watcher *watcher_list[MAX_WATCHERS];
+
+static struct task_struct *bench_task;  // The benchmark thread, NULL if `bench_mode` is off.
+static struct lat_hist *bench_hist;  // Only written by `bench_task`.
+static atomic64_t bench_stamp = ATOMIC64_INIT(0);  // Time of the oldest write the benchmark thread didn't see yet.
+static atomic64_t bench_coalesced = ATOMIC64_INIT(0);  // Writes that came in before the thread saw the previous one.
+static bool bench_stopping;
+static DECLARE_WAIT_QUEUE_HEAD(bench_wq);
+static DECLARE_SWAIT_QUEUE_HEAD(bench_swq);  // A simple waitqueue: no callbacks, no exclusive/non-exclusive mix.
+static DECLARE_COMPLETION(bench_done);
+static struct dentry *debugfs_dir;
+
+static struct hrtimer wake_timer;  // Wakes up the readers at the end of a coalesced batch.
+static atomic_t wake_pending = ATOMIC_INIT(0);  // Writes since the readers were woken up last.
+static atomic64_t wake_first = ATOMIC64_INIT(0);  // Time of the oldest of them.
+static u64 write_gap_ns;  // Moving average of the time between two writes. Written under `watch_lock`.
+
+// Wake-up coalescing stats, in /sys/kernel/debug/waitqueue/coalesce. The timer flushes from hard
+// interrupt context, so the lock disables interrupts.
+static DEFINE_SPINLOCK(coalesce_lock);
+static struct {
+    u64 writes;  // Writes that were coalesced, or at least could have been.
+    u64 wakeups;  // Times the readers were woken up for them.
+    u64 by_frames;  // ... because `coalesce_frames` writes were pending.
+    u64 by_timer;  // ... because the delay was over.
+    u64 immediate;  // ... at once, because the writes came in too slow to wait for the next one.
+    struct lat_hist delay;  // Time from the oldest write of a batch until its wake-up.
+} coalesce;
+
+// Subscriptions come from their own slab cache, see `user_subscribe()`.
+static struct kmem_cache *user_sub_cache;
+
+// Per-CPU counters, in /sys/module/waitqueue/stats/write.
+CDEV_STATS_DEFINE(write);
+
+static struct attribute *stats_attrs[] = {
+    &write_attr.attr,
+    NULL,
+};
+
+static const struct attribute_group stats_group = {
+    .name = "stats",
+    .attrs = stats_attrs,
+};
+
+/**
+ * @brief A one-shot subscription to the values that are written to the device.
+ * @details
+ * Pending subscriptions are kept in one red-black tree per predicate, sorted by `value`. A write of
+ * `v` then only has to visit the subscriptions that match:
+ *   • `==`: the run of nodes with `value == v`, found with one lookup.
+ *   • `>=`: the nodes from the leftmost one up to `v`.
+ * Both cost O(log n) plus the number of matches, no matter how many subscriptions don't match.
+ * A subscription that fired is taken out of its tree, so no write visits it twice.
+ */
+struct watch_sub {
+    struct rb_node node;  // Empty while the subscription isn't in a tree.
+    s64 value;
+    u32 op;  // `WAITQUEUE_OP_*`.
+
+    // Called with `watch_lock` held when the subscription fires, so it must not sleep.
+    void (*notify)(struct watch_sub *sub, const struct waitqueue_state *state);
+};
+
+/**
+ * @brief A subscription of a user space file.
+ */
+struct user_sub {
+    struct watch_sub sub;
+    struct list_head entry;  // In `subs` of the file while pending, in `fired` after it fired.
+    struct waitqueue_file *wf;
+    struct waitqueue_event event;  // Filled in when it fires.
+};
+
+/**
+ * @brief Per-open state, stored in `filp->private_data`.
+ */
+struct waitqueue_file {
+    u64 seen_seq;  // `seq` of the state this file last read.
+
+    // Protected by `watch_lock`.
+    struct list_head subs;  // Pending `struct user_sub`s.
+    struct list_head fired;  // Fired `struct user_sub`s, oldest first.
+    unsigned int nr_subs;  // Pending and fired ones.
+
+    wait_queue_head_t event_wq;  // `WAITQUEUE_WAIT` and `poll()` wait here for fired subscriptions.
+};
+
+/**
+ * @brief A kernel thread that waits for a predicate, see the `watchers` parameter.
+ */
+struct watcher {
+    struct watch_sub sub;
+    struct task_struct *task;
+    int id;
+    wait_queue_head_t wq;  // Dynamic declaration of a waitqueue.
+    bool fired;  // Protected by `watch_lock`.
+    struct waitqueue_state state;  // The state that made the subscription fire.
+};
+
+#define rb_to_sub(n) rb_entry((n), struct watch_sub, node)
+
+/**
+ * @brief Works out where a thread runs from its `*_cpus` and `*_nodes` parameters.
+ *
+ * @param[in] cpulist: The CPUs of the thread, or NULL for any CPU.
+ * @param[inout] node: The node of the thread, or `NUMA_NO_NODE`. If it's `NUMA_NO_NODE` and there
+ *     are CPUs, it's set to the node of the first CPU.
+ * @param[out] mask: The CPUs the thread may run on. Empty if it may run anywhere.
+ * @return Zero on success, -EINVAL if the parameters are invalid.
+ */
+static int thread_placement(const char *cpulist, int *node, struct cpumask *mask) {
+    cpumask_clear(mask);
+
+    if (*node != NUMA_NO_NODE && (*node < 0 || *node >= MAX_NUMNODES || !node_online(*node))) {
+        pr_err("waitqueue - Node %d is not an online NUMA node!\n", *node);
+        return -EINVAL;
+    }
+
+    if (cpulist) {
+        if (cpulist_parse(cpulist, mask) || !cpumask_intersects(mask, cpu_online_mask)) {
+            pr_err("waitqueue - Invalid CPU list \"%s\"!\n", cpulist);
+            return -EINVAL;
+        }
+
+        // The thread's data goes where the thread runs.
+        if (*node == NUMA_NO_NODE)
+            *node = cpu_to_node(cpumask_first_and(mask, cpu_online_mask));
+    } else if (*node != NUMA_NO_NODE) {
+        cpumask_copy(mask, cpumask_of_node(*node));
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Creates a kernel thread on `node`, restricts it to `mask` and starts it.
+ * @details
+ * `kthread_create_on_node()` allocates the thread's stack and `task_struct` on `node`.
+ * `set_cpus_allowed_ptr()` keeps the scheduler from moving the thread off `mask`.
+ *
+ * @param[in] mask: The CPUs the thread may run on. Empty if it may run anywhere.
+ * @return The thread, or an `ERR_PTR()`.
+ */
+static struct task_struct *thread_start(int (*fn)(void *data), void *data, int node,
+                                        const struct cpumask *mask, const char *name) {
+    struct task_struct *task;
+    int ret;
+
+    task = kthread_create_on_node(fn, data, node, "%s", name);
+    if (IS_ERR(task))
+        return task;
+
+    if (!cpumask_empty(mask)) {
+        ret = set_cpus_allowed_ptr(task, mask);
+        if (ret) {
+            // The thread was never woken up, so `kthread_stop()` ends it without running `fn`.
+            kthread_stop(task);
+            return ERR_PTR(ret);
+        }
+    }
+
+    wake_up_process(task);
+    return task;
+}
+
+/**
+ * @brief Takes a consistent snapshot of `watch_state` without any lock.
+ * @details
+ * The writer bumps a sequence counter before and after it changes the state. A reader copies the
+ * state and then checks that the counter didn't move and wasn't odd (write in progress). Otherwise
+ * it copies again. Readers never write to shared memory, so any number of them can read at once
+ * without bouncing cache lines, and the writer never waits for a reader.
+ *
+ * @param[out] snap: Receives the state.
+ */
+static void watch_get(struct waitqueue_state *snap) {
+    unsigned int seq;
+
+    do {
+        seq = read_seqcount_begin(&watch_seq);
+        *snap = watch_state;
+    } while (read_seqcount_retry(&watch_seq, seq));
+}
+
+/**
+ * @brief Orders subscriptions by `value`. Equal values go to the right, so they fire in the
+ *     order they were added.
+ */
+static bool sub_less(struct rb_node *a, const struct rb_node *b) {
+    return rb_to_sub(a)->value < rb_to_sub(b)->value;
+}
+
+/**
+ * @brief Compares a value with a subscription, for `rb_find_first()`.
+ */
+static int sub_cmp(const void *key, const struct rb_node *node) {
+    s64 value = *(const s64 *)key;
+    s64 sub_value = rb_to_sub(node)->value;
+
+    return value < sub_value ? -1 : value > sub_value;
+}
+
+/**
+ * @brief Adds a subscription to its tree. `watch_lock` must be held.
+ */
+static void watch_subscribe(struct watch_sub *sub) {
+    rb_add_cached(&sub->node, &subs[sub->op], sub_less);
+}
+
+/**
+ * @brief Removes a subscription from its tree, if it's still in it. `watch_lock` must be held.
+ */
+static void watch_unsubscribe(struct watch_sub *sub) {
+    if (RB_EMPTY_NODE(&sub->node))
+        return;
+
+    rb_erase_cached(&sub->node, &subs[sub->op]);
+    RB_CLEAR_NODE(&sub->node);
+}
+
+/**
+ * @brief Fires all subscriptions that match `state->value`. `watch_lock` must be held.
+ */
+static void watch_notify(const struct waitqueue_state *state) {
+    struct rb_node *node, *next;
+    struct watch_sub *sub;
+    s64 value = state->value;
+
+    // All subscriptions to exactly this value sit next to each other. Find the first one.
+    node = rb_find_first(&value, &subs[WAITQUEUE_OP_EQ].rb_root, sub_cmp);
+    for (; node && rb_to_sub(node)->value == value; node = next) {
+        next = rb_next(node);
+        sub = rb_to_sub(node);
+        watch_unsubscribe(sub);
+        sub->notify(sub, state);
+    }
+
+    // All subscriptions to a value <= this one are at the left end of the tree.
+    while ((node = rb_first_cached(&subs[WAITQUEUE_OP_GE])) && rb_to_sub(node)->value <= value) {
+        sub = rb_to_sub(node);
+        watch_unsubscribe(sub);
+        sub->notify(sub, state);
+    }
+}
+
+/**
+ * @brief Publishes a new value and fires the subscriptions that match it.
+ *
+ * @param[in] value: The new value.
+ * @param[in] pid: The process that wrote it.
+ * @return The time the value was published at.
+ */
+static u64 watch_publish(long value, pid_t pid) {
+    struct waitqueue_state snap;
+    u64 max_gap = 2ULL * READ_ONCE(coalesce_usecs) * NSEC_PER_USEC;
+    u64 now = ktime_get_ns();
+
+    // Concurrent writers take turns, so subscribers see the values in the order they were published.
+    spin_lock(&watch_lock);
+
+    // Every write moves the average gap 1/8 of the way to its own. Long pauses count as twice the
+    // coalescing delay, so after a pause the average comes back down within a few writes.
+    if (max_gap && watch_state.time_ns)
+        WRITE_ONCE(write_gap_ns, write_gap_ns - (write_gap_ns >> 3) +
+                                 (min(now - watch_state.time_ns, max_gap) >> 3));
+
+    write_seqcount_begin(&watch_seq);
+    watch_state.value = value;
+    watch_state.seq++;
+    watch_state.time_ns = now;
+    watch_state.pid = pid;
+    snap = watch_state;
+    write_seqcount_end(&watch_seq);
+
+    watch_notify(&snap);
+
+    spin_unlock(&watch_lock);
+
+    return snap.time_ns;
+}
+
+/**
+ * @brief Wakes up the benchmark thread with the primitive of `bench_mode`.
+ */
+static void bench_wake(void) {
+    switch (bench_mode) {
+        case BENCH_WAKE_UP:
+            wake_up(&bench_wq);
+            break;
+        case BENCH_WAKE_UP_INTERRUPTIBLE:
+            wake_up_interruptible(&bench_wq);
+            break;
+        case BENCH_SWAIT:
+            swake_up_one(&bench_swq);
+            break;
+        case BENCH_COMPLETION:
+            complete(&bench_done);
+            break;
+    }
+}
+
+/**
+ * @brief Hands the time of a write to the benchmark thread and wakes it up.
+ *
+ * @param[in] stamp: When the value was published, from `ktime_get_ns()`.
+ */
+static void bench_signal(u64 stamp) {
+    if (!READ_ONCE(bench_task))
+        return;
+
+    // If the thread didn't pick up the previous write yet, keep the older time. The thread will
+    // be late for that one, and this write only gets counted.
+    if (atomic64_cmpxchg(&bench_stamp, 0, stamp) != 0)
+        atomic64_inc(&bench_coalesced);
+
+    bench_wake();
+}
+
+/**
+ * @brief Wait condition of the benchmark thread.
+ */
+static bool bench_ready(void) {
+    return atomic64_read(&bench_stamp) || READ_ONCE(bench_stopping);
+}
+
+/**
+ * @brief The benchmark thread. Sleeps until a write comes in and records how long it took to wake up.
+ */
+static int bench_thread(void *unused) {
+    u64 now, stamp;
+
+    while (!READ_ONCE(bench_stopping)) {
+        // Kernel threads ignore signals, so the interruptible waits only return once they were
+        // woken up. All of them sleep without adding to the load average.
+        switch (bench_mode) {
+            case BENCH_WAKE_UP:
+                wait_event_idle(bench_wq, bench_ready());
+                break;
+            case BENCH_WAKE_UP_INTERRUPTIBLE:
+                wait_event_interruptible(bench_wq, bench_ready());
+                break;
+            case BENCH_SWAIT:
+                swait_event_idle_exclusive(bench_swq, bench_ready());
+                break;
+            case BENCH_COMPLETION:
+                // Coalesced writes leave extra `complete()`s behind. They make this return at once
+                // with nothing to record, which is fine.
+                if (wait_for_completion_interruptible(&bench_done))
+                    continue;
+                break;
+        }
+
+        // Take the time first, everything after this isn't part of the wake-up latency.
+        now = ktime_get_ns();
+        stamp = atomic64_xchg(&bench_stamp, 0);
+        if (stamp)
+            lat_hist_record(bench_hist, now > stamp ? now - stamp : 0);
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Prints the wake-up latencies into the debugfs file `wake_latency`.
+ */
+static int wake_latency_show(struct seq_file *m, void *unused) {
+    seq_printf(m, "mode   : %s\n", bench_mode_names[bench_mode]);
+    seq_printf(m, "coalesced writes: %lld\n", atomic64_read(&bench_coalesced));
+    lat_hist_show(m, bench_hist);
+    return 0;
+}
+
+/**
+ * @brief Clears the wake-up latencies, e.g. before a run of the hammer program.
+ */
+static ssize_t wake_latency_write(struct file *file, const char __user *user_buf, size_t len, loff_t *off) {
+    lat_hist_reset(bench_hist);
+    atomic64_set(&bench_coalesced, 0);
+    return len;
+}
+
+static int wake_latency_open(struct inode *inode, struct file *file) {
+    return single_open(file, wake_latency_show, NULL);
+}
+
+static const struct file_operations wake_latency_fops = {
+    .owner = THIS_MODULE,
+    .open = wake_latency_open,
+    .read = seq_read,
+    .write = wake_latency_write,
+    .llseek = seq_lseek,
+    .release = single_release,
+};
+
+/**
+ * @brief Starts the benchmark thread and its debugfs file, if `bench_mode` is on.
+ * @note `debugfs_dir` has to exist already.
+ *
+ * @return Zero on success, a negative error code otherwise.
+ */
+static int bench_start(void) {
+    struct task_struct *task;
+    cpumask_var_t mask;
+    int node = bench_node;
+    int ret;
+
+    if (bench_mode == BENCH_OFF)
+        return 0;
+    if (bench_mode >= NR_BENCH_MODES)
+        return -EINVAL;
+
+    if (!alloc_cpumask_var(&mask, GFP_KERNEL))
+        return -ENOMEM;
+
+    ret = thread_placement(bench_cpus, &node, mask);
+    if (ret)
+        goto out;
+
+    // Only the benchmark thread writes the histogram, so keep it on its node.
+    bench_hist = kzalloc_node(sizeof(*bench_hist), GFP_KERNEL, node);
+    if (!bench_hist) {
+        ret = -ENOMEM;
+        goto out;
+    }
+
+    task = thread_start(bench_thread, NULL, node, mask, "waitqueue/bench");
+    if (IS_ERR(task)) {
+        kfree(bench_hist);
+        ret = PTR_ERR(task);
+        goto out;
+    }
+
+    // The thread stays around until `kthread_stop()`. Writers start to signal it from here on.
+    get_task_struct(task);
+    WRITE_ONCE(bench_task, task);
+
+    // /sys/kernel/debug/waitqueue/wake_latency. Reading it prints the percentiles, writing anything
+    // to it clears them.
+    debugfs_create_file("wake_latency", 0600, debugfs_dir, NULL, &wake_latency_fops);
+
+    pr_info("waitqueue - Wake-up benchmark with %s is running.\n", bench_mode_names[bench_mode]);
+
+out:
+    free_cpumask_var(mask);
+    return ret;
+}
+
+/**
+ * @brief Stops the benchmark thread, if it runs.
+ */
+static void bench_stop(void) {
+    if (!bench_task)
+        return;
+
+    // A thread that waits for a completion doesn't return on `kthread_stop()` alone, so wake it up
+    // the same way a write would.
+    WRITE_ONCE(bench_stopping, true);
+    bench_wake();
+    kthread_stop(bench_task);
+    put_task_struct(bench_task);
+    kfree(bench_hist);
+}
+
+// Why the readers were woken up, for the coalescing stats.
+enum wake_reason {
+    WAKE_NOW,
+    WAKE_FRAMES,
+    WAKE_TIMER,
+};
+
+/**
+ * @brief Wakes up the readers for all pending writes, and accounts for the batch.
+ *
+ * @param[in] reason: What ended the batch.
+ */
+static void wake_flush(enum wake_reason reason) {
+    unsigned long flags;
+    int pending = atomic_xchg(&wake_pending, 0);
+    u64 first, now;
+
+    // Another writer or the timer took the batch already.
+    if (!pending)
+        return;
+
+    // A write that raced with us may have started the next batch with a time of its own, and the
+    // xchg takes that. It only makes one sample of the stats a little off.
+    first = atomic64_xchg(&wake_first, 0);
+    wake_up_interruptible(&read_wq);
+    now = ktime_get_ns();
+
+    spin_lock_irqsave(&coalesce_lock, flags);
+    coalesce.writes += pending;
+    coalesce.wakeups++;
+    if (reason == WAKE_FRAMES)
+        coalesce.by_frames++;
+    else if (reason == WAKE_TIMER)
+        coalesce.by_timer++;
+    else
+        coalesce.immediate++;
+    if (first)
+        lat_hist_record(&coalesce.delay, now > first ? now - first : 0);
+    spin_unlock_irqrestore(&coalesce_lock, flags);
+}
+
+/**
+ * @brief Called when the delay of a batch is over.
+ */
+static enum hrtimer_restart wake_timer_handler(struct hrtimer *timer) {
+    wake_flush(WAKE_TIMER);
+    return HRTIMER_NORESTART;
+}
+
+/**
+ * @brief Wakes up the readers after a write, right away or together with the next writes.
+ *
+ * @param[in] stamp: When the value was published, from `ktime_get_ns()`.
+ */
+static void wake_readers(u64 stamp) {
+    unsigned int frames = READ_ONCE(coalesce_frames);
+    u64 delay = (u64)READ_ONCE(coalesce_usecs) * NSEC_PER_USEC;
+    unsigned int pending;
+    u64 gap, want;
+
+    if (!delay) {
+        wake_up_interruptible(&read_wq);
+        return;
+    }
+
+    // Wait about as long as it takes to collect `frames` writes at the current rate. If not even
+    // the next write is likely to come in within the longest delay, waiting would only add latency.
+    if (READ_ONCE(coalesce_adaptive)) {
+        gap = READ_ONCE(write_gap_ns);
+        if (gap >= delay)
+            delay = 0;
+        else if (!check_mul_overflow(gap, (u64)frames, &want) && want < delay)
+            delay = want;
+    }
+
+    // Only the first write of a batch keeps its time and arms the timer. `hrtimer_start()` moves a
+    // timer that is still armed for an older batch, which was flushed by its frame count.
+    atomic64_cmpxchg(&wake_first, 0, stamp);
+    pending = atomic_inc_return(&wake_pending);
+
+    if (!delay)
+        wake_flush(WAKE_NOW);
+    else if (pending >= frames)
+        wake_flush(WAKE_FRAMES);
+    else if (pending == 1)
+        hrtimer_start(&wake_timer, ns_to_ktime(delay), HRTIMER_MODE_REL);
+}
+
+/**
+ * @brief Prints the wake-up coalescing stats into the debugfs file `coalesce`.
+ */
+static int coalesce_show(struct seq_file *m, void *unused) {
+    struct lat_hist *delay;
+    u64 writes, wakeups, by_frames, by_timer, immediate;
+
+    // Copy the histogram, so `lat_hist_show()` doesn't run with interrupts off.
+    delay = kmalloc(sizeof(*delay), GFP_KERNEL);
+    if (!delay)
+        return -ENOMEM;
+
+    spin_lock_irq(&coalesce_lock);
+    writes = coalesce.writes;
+    wakeups = coalesce.wakeups;
+    by_frames = coalesce.by_frames;
+    by_timer = coalesce.by_timer;
+    immediate = coalesce.immediate;
+    *delay = coalesce.delay;
+    spin_unlock_irq(&coalesce_lock);
+
+    seq_printf(m, "writes : %llu\n", writes);
+    seq_printf(m, "wakeups: %llu (%llu full, %llu timer, %llu right away)\n", wakeups, by_frames, by_timer, immediate);
+    seq_printf(m, "saved  : %llu\n", writes - wakeups);
+    seq_printf(m, "gap    : %llu ns (average time between writes)\n", READ_ONCE(write_gap_ns));
+    seq_puts(m, "added latency:\n");
+    lat_hist_show(m, delay);
+
+    kfree(delay);
+    return 0;
+}
+
+/**
+ * @brief Clears the wake-up coalescing stats.
+ */
+static ssize_t coalesce_write(struct file *file, const char __user *user_buf, size_t len, loff_t *off) {
+    spin_lock_irq(&coalesce_lock);
+    memset(&coalesce, 0, sizeof(coalesce));
+    spin_unlock_irq(&coalesce_lock);
+    return len;
+}
+
+static int coalesce_open(struct inode *inode, struct file *file) {
+    return single_open(file, coalesce_show, NULL);
+}
+
+static const struct file_operations coalesce_fops = {
+    .owner = THIS_MODULE,
+    .open = coalesce_open,
+    .read = seq_read,
+    .write = coalesce_write,
+    .llseek = seq_lseek,
+    .release = single_release,
+};
+
+/**
+ * @brief `notify()` of the watcher threads.
+ */
+static void watcher_notify(struct watch_sub *sub, const struct waitqueue_state *state) {
+    struct watcher *w = container_of(sub, struct watcher, sub);
+
+    w->state = *state;
+    w->fired = true;
+    wake_up(&w->wq);
+}
+
+/**
+ * @brief Returns true if the subscription of `w` fired. Resets it.
+ */
+static bool watcher_fired(struct watcher *w) {
+    bool fired;
 
-/* Function prototypes */
-int thread_function(void * thread_num);
+    spin_lock(&watch_lock);
+    fired = w->fired;
+    w->fired = false;
+    spin_unlock(&watch_lock);
 
+    return fired;
+}
 
 /**
  * @brief This function will be executed by the threads.
+ * @details
+ * Every thread waits for the values that match its predicate, as long as the module is loaded.
  *
- * @param[in] thread_num: Thread number. Each thread has a different wait function.
+ * @param[in] data: The `struct watcher` of this thread.
  *
  * @return Return code.
  */
-int thread_function(void * thread_num) {
-    int thread_selection = *(int *) thread_num;
-    pr_info("waitqueue - `thread_selection` == %d\n", thread_selection);
+static int thread_function(void *data) {
+    struct watcher *w = data;
+    const char *op = w->sub.op == WAITQUEUE_OP_EQ ? "==" : ">=";
 
-    switch(thread_selection) {
-        case 1:
-            // If the condition (`watch_var == 11`) is false then it will go to sleep. It will
-            // sleep forever as long as the condition is false. The condition is checked each time
-            // the waitqueue is woken up (via the `wake_up()` function).
-            wait_event(wq1, watch_var == 11);
+    pr_info("waitqueue - Watcher %d waits for values %s %lld\n", w->id, op, w->sub.value);
 
-            // We will get here once the condition (`watch_var == 11`) is true.
-            pr_info("waitqueue - `watch_var` is now 11!\n");
-            break;
+    while (!kthread_should_stop()) {
+        spin_lock(&watch_lock);
+        watch_subscribe(&w->sub);
+        spin_unlock(&watch_lock);
 
-        case 2:
-            // Use `wait_event_timeout()` if we want to wait a maximum amount of time.
-            // If the condition is still not met after the maxiumum specified amount of time,
-            // then it will return zero. If the timeout elapsed and the condition is met, then it
-            // will return a 1. If the function is woken up with the `wake_up()` function and the
-            // condition is met, it will return the remaining time (jiffies) from the timeout.
-            // In this case, let's wait a maxiumum of 5 seconds.
-            while (wait_event_timeout(wq2, watch_var == 22, msecs_to_jiffies(5000)) == 0)
-                pr_info("waitqueue - `watch_var` is still not 22, but timeout elapsed!\n");
-
-            // We will get here once the condition (`watch_var == 22`) is true.
-            pr_info("waitqueue - `watch_var` is now 22!\n");
-            break;
+        // Use `wait_event_timeout()` if we want to wait a maximum amount of time.
+        // If the condition is still not met after the maxiumum specified amount of time,
+        // then it will return zero. If the timeout elapsed and the condition is met, then it
+        // will return a 1. If the function is woken up with the `wake_up()` function and the
+        // condition is met, it will return the remaining time (jiffies) from the timeout.
+        // In this case, let's wait a maxiumum of 5 seconds. `kthread_stop()` wakes us up, too.
+        while (wait_event_timeout(w->wq, READ_ONCE(w->fired) || kthread_should_stop(),
+                                  msecs_to_jiffies(5000)) == 0)
+            pr_info("waitqueue - Watcher %d: still no value %s %lld, but timeout elapsed!\n",
+                    w->id, op, w->sub.value);
 
-        default:
-            pr_info("waitqueue - Default thread_selection.\n");
+        // `kthread_stop()` woke us up before a matching value came in.
+        if (!watcher_fired(w))
             break;
+
+        // We will get here once a matching value was written.
+        pr_info_ratelimited("waitqueue - Watcher %d: `watch_var` is now %lld (pid %u)!\n",
+                            w->id, w->state.value, w->state.pid);
     }
 
-    pr_info("waitqueue - Thread monitoring waitqueue #%d finished execution.\n", thread_selection);
+    spin_lock(&watch_lock);
+    watch_unsubscribe(&w->sub);
+    spin_unlock(&watch_lock);
+
+    pr_info("waitqueue - Watcher %d finished execution.\n", w->id);
 
     return 0;  // Indicate the function has executed correctly.
 }
 
 /**
- * @brief The `write()` callback function. Writes from user space to kernel space.
+ * @brief Parses a predicate like "==11" or ">=22" into `sub`.
  *
- * In this kernel module, the value written to our device is what we will store in `watch_var`.
+ * @return Zero on success, -EINVAL if the predicate is malformed.
+ */
+static int watch_parse(const char *str, struct watch_sub *sub) {
+    if (!strncmp(str, "==", 2))
+        sub->op = WAITQUEUE_OP_EQ;
+    else if (!strncmp(str, ">=", 2))
+        sub->op = WAITQUEUE_OP_GE;
+    else
+        return -EINVAL;
+
+    return kstrtos64(str + 2, 10, &sub->value);
+}
+
+/**
+ * @brief Creates and starts a watcher thread.
+ *
+ * @return The watcher, or an `ERR_PTR()`.
+ */
+static struct watcher *watcher_create(int id, const char *predicate) {
+    struct watcher *w;
+    cpumask_var_t mask;
+    char name[TASK_COMM_LEN];
+    int node = watcher_nodes[id];
+    int ret;
+
+    if (!alloc_cpumask_var(&mask, GFP_KERNEL))
+        return ERR_PTR(-ENOMEM);
+
+    ret = thread_placement(watcher_cpus[id], &node, mask);
+    if (ret)
+        goto err_mask;
+
+    // The thread's data lives on the thread's node, so its wait condition and the state it copies
+    // in `watcher_notify()` are local memory accesses.
+    w = kzalloc_node(sizeof(*w), GFP_KERNEL, node);
+    if (!w) {
+        ret = -ENOMEM;
+        goto err_mask;
+    }
+
+    w->id = id;
+    w->sub.notify = watcher_notify;
+    RB_CLEAR_NODE(&w->sub.node);
+
+    // Initialize our dynamically-created waitqueue.
+    init_waitqueue_head(&w->wq);
+
+    ret = watch_parse(predicate, &w->sub);
+    if (ret) {
+        pr_err("waitqueue - Invalid predicate \"%s\", use \"==X\" or \">=X\"!\n", predicate);
+        goto err;
+    }
+
+    snprintf(name, sizeof(name), "waitqueue/%d", id);
+    w->task = thread_start(thread_function, w, node, mask, name);
+    if (IS_ERR(w->task)) {
+        ret = PTR_ERR(w->task);
+        goto err;
+    }
+
+    // The thread stays around until `kthread_stop()`, but hold on to it anyway, so it can't be
+    // freed under us if it ever returns early.
+    get_task_struct(w->task);
+    free_cpumask_var(mask);
+    return w;
+
+err:
+    kfree(w);
+err_mask:
+    free_cpumask_var(mask);
+    return ERR_PTR(ret);
+}
+
+/**
+ * @brief Stops a watcher thread and frees it.
+ */
+static void watcher_destroy(struct watcher *w) {
+    kthread_stop(w->task);
+    put_task_struct(w->task);
+    kfree(w);
+}
+
+/**
+ * @brief `notify()` of the user space subscriptions. Moves the subscription to the fired list of
+ *     its file.
+ */
+static void user_notify(struct watch_sub *sub, const struct waitqueue_state *state) {
+    struct user_sub *us = container_of(sub, struct user_sub, sub);
+
+    us->event.state = *state;
+    list_move_tail(&us->entry, &us->wf->fired);
+    wake_up_interruptible(&us->wf->event_wq);
+}
+
+/**
+ * @brief Adds a subscription to a file. Handles `WAITQUEUE_SUBSCRIBE`.
+ */
+static long user_subscribe(struct waitqueue_file *wf, const struct waitqueue_sub *arg) {
+    struct user_sub *us;
+
+    if (arg->op > WAITQUEUE_OP_GE)
+        return -EINVAL;
+
+    // Subscribing is a hot path when a client watches many values. The slab cache packs the
+    // subscriptions tightly and keeps a per-CPU freelist of them, so subscribing right after
+    // another subscription was consumed usually reuses its memory without touching any lock.
+    us = kmem_cache_alloc(user_sub_cache, GFP_KERNEL);
+    if (!us)
+        return -ENOMEM;
+
+    us->sub.op = arg->op;
+    us->sub.value = arg->value;
+    us->sub.notify = user_notify;
+    us->wf = wf;
+    us->event.cookie = arg->cookie;
+
+    spin_lock(&watch_lock);
+
+    // Every subscription costs kernel memory, so don't let one file pile up an unlimited number.
+    if (wf->nr_subs >= READ_ONCE(max_subs)) {
+        spin_unlock(&watch_lock);
+        kmem_cache_free(user_sub_cache, us);
+        return -ENOSPC;
+    }
+
+    wf->nr_subs++;
+    list_add_tail(&us->entry, &wf->subs);
+    watch_subscribe(&us->sub);
+
+    spin_unlock(&watch_lock);
+    return 0;
+}
+
+/**
+ * @brief Takes the oldest fired subscription off a file.
+ *
+ * @return The subscription, or NULL if none fired.
+ */
+static struct user_sub *user_pop_fired(struct waitqueue_file *wf) {
+    struct user_sub *us;
+
+    spin_lock(&watch_lock);
+    us = list_first_entry_or_null(&wf->fired, struct user_sub, entry);
+    if (us) {
+        list_del(&us->entry);
+        wf->nr_subs--;
+    }
+    spin_unlock(&watch_lock);
+
+    return us;
+}
+
+/**
+ * @brief Waits for a fired subscription and copies it to user space. Handles `WAITQUEUE_WAIT`.
+ */
+static long user_wait(struct file *filp, struct waitqueue_event __user *arg) {
+    struct waitqueue_file *wf = filp->private_data;
+    struct user_sub *us;
+    long ret = 0;
+
+    us = user_pop_fired(wf);
+    if (!us) {
+        if (filp->f_flags & O_NONBLOCK)
+            return -EAGAIN;
+
+        // The condition takes `watch_lock`. That's fine, it only sleeps between checks.
+        if (wait_event_interruptible(wf->event_wq, (us = user_pop_fired(wf)) != NULL))
+            return -ERESTARTSYS;
+    }
+
+    if (copy_to_user(arg, &us->event, sizeof(us->event)))
+        ret = -EFAULT;
+
+    kmem_cache_free(user_sub_cache, us);
+    return ret;
+}
+
+/**
+ * @brief Callback function for when the device file is opened.
+ *
+ * @param[in] inode: Represents a file.
+ * @param[in] filp: Represents an open file in the Linux kernel.
+ * @return Return code.
+ */
+static int my_open(struct inode *inode, struct file *filp) {
+    struct waitqueue_file *wf = kzalloc(sizeof(*wf), GFP_KERNEL);
+    struct waitqueue_state snap;
+
+    if (!wf)
+        return -ENOMEM;
+
+    // A new reader only wants to hear about changes that happen after it opened the device.
+    watch_get(&snap);
+    wf->seen_seq = snap.seq;
+    INIT_LIST_HEAD(&wf->subs);
+    INIT_LIST_HEAD(&wf->fired);
+    init_waitqueue_head(&wf->event_wq);
+    filp->private_data = wf;
+
+    // `my_read_iter()` honors `IOCB_NOWAIT`, so io_uring doesn't need a worker thread for it.
+    filp->f_mode |= FMODE_NOWAIT;
+
+    return 0;
+}
+
+/**
+ * @brief Callback function for when the device file is closed.
+ *
+ * @return Return code.
+ */
+static int my_release(struct inode *inode, struct file *filp) {
+    struct waitqueue_file *wf = filp->private_data;
+    struct user_sub *us, *tmp;
+    LIST_HEAD(dead);
+
+    // Take the pending subscriptions out of the trees, then free them and the fired ones outside
+    // of the lock.
+    spin_lock(&watch_lock);
+    list_for_each_entry(us, &wf->subs, entry)
+        watch_unsubscribe(&us->sub);
+    list_splice_init(&wf->subs, &dead);
+    list_splice_init(&wf->fired, &dead);
+    spin_unlock(&watch_lock);
+
+    list_for_each_entry_safe(us, tmp, &dead, entry)
+        kmem_cache_free(user_sub_cache, us);
+
+    kfree(wf);
+    return 0;
+}
+
+/**
+ * @brief Returns true if a new value was published since `wf` last read one.
+ */
+static bool my_changed(struct waitqueue_file *wf) {
+    struct waitqueue_state snap;
+
+    watch_get(&snap);
+    return snap.seq != READ_ONCE(wf->seen_seq);
+}
+
+/**
+ * @brief The `read_iter()` callback function. Writes from kernel space to user space.
+ * @details
+ * Returns the watched value as a decimal string, followed by a newline, once it was written
+ * since the last read on this file. Until then, the read sleeps, or fails with `-EAGAIN` if the file
+ * was opened with `O_NONBLOCK`.
+ *
+ * @param[in] iocb: Describes the I/O request. `iocb->ki_filp` is the opened file.
+ * @param[inout] to: The user space buffers to copy into.
+ *
+ * @return The number of bytes that were read successfully.
+ *
+ * @note We will ignore `iocb->ki_pos`.
+ */
+static ssize_t my_read_iter(struct kiocb *iocb, struct iov_iter *to) {
+    struct waitqueue_file *wf = iocb->ki_filp->private_data;
+    struct waitqueue_state snap;
+    char buffer[24];
+    int len;
+
+    if (!my_changed(wf)) {
+        if ((iocb->ki_filp->f_flags & O_NONBLOCK) || (iocb->ki_flags & IOCB_NOWAIT))
+            return -EAGAIN;
+
+        // Sleep until `my_write_iter()` publishes a new value. Returns early on a signal.
+        if (wait_event_interruptible(read_wq, my_changed(wf)))
+            return -ERESTARTSYS;
+    }
+
+    // The value and its sequence number always belong to the same write.
+    watch_get(&snap);
+
+    len = scnprintf(buffer, sizeof(buffer), "%lld\n", snap.value);
+    if (iov_iter_count(to) < len)
+        return -EINVAL;  // Don't hand out half a number.
+
+    if (copy_to_iter(buffer, len, to) != len)
+        return -EFAULT;
+
+    WRITE_ONCE(wf->seen_seq, snap.seq);
+    return len;
+}
+
+/**
+ * @brief The `unlocked_ioctl()` callback function.
+ *
+ * @param[in] filp: An opened file in the Linux kernel.
+ * @param[in] cmd: The command, see waitqueue.h.
+ * @param[in] arg: User space pointer to the argument of the command.
+ *
+ * @return Zero on success, a negative error code otherwise.
+ */
+static long my_ioctl(struct file *filp, unsigned int cmd, unsigned long arg) {
+    struct waitqueue_state snap;
+    struct waitqueue_sub sub;
+
+    switch (cmd) {
+        case WAITQUEUE_GET_STATE:
+            // Unlike `read()`, this never waits for a new value and doesn't mark it as seen.
+            watch_get(&snap);
+            if (copy_to_user((void __user *)arg, &snap, sizeof(snap)))
+                return -EFAULT;
+            return 0;
+        case WAITQUEUE_SUBSCRIBE:
+            if (copy_from_user(&sub, (void __user *)arg, sizeof(sub)))
+                return -EFAULT;
+            return user_subscribe(filp->private_data, &sub);
+        case WAITQUEUE_WAIT:
+            return user_wait(filp, (struct waitqueue_event __user *)arg);
+        default:
+            return -ENOTTY;
+    }
+}
+
+/**
+ * @brief The `poll()` callback function. Used by `poll()`, `select()` and `epoll`.
  *
  * @param[in] filp: An opened file in the Linux kernel.
- * @param[in] user_buf: A user space buffer.
- * @param[in] len: Length of the buffer.
- * @param[inout] off: Our current file offset.
+ * @param[in] wait: Lets us register the waitqueue that will signal a change in readiness.
+ *
+ * @return `EPOLLIN` if a new value can be read, `EPOLLPRI` if a subscription fired. Writes never
+ *     block, so always `EPOLLOUT`.
+ */
+static __poll_t my_poll(struct file *filp, poll_table *wait) {
+    struct waitqueue_file *wf = filp->private_data;
+    __poll_t mask = EPOLLOUT | EPOLLWRNORM;
+
+    // Doesn't sleep. It only adds `read_wq` to the waitqueues that the caller (e.g. epoll) listens on.
+    poll_wait(filp, &read_wq, wait);
+    poll_wait(filp, &wf->event_wq, wait);
+
+    if (my_changed(wf))
+        mask |= EPOLLIN | EPOLLRDNORM;
+    if (!list_empty_careful(&wf->fired))
+        mask |= EPOLLPRI;
+
+    return mask;
+}
+
+/**
+ * @brief The `write_iter()` callback function. Writes from user space to kernel space.
+ *
+ * In this kernel module, the value written to our device is published as the new watched state.
+ * `write()`, `writev()` and io_uring writes all end up here.
+ *
+ * @param[in] iocb: Describes the I/O request. `iocb->ki_filp` is the opened file.
+ * @param[inout] from: The user space buffers to copy from.
  *
  * @return The number of bytes that were written successfully.
  *
- * @note We will ignnore the `loff_t *off` parameter.
+ * @note We will ignore `iocb->ki_pos`.
  */
-static ssize_t my_write(struct file *filp, const char __user *user_buf, size_t len, loff_t *off) {
+static ssize_t my_write_iter(struct kiocb *iocb, struct iov_iter *from) {
     char buffer[16];
-
-    pr_info("waitqueue - Write callback function called.\n");
+    long value = 0;
+    ssize_t ret;
 
     // Clean out `buffer` in case it's dirty.
     memset(buffer, 0, sizeof(buffer));
 
-    // Get the amount of data to copy. We can't copy more then the size of `buffer`.
-    int num_bytes_to_copy = min(len, sizeof(buffer));
-
-    // Copy from user buffer (`user_buf`) to our kernel space `buffer`.
-    int num_bytes_not_copied = copy_from_user(buffer, user_buf, num_bytes_to_copy);
+    // Get the amount of data to copy. We can't copy more then the size of `buffer`, and we keep
+    // the last byte as the string terminator for `kstrtol()`.
+    size_t num_bytes_to_copy = min(iov_iter_count(from), sizeof(buffer) - 1);
 
-    // Calculate how many bytes were copied.
-    int bytes_copied = num_bytes_to_copy - num_bytes_not_copied;
+    // Copy from the user buffers (`from`) to our kernel space `buffer`. The data may be spread
+    // over several buffers when it comes from `writev()`; `copy_from_iter()` gathers it for us.
+    size_t bytes_copied = copy_from_iter(buffer, num_bytes_to_copy, from);
 
-    // Convert the string in `buffer` to a long integer and store it into `watch_var`.
-    if (kstrtol(buffer, 10, &watch_var) == -EINVAL)
-        // Print an error if the string conversion failed.
-        pr_err("waitqueue - Error converting input!\n");
-    else
+    if (bytes_copied < num_bytes_to_copy) {
+        // Part of the user buffer wasn't readable. Don't act on a truncated number.
+        ret = -EFAULT;
+    } else if (kstrtol(buffer, 10, &value)) {
+        // The string conversion failed. This is reported to the caller instead of the kernel log,
+        // so a misbehaving writer can't flood the log.
+        ret = -EINVAL;
+    } else {
         // The string conversion succeeded.
-        pr_info("waitqueue - `watch_var` is now %ld.\n", watch_var);
+        u64 stamp = watch_publish(value, task_tgid_nr(current));
+
+        bench_signal(stamp);
+        ret = bytes_copied;
+
+        // Tell user space readers and pollers that there is a new value, now or after a few more
+        // writes. The subscribers whose predicates match were woken up by `watch_publish()` already.
+        wake_readers(stamp);
+    }
 
-    // Have the waitqueues check if their respective conditions are now met.
-    wake_up(&wq1);
-    wake_up(&wq2);
+    // This is the hot path, so it doesn't print anything. Use the counters and the
+    // `waitqueue:waitqueue_write` tracepoint to see what's going on.
+    cdev_stats_account(&write_stats, ret);
+    trace_waitqueue_write(iov_iter_count(from) + bytes_copied, value, ret);
 
-    return bytes_copied;
+    return ret;
 }
 
 static struct file_operations fops = {
     // Set file operations function pointers to our own functions.
     .owner = THIS_MODULE,
-    .write = my_write,  // The `write()` callback function.
+    .open = my_open,
+    .release = my_release,
+    .read_iter = my_read_iter,  // Used by `read()`, `readv()` and io_uring.
+    .write_iter = my_write_iter,  // Used by `write()`, `writev()` and io_uring.
+    .poll = my_poll,  // Used by `poll()`, `select()` and `epoll`.
+    .unlocked_ioctl = my_ioctl,
 };
 
 /**
@@ -125,45 +1208,76 @@ static struct file_operations fops = {
  * @return Zero if the loading of the module was successful.
  */
 static int __init my_init(void) {
-    // Initialize our dynamically-created waitqueue.
-    init_waitqueue_head(&wq2);
+    int i, ret;
 
-    // We will start to create and initialize the threads now.
-    pr_info("waitqueue - Init threads.\n");
+    if (nr_watchers > MAX_WATCHERS)
+        return -EINVAL;
+
+    user_sub_cache = KMEM_CACHE(user_sub, 0);
+    if (!user_sub_cache)
+        return -ENOMEM;
+
+    // The timer of the wake-up coalescing, armed by the first write of every batch.
+    hrtimer_init(&wake_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+    wake_timer.function = &wake_timer_handler;
 
     // Register the device number.
     if (register_chrdev(MAJOR_DEV_NUM, "waitqueue", &fops)) {
         pr_err("waitqueue - Could not register the device number (%d)!\n", MAJOR_DEV_NUM);
+        kmem_cache_destroy(user_sub_cache);
         return -1;
     }
 
     pr_info("waitqueue - Device number %d successfully registered!\n", MAJOR_DEV_NUM);
 
-    // Create and run `kthread_1`. `kthread_run()` will create a thread and run it.
-    kthread_1 = kthread_run(thread_function, &t1_data, "kthread_1");
-
-    // Check if `kthread_1` failed to be created.
-    if (kthread_1 == NULL) {
-        pr_err("waitqueue - Thread 1 could not be created!\n");
-        unregister_chrdev(MAJOR_DEV_NUM, "waitqueue");  // Unregister our character device.
-        return -1;  // We can't continue. Indicate that we failed.
+    if (cdev_stats_register(&stats_group)) {
+        pr_err("waitqueue - Could not create the stats in sysfs!\n");
+        unregister_chrdev(MAJOR_DEV_NUM, "waitqueue");
+        hrtimer_cancel(&wake_timer);  // A `write()` may have armed it since the device was registered.
+        kmem_cache_destroy(user_sub_cache);
+        return -1;
     }
-    else  // `kthread_1` has successfully been created and started.
-        pr_info("waitqueue - Thread 1 was created and is now running.\n");
 
-    // Create and run `kthread_2`. `kthread_run()` will create a thread and run it.
-    kthread_2 = kthread_run(thread_function, &t2_data, "kthread_2");
+    // We will start to create and initialize the threads now.
+    pr_info("waitqueue - Init threads.\n");
+
+    for (i = 0; i < nr_watchers; i++) {
+        watcher_list[i] = watcher_create(i, watchers[i]);
+
+        // Check if the thread failed to be created.
+        if (IS_ERR(watcher_list[i])) {
+            pr_err("waitqueue - Thread %d could not be created!\n", i);
 
-    // Check if `kthread_2` failed to be created.
-    if (kthread_2 == NULL) {
-        pr_err("waitqueue - Thread 2 could not be created!\n");
-        unregister_chrdev(MAJOR_DEV_NUM, "waitqueue");  // Unregister our character device.
-        return -1;  // We can't continue. Indicate that we failed.
+            // We can't continue. Undo everything and indicate that we failed.
+            while (i--)
+                watcher_destroy(watcher_list[i]);
+            cdev_stats_unregister(&stats_group);
+            unregister_chrdev(MAJOR_DEV_NUM, "waitqueue");  // Unregister our character device.
+            hrtimer_cancel(&wake_timer);
+            kmem_cache_destroy(user_sub_cache);
+            return -1;
+        }
     }
-    else  // `kthread_2` has successfully been created and started.
-        pr_info("waitqueue - Thread 2 was created and is now running.\n");
 
-    pr_info("waitqueue - Both threads are now running!\n");
+    pr_info("waitqueue - %d threads are now running!\n", nr_watchers);
+
+    // /sys/kernel/debug/waitqueue/coalesce. Reading it prints the wake-up coalescing stats, writing
+    // anything to it clears them. debugfs is optional, so errors are ignored.
+    debugfs_dir = debugfs_create_dir("waitqueue", NULL);
+    debugfs_create_file("coalesce", 0600, debugfs_dir, NULL, &coalesce_fops);
+
+    ret = bench_start();
+    if (ret) {
+        pr_err("waitqueue - Could not start the wake-up benchmark!\n");
+        debugfs_remove_recursive(debugfs_dir);
+        for (i = 0; i < nr_watchers; i++)
+            watcher_destroy(watcher_list[i]);
+        cdev_stats_unregister(&stats_group);
+        unregister_chrdev(MAJOR_DEV_NUM, "waitqueue");
+        hrtimer_cancel(&wake_timer);
+        kmem_cache_destroy(user_sub_cache);
+        return ret;
+    }
 
     return 0;  // Indicate the function has executed correctly.
 }
@@ -177,24 +1291,27 @@ static int __init my_init(void) {
  *   • Makes this function only available within this kernel module.
  */
 static void __exit my_exit(void) {
-    // Make the wait function return for `wq1`.
-    watch_var = 11;
-    wake_up(&wq1);
-    mdelay(10);
+    int i;
+
+    debugfs_remove_recursive(debugfs_dir);
+    bench_stop();
 
-    // Make the wait function return for `wq2`.
-    watch_var = 22;
-    wake_up(&wq2);
-    mdelay(10);
+    // Stop the threads. `kthread_stop()` wakes every thread up, and it sees `kthread_should_stop()`.
+    pr_info("waitqueue - Stopping the threads...\n");
+    for (i = 0; i < nr_watchers; i++)
+        watcher_destroy(watcher_list[i]);
 
-    // Stop both threads.
-    pr_info("waitqueue - Stopping both threads...\n");
-    kthread_stop(kthread_1);
-    kthread_stop(kthread_2);
+    cdev_stats_unregister(&stats_group);
 
     // Unregister our character device.
     pr_info("waitqueue - Unregistering character device %d.\n", MAJOR_DEV_NUM);
     unregister_chrdev(MAJOR_DEV_NUM, "waitqueue");
+
+    // No more writes can come in, so nothing arms the timer again.
+    hrtimer_cancel(&wake_timer);
+
+    // Every file was released, and with it all of its subscriptions.
+    kmem_cache_destroy(user_sub_cache);
 }
 
 // Specify the function to use when the module is loaded into the kernel.
@@ -0,0 +1,53 @@
+#ifndef WAITQUEUE_H
+#define WAITQUEUE_H
+
+// This header is shared by the kernel module and the user space programs, so only use the
+// fixed-size types from <linux/types.h>.
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+/**
+ * @brief The watched state. Every successful write to the device publishes a new version of it.
+ */
+struct waitqueue_state {
+    __s64 value;  // The value that was written, what the kernel calls `watch_var`.
+    __u64 seq;  // Version number, incremented by every write. Zero until the first write.
+    __u64 time_ns;  // When the value was written, from `ktime_get_ns()` (CLOCK_MONOTONIC).
+    __u32 pid;  // Process that wrote the value. Zero if the module itself wrote it.
+    __u32 pad;
+};
+
+// Predicates of a subscription. They are checked against every value when it is written, so a
+// subscription fires on the next matching write, not on the value that is already there.
+#define WAITQUEUE_OP_EQ 0  // Fires when a value == `value` is written.
+#define WAITQUEUE_OP_GE 1  // Fires when a value >= `value` is written.
+
+/**
+ * @brief Argument of `WAITQUEUE_SUBSCRIBE`.
+ */
+struct waitqueue_sub {
+    __u32 op;  // `WAITQUEUE_OP_*`.
+    __u32 pad;
+    __s64 value;
+    __u64 cookie;  // Anything, handed back in the `struct waitqueue_event` of this subscription.
+};
+
+/**
+ * @brief A subscription that fired. Returned by `WAITQUEUE_WAIT`.
+ */
+struct waitqueue_event {
+    __u64 cookie;  // From the `struct waitqueue_sub`.
+    struct waitqueue_state state;  // The state that was published by the matching write.
+};
+
+// Copies a consistent snapshot of the current state. Never blocks, and never blocks a writer.
+#define WAITQUEUE_GET_STATE _IOR('w', 1, struct waitqueue_state)
+
+// Adds a one-shot subscription to this open file. A file can hold many of them.
+#define WAITQUEUE_SUBSCRIBE _IOW('w', 2, struct waitqueue_sub)
+
+// Sleeps until a subscription of this file fired and returns it, oldest first. With `O_NONBLOCK`,
+// fails with `EAGAIN` instead. `poll()` reports `EPOLLPRI` while there are fired subscriptions.
+#define WAITQUEUE_WAIT _IOR('w', 3, struct waitqueue_event)
+
+#endif  // #ifndef WAITQUEUE_H
@@ -0,0 +1,41 @@
+// Tracepoints of waitqueue. They cost a not-taken branch while disabled. Enable them with e.g.
+//   echo 1 > /sys/kernel/tracing/events/waitqueue/enable
+// or record them with `perf record -e 'waitqueue:*'`.
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM waitqueue
+
+// Unlike other headers, this one is read several times by <trace/define_trace.h>.
+#if !defined(WAITQUEUE_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define WAITQUEUE_TRACE_H
+
+#include <linux/tracepoint.h>
+
+TRACE_EVENT(waitqueue_write,
+    TP_PROTO(size_t len, long value, ssize_t ret),
+    TP_ARGS(len, value, ret),
+
+    TP_STRUCT__entry(
+        __field(size_t, len)  // Bytes that were written by user space.
+        __field(long, value)  // The new `watch_var`, only valid if `ret` isn't negative.
+        __field(ssize_t, ret)
+    ),
+
+    TP_fast_assign(
+        __entry->len = len;
+        __entry->value = value;
+        __entry->ret = ret;
+    ),
+
+    TP_printk("len=%zu value=%ld ret=%zd", __entry->len, __entry->value, __entry->ret)
+);
+
+#endif  // #if !defined(WAITQUEUE_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+
+// <trace/define_trace.h> includes this file again, from the path below. The Makefile adds our
+// directory to the include path for that.
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE waitqueue_trace
+#include <trace/define_trace.h>
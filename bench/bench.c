@@ -0,0 +1,242 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "bench.h"
+
+// Phases of a run. The main thread moves the workers through them.
+enum {
+    PHASE_WARMUP,
+    PHASE_MEASURE,
+    PHASE_STOP,
+};
+
+/**
+ * @brief One worker thread. Everything but `phase` is only written by the thread itself.
+ */
+struct bench_thread {
+    pthread_t thread;
+    unsigned int idx;
+    const struct bench_workload *w;
+    const struct bench_config *cfg;
+    pthread_barrier_t *start;
+    atomic_int *phase;
+
+    int failed;  // `setup()` failed.
+    uint64_t ops, bytes, errors;
+    struct bench_hist hist;
+};
+
+uint64_t bench_now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * @brief Sleeps for `secs` seconds.
+ */
+static void sleep_secs(double secs) {
+    struct timespec ts = { .tv_sec = (time_t)secs, .tv_nsec = (long)((secs - (time_t)secs) * 1e9) };
+
+    while (nanosleep(&ts, &ts) != 0)
+        ;
+}
+
+/**
+ * @brief Returns the histogram bucket of `value`. Same as `lat_hist_index()` in the kernel.
+ */
+static unsigned int hist_index(uint64_t value) {
+    unsigned int msb;
+
+    if (value < BENCH_HIST_SUB_COUNT)
+        return value;
+
+    msb = 63 - __builtin_clzll(value);
+    if (msb > BENCH_HIST_MAX_BIT)
+        return BENCH_HIST_BUCKETS - 1;
+
+    return (msb - BENCH_HIST_SUB_BITS + 1) * BENCH_HIST_SUB_COUNT +
+           ((value >> (msb - BENCH_HIST_SUB_BITS)) & (BENCH_HIST_SUB_COUNT - 1));
+}
+
+/**
+ * @brief Returns the smallest value that falls into bucket `index`.
+ */
+static uint64_t hist_lowest(unsigned int index) {
+    unsigned int group = index / BENCH_HIST_SUB_COUNT;
+    uint64_t sub = index % BENCH_HIST_SUB_COUNT;
+
+    if (group == 0)
+        return sub;
+
+    return (BENCH_HIST_SUB_COUNT + sub) << (group - 1);
+}
+
+void bench_hist_record(struct bench_hist *h, uint64_t ns) {
+    h->buckets[hist_index(ns)]++;
+    h->count++;
+    if (ns > h->max)
+        h->max = ns;
+}
+
+uint64_t bench_hist_percentile(const struct bench_hist *h, unsigned int per_10k) {
+    uint64_t rank, seen = 0, value;
+    unsigned int i = 0;
+
+    if (!h->count)
+        return 0;
+
+    rank = (h->count * per_10k + 9999) / 10000;
+
+    // Walk up to the bucket that holds the sample with this rank.
+    while (i < BENCH_HIST_BUCKETS - 1 && seen + h->buckets[i] < rank)
+        seen += h->buckets[i++];
+
+    // Report the highest value of the bucket, but never more than the real maximum.
+    value = i < BENCH_HIST_BUCKETS - 1 ? hist_lowest(i + 1) - 1 : h->max;
+    return value < h->max ? value : h->max;
+}
+
+/**
+ * @brief Body of every worker thread. Runs the operation until the main thread says stop.
+ */
+static void *bench_thread_fn(void *arg) {
+    struct bench_thread *t = arg;
+    void *state = NULL;
+    uint64_t start;
+    int phase;
+    long ret;
+
+    if (t->w->setup) {
+        state = t->w->setup(t->cfg, t->idx);
+        t->failed = !state;
+    }
+
+    // Start all threads at the same time, once every one of them is set up.
+    pthread_barrier_wait(t->start);
+
+    while (!t->failed && (phase = atomic_load_explicit(t->phase, memory_order_relaxed)) != PHASE_STOP) {
+        start = bench_now_ns();
+        ret = t->w->op(state);
+
+        // Operations that started during the warm-up aren't counted.
+        if (phase != PHASE_MEASURE)
+            continue;
+
+        if (ret < 0) {
+            t->errors++;
+            continue;
+        }
+        bench_hist_record(&t->hist, bench_now_ns() - start);
+        t->ops++;
+        t->bytes += ret;
+    }
+
+    if (t->w->teardown && state)
+        t->w->teardown(state);
+
+    return NULL;
+}
+
+int bench_run(const struct bench_workload *w, const struct bench_config *cfg, struct bench_result *res) {
+    struct bench_thread *threads;
+    pthread_barrier_t start;
+    atomic_int phase = PHASE_WARMUP;
+    uint64_t begin;
+    unsigned int i, b;
+    int failed = 0;
+
+    threads = calloc(cfg->threads, sizeof(*threads));
+    if (!threads)
+        return -1;
+
+    pthread_barrier_init(&start, NULL, cfg->threads + 1);
+
+    for (i = 0; i < cfg->threads; i++) {
+        threads[i].idx = i;
+        threads[i].w = w;
+        threads[i].cfg = cfg;
+        threads[i].start = &start;
+        threads[i].phase = &phase;
+        if (pthread_create(&threads[i].thread, NULL, bench_thread_fn, &threads[i]) != 0) {
+            perror("pthread_create failed");
+            exit(1);
+        }
+    }
+
+    pthread_barrier_wait(&start);
+
+    sleep_secs(cfg->warmup_secs);
+    begin = bench_now_ns();
+    atomic_store(&phase, PHASE_MEASURE);
+
+    sleep_secs(cfg->secs);
+    atomic_store(&phase, PHASE_STOP);
+    res->secs = (bench_now_ns() - begin) / 1e9;
+
+    memset(&res->hist, 0, sizeof(res->hist));
+    res->ops = res->bytes = res->errors = 0;
+
+    for (i = 0; i < cfg->threads; i++) {
+        pthread_join(threads[i].thread, NULL);
+        failed |= threads[i].failed;
+
+        res->ops += threads[i].ops;
+        res->bytes += threads[i].bytes;
+        res->errors += threads[i].errors;
+        for (b = 0; b < BENCH_HIST_BUCKETS; b++)
+            res->hist.buckets[b] += threads[i].hist.buckets[b];
+        res->hist.count += threads[i].hist.count;
+        if (threads[i].hist.max > res->hist.max)
+            res->hist.max = threads[i].hist.max;
+    }
+
+    pthread_barrier_destroy(&start);
+    free(threads);
+
+    return failed ? -1 : 0;
+}
+
+void bench_print_header(enum bench_format format) {
+    if (format == BENCH_CSV)
+        printf("workload,threads,size,secs,ops,errors,ops_per_sec,mb_per_sec,p50_ns,p99_ns,p999_ns,max_ns\n");
+}
+
+void bench_report(const struct bench_workload *w, const struct bench_config *cfg, const struct bench_result *res) {
+    double ops_per_sec = res->ops / res->secs;
+    double mb_per_sec = res->bytes / res->secs / 1e6;
+    unsigned long long p50 = bench_hist_percentile(&res->hist, 5000);
+    unsigned long long p99 = bench_hist_percentile(&res->hist, 9900);
+    unsigned long long p999 = bench_hist_percentile(&res->hist, 9990);
+    unsigned long long max = res->hist.max;
+
+    switch (cfg->format) {
+        case BENCH_TEXT:
+            printf("%-12s %3u threads, %6zu bytes: %10.0f ops/s %9.1f MB/s | p50 %7llu ns, p99 %8llu ns, "
+                   "p99.9 %8llu ns, max %9llu ns | %llu errors\n",
+                   w->name, cfg->threads, cfg->size, ops_per_sec, mb_per_sec, p50, p99, p999, max,
+                   (unsigned long long)res->errors);
+            break;
+
+        case BENCH_CSV:
+            printf("%s,%u,%zu,%.3f,%llu,%llu,%.0f,%.1f,%llu,%llu,%llu,%llu\n",
+                   w->name, cfg->threads, cfg->size, res->secs, (unsigned long long)res->ops,
+                   (unsigned long long)res->errors, ops_per_sec, mb_per_sec, p50, p99, p999, max);
+            break;
+
+        case BENCH_JSON:
+            printf("{\"workload\": \"%s\", \"threads\": %u, \"size\": %zu, \"secs\": %.3f, \"ops\": %llu, "
+                   "\"errors\": %llu, \"ops_per_sec\": %.0f, \"mb_per_sec\": %.1f, \"p50_ns\": %llu, "
+                   "\"p99_ns\": %llu, \"p999_ns\": %llu, \"max_ns\": %llu}\n",
+                   w->name, cfg->threads, cfg->size, res->secs, (unsigned long long)res->ops,
+                   (unsigned long long)res->errors, ops_per_sec, mb_per_sec, p50, p99, p999, max);
+            break;
+    }
+
+    fflush(stdout);
+}
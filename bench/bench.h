@@ -0,0 +1,107 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// A small harness for benchmarking the example devices from user space. A workload provides one
+// operation, the harness runs it from several threads for a fixed time after a warm-up, times every
+// single operation and reports the throughput and the latency percentiles.
+
+// Output formats of `bench_report()`.
+enum bench_format {
+    BENCH_TEXT,  // One human readable line per run.
+    BENCH_CSV,  // One comma separated line per run, see `bench_print_header()`.
+    BENCH_JSON,  // One JSON object per line, so several runs can be appended to the same file.
+};
+
+/**
+ * @brief How a workload is run. Filled in from the command line.
+ */
+struct bench_config {
+    const char *dev;  // Device file that the workload drives.
+    unsigned int threads;
+    double warmup_secs;  // Operations in this time are run, but not counted.
+    double secs;  // Measured time.
+    size_t size;  // Request size in bytes, for the workloads that have one.
+    enum bench_format format;
+};
+
+/**
+ * @brief A workload. Only `op` is required.
+ */
+struct bench_workload {
+    const char *name;
+    const char *help;  // One line for the usage message.
+
+    // Called once by every thread before the run. Returns the thread's state, NULL on error.
+    void *(*setup)(const struct bench_config *cfg, unsigned int thread);
+
+    // Runs one operation. Returns the number of bytes it moved (zero if that doesn't apply), or -1
+    // if it failed. Failed operations are counted as errors, their latency is not recorded.
+    long (*op)(void *state);
+
+    // Called once by every thread after the run.
+    void (*teardown)(void *state);
+};
+
+// The latency histogram has the same layout as <lat_hist.h> in the kernel: every power of two is
+// split into `BENCH_HIST_SUB_COUNT` equal buckets, so every value is recorded within about 3%.
+#define BENCH_HIST_SUB_BITS 5
+#define BENCH_HIST_SUB_COUNT (1 << BENCH_HIST_SUB_BITS)
+#define BENCH_HIST_MAX_BIT 40  // Values of 2^41 ns (about 36 minutes) and more go into the last bucket.
+#define BENCH_HIST_BUCKETS ((BENCH_HIST_MAX_BIT - BENCH_HIST_SUB_BITS + 2) * BENCH_HIST_SUB_COUNT)
+
+/**
+ * @brief Latency histogram of one thread, or the sum of all threads.
+ */
+struct bench_hist {
+    uint64_t buckets[BENCH_HIST_BUCKETS];
+    uint64_t count;
+    uint64_t max;
+};
+
+/**
+ * @brief The outcome of one run.
+ */
+struct bench_result {
+    uint64_t ops;
+    uint64_t bytes;
+    uint64_t errors;
+    double secs;  // Measured time, as it really was.
+    struct bench_hist hist;  // Nanoseconds per operation.
+};
+
+/**
+ * @brief Returns the current time of the monotonic clock in nanoseconds.
+ */
+uint64_t bench_now_ns(void);
+
+/**
+ * @brief Adds one value to a histogram.
+ */
+void bench_hist_record(struct bench_hist *h, uint64_t ns);
+
+/**
+ * @brief Returns the value at or below which `per_10k` / 10000 of the values of `h` are.
+ */
+uint64_t bench_hist_percentile(const struct bench_hist *h, unsigned int per_10k);
+
+/**
+ * @brief Runs a workload as described by `cfg`.
+ *
+ * @return Zero on success, -1 if a thread couldn't be set up.
+ */
+int bench_run(const struct bench_workload *w, const struct bench_config *cfg, struct bench_result *res);
+
+/**
+ * @brief Prints the column names for `BENCH_CSV`. Nothing for the other formats.
+ */
+void bench_print_header(enum bench_format format);
+
+/**
+ * @brief Prints the result of one run to stdout, in `cfg->format`.
+ */
+void bench_report(const struct bench_workload *w, const struct bench_config *cfg, const struct bench_result *res);
+
+#endif  // #ifndef BENCH_H
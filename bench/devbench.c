@@ -0,0 +1,511 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>  // For open, close, read, write and getopt.
+#include <fcntl.h>  // For the flags being associated with our character device.
+#include <stdint.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+
+#include "bench.h"
+#include "hrt_deadline.h"
+#include "ioctl_test.h"
+#include "kthread_pool.h"
+
+// Drives one of the example devices with one of the workloads below and reports ops/s, MB/s and
+// the latency percentiles. `run.sh` runs all of them against freshly loaded modules.
+//
+// Usage: devbench [-t threads] [-w warm-up secs] [-d secs] [-s size] [-f text|csv|json] [-H] <workload> <device>
+
+#define STORE_SPAN (256 << 20)  // The store workloads use the first 256 MiB of the store.
+
+/**
+ * @brief Per-thread state of the workloads that work on a file.
+ */
+struct file_state {
+    const struct bench_config *cfg;
+    int fd;
+    char *buf;  // `cfg->size` bytes.
+    uint64_t slots;  // Store workloads: number of `cfg->size` blocks they use.
+    uint64_t rng;  // Store workloads: state of the offset generator.
+    uint64_t value;  // waitqueue: next value to write.
+    __u64 key;  // ioctl workloads: key of this thread.
+    struct ioctl_op *ops;  // ioctl-batch: the descriptors.
+    struct hrtd_timer *timers;  // deadline: the timers of one `HRTD_ADD`.
+    __u32 nr_ops;  // ioctl-batch and the ring workloads: operations per call.
+    struct kv_ring_hdr *ring;  // Ring workloads: the mapping of `KV_RING_SETUP`.
+    unsigned int ring_size;  // Bytes that are mapped.
+    unsigned int ring_flags;  // `KV_RING_*` flags of the setup.
+    unsigned int sq_tail, cq_head;  // Our copies of the cursors that we write.
+};
+
+/**
+ * @brief Opens the device and allocates a buffer of `cfg->size` bytes.
+ */
+static struct file_state *file_setup(const struct bench_config *cfg, int flags) {
+    struct file_state *s = calloc(1, sizeof(*s));
+
+    if (!s)
+        return NULL;
+
+    s->cfg = cfg;
+    s->fd = open(cfg->dev, flags);
+    s->buf = malloc(cfg->size ? cfg->size : 1);
+    if (s->fd < 0 || !s->buf) {
+        perror("Error opening the device.");
+        free(s->buf);
+        free(s);
+        return NULL;
+    }
+    memset(s->buf, 'x', cfg->size);
+
+    return s;
+}
+
+static void file_teardown(void *state) {
+    struct file_state *s = state;
+
+    if (s->ring)
+        munmap(s->ring, s->ring_size);
+    close(s->fd);
+    free(s->ops);
+    free(s->timers);
+    free(s->buf);
+    free(s);
+}
+
+// open: `open()` and `close()` of the device, e.g. 07_open_release_cdev.
+
+static void *open_setup(const struct bench_config *cfg, unsigned int thread) {
+    (void)thread;
+    return (void *)cfg;
+}
+
+static long open_op(void *state) {
+    const struct bench_config *cfg = state;
+    int fd = open(cfg->dev, O_RDONLY);
+
+    if (fd < 0)
+        return -1;
+    close(fd);
+    return 0;
+}
+
+// ring: `write()` one record of `size` bytes, then `read()` up to `size` bytes, 08_read_write_cdev.
+
+static void *ring_setup(const struct bench_config *cfg, unsigned int thread) {
+    (void)thread;
+    return file_setup(cfg, O_RDWR);
+}
+
+static long ring_op(void *state) {
+    struct file_state *s = state;
+    ssize_t n = write(s->fd, s->buf, s->cfg->size);
+
+    // Other threads may take our record. All that matters is that every write is read once.
+    if (n < 0 || read(s->fd, s->buf, s->cfg->size) < 0)
+        return -1;
+    return n;
+}
+
+// store-read, store-write: `pread()`/`pwrite()` of `size` bytes at random offsets, on the store
+// minor of 08_read_write_cdev.
+
+/**
+ * @brief Returns a random block of the store. xorshift, so the threads don't share any state.
+ */
+static off_t store_offset(struct file_state *s) {
+    s->rng ^= s->rng << 13;
+    s->rng ^= s->rng >> 7;
+    s->rng ^= s->rng << 17;
+    return (off_t)(s->rng % s->slots) * s->cfg->size;
+}
+
+static void *store_setup(const struct bench_config *cfg, unsigned int thread) {
+    struct file_state *s = file_setup(cfg, O_RDWR);
+    off_t size;
+
+    if (!s)
+        return NULL;
+
+    size = lseek(s->fd, 0, SEEK_END);
+    if (size > STORE_SPAN)
+        size = STORE_SPAN;
+    s->slots = cfg->size ? size / cfg->size : 0;
+    s->rng = 0x9e3779b97f4a7c15ULL * (thread + 1);
+    if (s->slots == 0) {
+        printf("The store is smaller than one request.\n");
+        file_teardown(s);
+        return NULL;
+    }
+
+    return s;
+}
+
+static void *store_read_setup(const struct bench_config *cfg, unsigned int thread) {
+    struct file_state *s = store_setup(cfg, thread);
+    uint64_t i;
+
+    // Holes read as zeros without touching a page. Fill our share of the blocks, so the reads
+    // measure the copy from real pages.
+    for (i = thread; s && i < s->slots; i += cfg->threads) {
+        if (pwrite(s->fd, s->buf, cfg->size, i * cfg->size) != (ssize_t)cfg->size) {
+            perror("Error filling the store.");
+            file_teardown(s);
+            return NULL;
+        }
+    }
+
+    return s;
+}
+
+static long store_read_op(void *state) {
+    struct file_state *s = state;
+
+    return pread(s->fd, s->buf, s->cfg->size, store_offset(s));
+}
+
+static long store_write_op(void *state) {
+    struct file_state *s = state;
+
+    return pwrite(s->fd, s->buf, s->cfg->size, store_offset(s));
+}
+
+// deadline: one `HRTD_ADD` of `size / sizeof(struct hrtd_timer)` timers that expire 50 us later,
+// then a `read()` of the expiries that are there, 09_high_resolution_timer. This measures how many
+// timers per second the driver takes, deadline_bench in that folder measures how accurately they expire.
+
+#define DEADLINE_DELAY_NS 50000
+
+static void *deadline_setup(const struct bench_config *cfg, unsigned int thread) {
+    struct file_state *s = file_setup(cfg, O_RDWR | O_NONBLOCK);
+    __u32 i;
+
+    (void)thread;
+    if (!s)
+        return NULL;
+
+    // `buf` has to hold the expiries of a whole batch, see `deadline_op()`.
+    if (cfg->size < sizeof(*s->timers)) {
+        fprintf(stderr, "deadline needs a size of at least %zu bytes\n", sizeof(*s->timers));
+        file_teardown(s);
+        return NULL;
+    }
+
+    s->nr_ops = cfg->size / sizeof(*s->timers);
+    if (s->nr_ops > HRTD_MAX_BATCH)
+        s->nr_ops = HRTD_MAX_BATCH;
+
+    s->timers = calloc(s->nr_ops, sizeof(*s->timers));
+    if (!s->timers) {
+        file_teardown(s);
+        return NULL;
+    }
+    // The driver only writes back the IDs, so the timers can be added again as they are.
+    for (i = 0; i < s->nr_ops; i++) {
+        s->timers[i].expires_ns = DEADLINE_DELAY_NS;
+        s->timers[i].flags = HRTD_RELATIVE;
+    }
+
+    return s;
+}
+
+static long deadline_op(void *state) {
+    struct file_state *s = state;
+    struct hrtd_batch batch = { .timers = (uintptr_t)s->timers, .count = s->nr_ops };
+
+    if (ioctl(s->fd, HRTD_ADD, &batch) != (int)s->nr_ops)
+        return -1;
+
+    // Reap the expiries of earlier batches without waiting, so the completion channel never fills up.
+    // A `struct hrtd_expiry` has the same size as a timer, so `buf` holds as many as one batch adds.
+    while (read(s->fd, s->buf, s->nr_ops * sizeof(struct hrtd_expiry)) > 0)
+        ;
+
+    return s->nr_ops * sizeof(*s->timers);
+}
+
+// ioctl-get: one `KV_GET` of the thread's own key, 13_ioctl.
+
+static void *ioctl_get_setup(const struct bench_config *cfg, unsigned int thread) {
+    struct file_state *s = file_setup(cfg, O_RDWR);
+    struct kv_pair pair;
+
+    if (!s)
+        return NULL;
+
+    s->key = thread + 1;  // Key 0 is the answer, leave that alone.
+    pair.key = s->key;
+    pair.value = thread;
+    if (ioctl(s->fd, KV_PUT, &pair) < 0) {
+        perror("KV_PUT failed");
+        file_teardown(s);
+        return NULL;
+    }
+
+    return s;
+}
+
+static long ioctl_get_op(void *state) {
+    struct file_state *s = state;
+    struct kv_pair pair = { .key = s->key };
+
+    if (ioctl(s->fd, KV_GET, &pair) < 0)
+        return -1;
+    return sizeof(pair);
+}
+
+// ioctl-batch: one `IOCTL_BATCH` of `size / sizeof(struct ioctl_op)` lookups, 13_ioctl.
+
+static void *ioctl_batch_setup(const struct bench_config *cfg, unsigned int thread) {
+    struct file_state *s = ioctl_get_setup(cfg, thread);
+    __u32 i;
+
+    if (!s)
+        return NULL;
+
+    s->nr_ops = cfg->size / sizeof(*s->ops);
+    if (s->nr_ops == 0)
+        s->nr_ops = 1;
+    if (s->nr_ops > IOCTL_MAX_BATCH)
+        s->nr_ops = IOCTL_MAX_BATCH;
+
+    s->ops = calloc(s->nr_ops, sizeof(*s->ops));
+    if (!s->ops) {
+        file_teardown(s);
+        return NULL;
+    }
+    for (i = 0; i < s->nr_ops; i++) {
+        s->ops[i].op = IOCTL_OP_GET;
+        s->ops[i].key = s->key;
+    }
+
+    return s;
+}
+
+static long ioctl_batch_op(void *state) {
+    struct file_state *s = state;
+    struct ioctl_batch batch = { .ops = (uintptr_t)s->ops, .count = s->nr_ops };
+
+    if (ioctl(s->fd, IOCTL_BATCH, &batch) < 0)
+        return -1;
+    return s->nr_ops * sizeof(*s->ops);
+}
+
+// ioctl-ring, ioctl-sqpoll: `size / sizeof(struct kv_sqe)` lookups through the shared-memory rings,
+// 13_ioctl. ioctl-ring rings the doorbell once per batch, ioctl-sqpoll lets the driver's thread poll.
+
+static void *ring_setup_flags(const struct bench_config *cfg, unsigned int thread, unsigned int flags) {
+    struct file_state *s = ioctl_get_setup(cfg, thread);
+    struct kv_ring_params params = { .flags = flags, .sq_thread_cpu = -1 };
+    void *map;
+
+    if (!s)
+        return NULL;
+
+    s->nr_ops = cfg->size / sizeof(struct kv_sqe);
+    if (s->nr_ops == 0)
+        s->nr_ops = 1;
+    if (s->nr_ops > KV_RING_MAX_ENTRIES)
+        s->nr_ops = KV_RING_MAX_ENTRIES;
+
+    // The SQ has to hold one batch.
+    for (params.entries = 1; params.entries < s->nr_ops; params.entries *= 2)
+        ;
+
+    if (ioctl(s->fd, KV_RING_SETUP, &params) < 0 ||
+        (map = mmap(NULL, params.map_size, PROT_READ | PROT_WRITE, MAP_SHARED, s->fd, 0)) == MAP_FAILED) {
+        perror("Setting up the rings failed");
+        file_teardown(s);
+        return NULL;
+    }
+    s->ring = map;
+    s->ring_size = params.map_size;
+    s->ring_flags = flags;
+
+    return s;
+}
+
+static void *ioctl_ring_setup(const struct bench_config *cfg, unsigned int thread) {
+    return ring_setup_flags(cfg, thread, 0);
+}
+
+static void *ioctl_sqpoll_setup(const struct bench_config *cfg, unsigned int thread) {
+    return ring_setup_flags(cfg, thread, KV_RING_SQPOLL);
+}
+
+static long ioctl_ring_op(void *state) {
+    struct file_state *s = state;
+    struct kv_ring_hdr *hdr = s->ring;
+    struct kv_sqe *sqes = (struct kv_sqe *)((char *)hdr + hdr->sq_off);
+    struct kv_cqe *cqes = (struct kv_cqe *)((char *)hdr + hdr->cq_off);
+    unsigned int i, done = 0;
+    long ret = s->nr_ops * sizeof(struct kv_sqe);
+
+    // The previous batch completed, so the whole SQ is free.
+    for (i = 0; i < s->nr_ops; i++) {
+        struct kv_sqe *sqe = &sqes[s->sq_tail++ & (hdr->sq_entries - 1)];
+
+        sqe->op = IOCTL_OP_GET;
+        sqe->key = s->key;
+        sqe->user_data = i;
+    }
+    __atomic_store_n(&hdr->sq_tail, s->sq_tail, __ATOMIC_RELEASE);
+
+    if (!(s->ring_flags & KV_RING_SQPOLL)) {
+        // One system call runs the whole batch, the completions are there when it returns.
+        if (ioctl(s->fd, KV_RING_ENTER, 0) < 0)
+            return -1;
+    } else {
+        // Pairs with the barrier of the SQPOLL thread between setting the flag and its last look.
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&hdr->flags, __ATOMIC_RELAXED) & KV_RING_NEED_WAKEUP)
+            ioctl(s->fd, KV_RING_ENTER, KV_ENTER_SQ_WAKEUP);
+    }
+
+    // With SQPOLL, spin until the thread got through the batch.
+    while (done < s->nr_ops) {
+        unsigned int cq_tail = __atomic_load_n(&hdr->cq_tail, __ATOMIC_ACQUIRE);
+
+        for (; s->cq_head != cq_tail; s->cq_head++, done++)
+            if (cqes[s->cq_head & (hdr->cq_entries - 1)].status < 0)
+                ret = -1;
+        __atomic_store_n(&hdr->cq_head, s->cq_head, __ATOMIC_RELEASE);
+    }
+
+    return ret;
+}
+
+// kpool: one `KPOOL_SUBMIT` of a work item with `size` rounds, 14_kernel_threads.
+
+static void *kpool_setup(const struct bench_config *cfg, unsigned int thread) {
+    (void)thread;
+    return file_setup(cfg, O_RDWR);
+}
+
+static long kpool_op(void *state) {
+    struct file_state *s = state;
+    struct kpool_submit req = { .op = KPOOL_OP_SPIN, .count = 1, .arg = s->cfg->size };
+
+    return ioctl(s->fd, KPOOL_SUBMIT, &req) < 0 ? -1 : 0;
+}
+
+static void kpool_teardown(void *state) {
+    struct file_state *s = state;
+
+    // Don't leave work behind for the next workload.
+    ioctl(s->fd, KPOOL_WAIT);
+    file_teardown(s);
+}
+
+// waitqueue: `write()` of a decimal value, which wakes up all readers and subscribers, 17_waitqueue.
+
+static void *waitqueue_setup(const struct bench_config *cfg, unsigned int thread) {
+    struct file_state *s = file_setup(cfg, O_WRONLY);
+
+    // Stay clear of the values that the default watchers wait for.
+    if (s)
+        s->value = 1000 + thread * 1000000ULL;
+    return s;
+}
+
+static long waitqueue_op(void *state) {
+    struct file_state *s = state;
+    char text[24];
+    int len = snprintf(text, sizeof(text), "%llu", (unsigned long long)s->value++);
+
+    return write(s->fd, text, len) == len ? len : -1;
+}
+
+static const struct bench_workload workloads[] = {
+    { "open", "open() and close() the device (07)", open_setup, open_op, NULL },
+    { "ring", "write() a record of <size> bytes and read() it back (08 ring minor)", ring_setup, ring_op, file_teardown },
+    { "store-read", "pread() <size> bytes at random offsets (08 store minor)", store_read_setup, store_read_op, file_teardown },
+    { "store-write", "pwrite() <size> bytes at random offsets (08 store minor)", store_setup, store_write_op, file_teardown },
+    { "deadline", "HRTD_ADD of <size> / 32 timers, 50 us from now, and read() the expiries (09)", deadline_setup, deadline_op, file_teardown },
+    { "ioctl-get", "KV_GET of one key (13)", ioctl_get_setup, ioctl_get_op, file_teardown },
+    { "ioctl-batch", "IOCTL_BATCH of <size> / 24 lookups (13)", ioctl_batch_setup, ioctl_batch_op, file_teardown },
+    { "ioctl-ring", "<size> / 32 lookups through the rings, one KV_RING_ENTER per batch (13)", ioctl_ring_setup, ioctl_ring_op, file_teardown },
+    { "ioctl-sqpoll", "<size> / 32 lookups through the rings, polled by the driver (13)", ioctl_sqpoll_setup, ioctl_ring_op, file_teardown },
+    { "kpool", "KPOOL_SUBMIT of one work item with <size> rounds (14)", kpool_setup, kpool_op, kpool_teardown },
+    { "waitqueue", "write() a new value (17)", waitqueue_setup, waitqueue_op, file_teardown },
+};
+
+/**
+ * @brief Prints how to use this program and the list of workloads.
+ */
+static void usage(const char *prog) {
+    unsigned int i;
+
+    printf("Usage: %s [-t threads] [-w warm-up secs] [-d secs] [-s size] [-f text|csv|json] [-H] <workload> <device>\n"
+           "  -H prints the CSV header first.\n\nWorkloads:\n", prog);
+    for (i = 0; i < sizeof(workloads) / sizeof(workloads[0]); i++)
+        printf("  %-12s %s\n", workloads[i].name, workloads[i].help);
+}
+
+// This is a user space program.
+int main(int argc, char **argv) {
+    struct bench_config cfg = { .threads = 1, .warmup_secs = 1, .secs = 5, .size = 64, .format = BENCH_TEXT };
+    const struct bench_workload *w = NULL;
+    struct bench_result *res;
+    int header = 0;
+    unsigned int i;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "t:w:d:s:f:H")) != -1) {
+        switch (opt) {
+            case 't':
+                cfg.threads = strtoul(optarg, NULL, 0);
+                break;
+            case 'w':
+                cfg.warmup_secs = strtod(optarg, NULL);
+                break;
+            case 'd':
+                cfg.secs = strtod(optarg, NULL);
+                break;
+            case 's':
+                cfg.size = strtoul(optarg, NULL, 0);
+                break;
+            case 'f':
+                cfg.format = !strcmp(optarg, "csv") ? BENCH_CSV : !strcmp(optarg, "json") ? BENCH_JSON : BENCH_TEXT;
+                break;
+            case 'H':
+                header = 1;
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    // The workload and the device file are the two positional arguments.
+    if (argc - optind != 2 || cfg.threads == 0 || cfg.secs <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+    for (i = 0; i < sizeof(workloads) / sizeof(workloads[0]); i++)
+        if (!strcmp(argv[optind], workloads[i].name))
+            w = &workloads[i];
+    if (!w) {
+        usage(argv[0]);
+        return 1;
+    }
+    cfg.dev = argv[optind + 1];
+
+    // The result holds a latency histogram of about 9 KiB.
+    res = malloc(sizeof(*res));
+    if (!res)
+        return 1;
+
+    if (bench_run(w, &cfg, res) < 0) {
+        printf("%s: setting up the threads failed\n", w->name);
+        return 1;
+    }
+
+    if (header)
+        bench_print_header(cfg.format);
+    bench_report(w, &cfg, res);
+
+    free(res);
+    return 0;
+}
@@ -0,0 +1,86 @@
+#!/usr/bin/env bash
+
+# Loads every example module in turn, drives its device with devbench and removes it again, so
+# regressions in throughput or latency show up in one report. Needs root.
+#
+# Usage: bench/run.sh [devbench options], e.g. bench/run.sh -f csv -t 4 > results.csv
+# The modules and bench/devbench have to be built already, `make bench` does all of that.
+
+set -euo pipefail
+
+cd "$(dirname "$0")/.."
+
+DEVBENCH=bench/devbench
+NODES=$(mktemp -d)
+HEADER=-H  # Only the first run prints the CSV header.
+
+trap 'rm -rf "$NODES"' EXIT
+
+# Unloads the module first, in case an earlier run was interrupted and left it loaded.
+load() {
+    local ko=$1
+    shift
+    rmmod "$(basename "$ko" .ko)" 2>/dev/null || true
+    insmod "$ko" "$@"
+}
+
+unload() {
+    rmmod "$(basename "$1" .ko)"
+}
+
+# Runs a workload once per size against minor <minor> of the device that is called <label> in
+# /proc/devices. The device nodes are created in a temporary folder, nothing is left in /dev.
+#   run <label> <minor> <workload> <size>...
+run() {
+    local label=$1 minor=$2 workload=$3 major node size
+    shift 3
+
+    major=$(awk -v name="$label" '$2 == name { print $1; exit }' /proc/devices)
+    if [ -z "$major" ]; then
+        echo "No device called $label in /proc/devices" >&2
+        exit 1
+    fi
+
+    # The major number changes every time a module is loaded, so always make a new node.
+    node="$NODES/$label$minor"
+    rm -f "$node"
+    mknod "$node" c "$major" "$minor"
+
+    for size in "$@"; do
+        "$DEVBENCH" ${BENCH_ARGS[@]+"${BENCH_ARGS[@]}"} $HEADER -s "$size" "$workload" "$node"
+        HEADER=
+    done
+}
+
+BENCH_ARGS=("$@")
+
+load 07_open_release_cdev/open_release_cdev.ko
+run hello_cdev 0 open 0
+unload open_release_cdev
+
+# A 1 MiB ring, so records of a few KiB don't have to wait for each other. The store is the
+# minor after the four rings.
+load 08_read_write_cdev/hello_cdev.ko ring_size=1048576
+run hello_cdev 0 ring 64 4096
+run hello_cdev 4 store-read 4096 65536
+run hello_cdev 4 store-write 4096 65536
+unload hello_cdev
+
+load 09_high_resolution_timer/hrt_deadline.ko
+run hrt_deadline 0 deadline 32 2048
+unload hrt_deadline
+
+load 13_ioctl/ioctl_example.ko
+run ioctl_example 0 ioctl-get 16
+run ioctl_example 0 ioctl-batch 24 3072 98304
+run ioctl_example 0 ioctl-ring 32 4096 131072
+run ioctl_example 0 ioctl-sqpoll 32 4096 131072
+unload ioctl_example
+
+load 14_kernel_threads/kthread.ko
+run kthread_pool 0 kpool 1000
+unload kthread
+
+load 17_waitqueue/waitqueue.ko
+run waitqueue 0 waitqueue 0
+unload waitqueue
@@ -0,0 +1,125 @@
+#ifndef LAT_HIST_H
+#define LAT_HIST_H
+
+// A latency histogram with a fixed size and a bounded error, shared by all modules.
+//
+// The histogram is log-linear, like an HdrHistogram: every power of two is split into
+// `LAT_HIST_SUB_COUNT` equal buckets. Values below `LAT_HIST_SUB_COUNT` get a bucket each. That keeps
+// the error of every bucket below 1 / `LAT_HIST_SUB_COUNT` (about 3%) with a fixed, small number of
+// buckets.
+//
+// Recording is a plain increment without any lock, so every histogram must have a single writer,
+// e.g. one per CPU or one per thread. Readers fold them with `lat_hist_add()`.
+
+#include <linux/kernel.h>  // For `ARRAY_SIZE()` and `DIV_ROUND_UP_ULL()`.
+#include <linux/bitops.h>  // For `fls64()`.
+#include <linux/math64.h>
+#include <linux/minmax.h>
+#include <linux/seq_file.h>
+#include <linux/string.h>
+
+#define LAT_HIST_SUB_BITS 5
+#define LAT_HIST_SUB_COUNT (1 << LAT_HIST_SUB_BITS)
+#define LAT_HIST_MAX_BIT 40  // Values of 2^41 ns (about 36 minutes) and more go into the last bucket.
+#define LAT_HIST_BUCKETS ((LAT_HIST_MAX_BIT - LAT_HIST_SUB_BITS + 2) * LAT_HIST_SUB_COUNT)
+
+/**
+ * @brief A histogram of latencies in nanoseconds. About 9 KiB, so allocate it dynamically.
+ */
+struct lat_hist {
+    u64 buckets[LAT_HIST_BUCKETS];
+    u64 count;
+    u64 max;
+};
+
+/**
+ * @brief Returns the histogram bucket of `value`.
+ */
+static inline unsigned int lat_hist_index(u64 value) {
+    unsigned int msb;
+
+    if (value < LAT_HIST_SUB_COUNT)
+        return value;
+
+    msb = fls64(value) - 1;
+    if (msb > LAT_HIST_MAX_BIT)
+        return LAT_HIST_BUCKETS - 1;
+
+    // The group of the power of two, then the top `LAT_HIST_SUB_BITS` bits below the most significant one.
+    return (msb - LAT_HIST_SUB_BITS + 1) * LAT_HIST_SUB_COUNT +
+           ((value >> (msb - LAT_HIST_SUB_BITS)) & (LAT_HIST_SUB_COUNT - 1));
+}
+
+/**
+ * @brief Returns the smallest value that falls into bucket `index`. The reverse of `lat_hist_index()`.
+ */
+static inline u64 lat_hist_lowest(unsigned int index) {
+    unsigned int group = index / LAT_HIST_SUB_COUNT;
+    u64 sub = index % LAT_HIST_SUB_COUNT;
+
+    if (group == 0)
+        return sub;
+
+    return (LAT_HIST_SUB_COUNT + sub) << (group - 1);
+}
+
+/**
+ * @brief Records one latency. Only the single writer of `hist` may call this.
+ */
+static inline void lat_hist_record(struct lat_hist *hist, u64 ns) {
+    hist->buckets[lat_hist_index(ns)]++;
+    hist->count++;
+    if (ns > hist->max)
+        hist->max = ns;
+}
+
+/**
+ * @brief Adds `hist` to `sum`. `hist` may be written concurrently, then the sum is a snapshot that
+ *     may be off by the few samples that came in while we were adding up.
+ */
+static inline void lat_hist_add(struct lat_hist *sum, const struct lat_hist *hist) {
+    unsigned int i;
+
+    for (i = 0; i < LAT_HIST_BUCKETS; i++)
+        sum->buckets[i] += READ_ONCE(hist->buckets[i]);
+    sum->count += READ_ONCE(hist->count);
+    sum->max = max(sum->max, READ_ONCE(hist->max));
+}
+
+/**
+ * @brief Clears a histogram. A concurrent writer may bump a bucket while we clear it. That only
+ *     costs a handful of samples.
+ */
+static inline void lat_hist_reset(struct lat_hist *hist) {
+    memset(hist, 0, sizeof(*hist));
+}
+
+/**
+ * @brief Prints the number of samples, p50, p99, p99.9 and the maximum into a seq_file.
+ */
+static inline void lat_hist_show(struct seq_file *m, const struct lat_hist *hist) {
+    static const struct {
+        const char *name;
+        u64 per_10k;  // The percentile, in units of 0.01 %.
+    } percentiles[] = { { "p50", 5000 }, { "p99", 9900 }, { "p99.9", 9990 } };
+    u64 seen, rank;
+    unsigned int i, p;
+
+    seq_printf(m, "samples: %llu\n", hist->count);
+
+    for (p = 0, i = 0, seen = 0; p < ARRAY_SIZE(percentiles) && hist->count; p++) {
+        rank = DIV_ROUND_UP_ULL(hist->count * percentiles[p].per_10k, 10000);
+
+        // Walk up to the bucket that holds the sample with this rank.
+        while (i < LAT_HIST_BUCKETS - 1 && seen + hist->buckets[i] < rank)
+            seen += hist->buckets[i++];
+
+        // Report the highest value of the bucket, but never more than the real maximum.
+        seq_printf(m, "%-6s: %llu ns\n", percentiles[p].name,
+                   min(i < LAT_HIST_BUCKETS - 1 ? lat_hist_lowest(i + 1) - 1 : hist->max, hist->max));
+    }
+
+    seq_printf(m, "max   : %llu ns\n", hist->max);
+}
+
+#endif  // #ifndef LAT_HIST_H